@@ -5,14 +5,128 @@
  hardware store database.
 */
 #define _CRT_SECURE_NO_DEPRECATE // allow use of fopen, etc in Visual Studio
-#define ID_SIZE 4
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // O_DIRECT
+#endif
+#ifndef ID_SIZE
+#define ID_SIZE 4 // may be widened at compile time (-DID_SIZE=8) for large catalogs
+#endif
 #define NAME_SIZE 20
-#define TABSIZE 40
-#define BUCKETSIZE 3
-#define OFLOWSIZE 40
+#define NAME_CHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ()\040" // characters allowed in names
+#define TABSIZE 40 // initial number of buckets; the table grows one bucket at a time
+#define BUCKETSIZE 4 // records per bucket: 4 and their control bytes fill two cache lines
+#define OFLOWSIZE 8 // records per overflow page: 8 and their control bytes fill four cache lines
+#define CACHE_LINE 64 // buckets and overflow pages take whole cache lines on disk
+#define CTRL_GROUP 16 // control bytes matched by one SSE2 compare
+#define CTRL_WIDTH(n) (((n) + CTRL_GROUP - 1) / CTRL_GROUP * CTRL_GROUP) // control bytes of a block of n slots
+#define CTRL_EMPTY 0x00 // control byte of a slot never used, so a zero-filled block is empty
+#define CTRL_TOMBSTONE 0x01 // control byte of a deleted slot
+#define CTRL_FULL 0x80 // set in the control byte of a live slot; the low 7 bits are its key's tag
+#define LOAD_FACTOR 0.75 // split a bucket when records exceed this fraction of bucket slots
+#define MAXLEVEL 48 // number of times the table can double
 #define FLUSH while( getchar() != '\n') // clean user input
 #define DEFAULT_INPUT_FILENAME "input.txt"
 #define DEFAULT_OUTPUT_FILENAME "output.txt"
+#define BENCH_OUTPUT_FILENAME "bench_output.txt"
+#define LINE_SIZE 100 // longest input line read at once, as in fgets(line, 100, ...)
+#define PARSE_BATCH 4096 // records per batch handed from parser threads to the writer
+#define MAX_THREADS 64
+#define PARSE_OK 0 // parseRecord() results
+#define PARSE_NOID 1
+#define PARSE_BADID 2
+#define PARSE_NONAME 3
+#define PARSE_BADNAME 4
+#define PARSE_LONGNAME 5
+#define PARSE_NOQTY 6
+#define PARSE_BADQTY 7
+#define PARSE_QTYRANGE 8
+#define BENCH_INPUT_FILENAME "bench_input.txt"
+#define BACKEND_STDIO 0 // every probe is an fseek + fread/fwrite
+#define BACKEND_MMAP 1 // the file is mapped and probed in place
+#define MAP_MINSIZE (1L << 20) // initial mapping; doubled as the file grows
+#define POOL_PAGESIZE 4096 // bytes per buffer pool page
+#define POOL_PAGES 256 // default buffer pool size in pages (1 MB)
+#define POOL_BYPASS (4 * POOL_PAGESIZE) // larger writes go straight to the file
+#define HASH_CUBES 0 // sum of the cubes of the ID's characters (the original hash)
+#define HASH_FNV 1 // FNV-1a over the ID
+#define HASH_MIX 2 // multiplicative mix with an xxHash-style finalizer
+#define HASH_DEFAULT HASH_MIX
+#define HASH_COUNT 3
+#define HEADER_MAGIC "HWDBHASH" // first bytes of every hash file
+#define HEADER_VERSION 6 // 1 had no superblock fields after presenceBytes, 2 no tombstones, 3 text keys, 4 no control bytes,
+						  // 5 blocks of IDs wider than 9 digits not padded to a power of two
+#define OLDEST_VERSION 3 // files from this version on are converted on open (see convertHashFile)
+#define DIAG_OUTPUT_FILENAME "diag_output.txt"
+#define PRESENCE_MAXDIGITS 8 // IDs up to this wide get an exact bitmap (10^8 bits = 12.5 MB)
+#define BLOOM_BITS (1L << 26) // Bloom filter size for wider IDs
+#define BLOOM_HASHES 4 // bits set per ID in the Bloom filter
+#define DIAG_ROWS 8 // rows in the bucket occupancy histogram
+#define WAL_SUFFIX ".wal" // the write-ahead log is the hash file's name plus this
+#define WAL_WRITE 1 // log entry: bytes written to the hash file, before and after images
+#define WAL_OPEND 2 // log entry: an insert, delete or bulk load is complete; table state follows
+#define WAL_CHECKPOINT 3 // log entry: first in the log; the hash file is complete up to here
+#define WAL_CHECKPOINT_BYTES (64L << 20) // checkpoint once the log grows past this
+#define WAL_CHUNK 65536 // bytes copied at a time for large log entries
+#define WAL_WINDOW 1000 // default group commit window in microseconds
+#define DIAG_BAR 50 // width of the longest histogram bar
+#define KEY_EMPTY 0 // packed key of a slot never used
+#define KEY_TOMBSTONE 1 // packed key of a deleted slot; stored IDs pack to their value plus 2
+#define KEY_LIVE(key) ((key) > KEY_TOMBSTONE) // slot holds a record
+#define LEGACY_TOMBSTONE '*' // first ID character of a deleted slot in a version 3 file
+#define COMPACT_MICROS 100 // default time budget of the compaction step after each delete
+#define COMPACT_DENSITY 8 // deletes compact once there is a tombstone per this many buckets
+#define MULTI_SPAN 65536 // most bytes a batched operation reads at once
+#define MULTI_GAP 4096 // a batched operation reads blocks at most this far apart together, gap included
+#define AIO_BLOCK 4096 // asynchronous requests read the aligned 4 KB pages holding a block, at most two
+#define AIO_DEPTH 32 // default requests in flight on an asynchronous queue
+#define AIO_CONFLICTS 1024 // an asynchronous request checks its bucket for changes by address % AIO_CONFLICTS
+#define AIO_DIRECT 1 // openAio() flags: read around the page cache (O_DIRECT)
+#define AIO_SYNC 2 // run every request at once, as without io_uring (with AIO_DIRECT: by the same page reads, one at a time)
+#define BATCH_OUTBUF (1 << 16) // bytes of batch results buffered before a write
+#define BATCH_SYNC 65536 // batch commands between syncs of the hash file
+#define BENCH_JSON_FILENAME "bench_results.json"
+#define OP_GET 0 // engine statistics are kept per kind of operation
+#define OP_PUT 1
+#define OP_DEL 2
+#define OP_UPD 3
+#define OP_COUNT 4
+#define SERVER_BUFSIZE 65536 // bytes of requests, and of replies, buffered per server connection
+#define SERVER_EVENTS 64 // epoll events handled per wakeup
+#define SERVER_IDLE_MS 1000 // the server syncs the hash file after this long without requests
+#define WIRE_GET 'G' // server request codes, the first byte of every request
+#define WIRE_PUT 'P'
+#define WIRE_UPD 'U'
+#define WIRE_DEL 'D'
+#define WIRE_OK 'O' // server reply codes, the first byte of every reply
+#define WIRE_NF 'N'
+#define WIRE_DUP 'X'
+#define WIRE_ERR 'E'
+#define WIRE_KEY (1 + ID_SIZE) // GET and DEL requests: code, ID
+#define WIRE_RECORD (1 + ID_SIZE + NAME_SIZE + sizeof(int)) // PUT and UPD requests: code, ID, name, qty
+#define WIRE_FOUND (1 + NAME_SIZE + sizeof(int)) // reply to a GET that found its record: code, name, qty
+#define NAMES_SUFFIX ".idx" // the name index side file is the hash file's name plus this
+#define NAMES_MAGIC "HWDBNAME" // first bytes of every name index file
+#define NAMES_BLOCK 128 // name index entries per block; the first key of each is kept in memory
+#define NAMES_DELTA 65536 // name index changes logged in memory before the side file may be rewritten
+#define RANGE_RUN (1L << 18) // records an ordered scan sorts in memory at a time; more are merged from sorted runs
+#define RANGE_RUNS_SUFFIX ".runs" // sorted runs of an ordered scan are spilled to the hash file's name plus this
+#define RANGE_READAHEAD 1024 // records read at a time from each sorted run while merging
+#define RANGE_SEEK_RATIO 8 // one lookup costs about as much as reading this many blocks in order
+#define QTY_SUFFIX ".qty" // the quantity column side file is the hash file's name plus this
+#define QTY_MAGIC "HWDBQTYC" // first bytes of every quantity column file
+#define QTY_HEADER 64 // bytes ahead of the column in its file, so the column starts on a cache line
+#define QTY_SUMSTEPS 65536 // SSE2 sum steps between emptying the 32-bit lanes (65536 * 2 * 9999 < 2^31)
+#define STOCK_TOP 10 // items listed by the stock report as the largest quantities
+#define LOCK_STRIPES 1024 // bucket reader-writer locks of a shared table; bucket b uses lock b % LOCK_STRIPES
+#define HIST_SUBBITS 7 // latency histogram: 128 linear steps per power of two (under 1% error)
+#define HIST_SHIFTS 40 // powers of two above the linear range, up to about 10^14 ns
+#define BENCH_OPS 1000000 // default operations per workload
+#define BENCH_SOCKET_FILENAME "bench_socket"
+#define BENCH_EXPORT_FILENAME "bench_export.txt"
+#define BENCH_LOW_STOCK 10 // low-stock quantity of the stock benchmark
+#define BENCH_CLIENTS 4 // connections opened by the server load generator
+#define PROBE_PAGES 4096 // overflow pages probed by the probe benchmark (1 MB, so the probes stay in cache)
+#define PROBE_QUERIES 65536 // keys the probe benchmark cycles through (a power of two)
 
 #ifdef _MSC_VER
 #include <crtdbg.h>  // needed to check for memory leaks
@@ -21,6 +135,85 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h> // offsetof
+#include <limits.h> // LONG_MAX
+
+#include <ctype.h> // toupper
+
+#ifndef _WIN32
+#define HAVE_MMAP
+#define HAVE_PTHREADS
+#include <sys/mman.h> // mmap, msync
+#include <unistd.h> // ftruncate, fsync
+#include <pthread.h>
+#define HAVE_FSYNC
+#endif
+
+#ifdef __linux__
+#define HAVE_EPOLL
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/socket.h>
+#include <sys/un.h> // sockaddr_un
+#include <fcntl.h> // O_NONBLOCK
+#include <errno.h>
+#include <signal.h> // SIGINT, SIGTERM, SIGPIPE
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING // used through the raw system calls, so liburing is not needed
+#include <linux/io_uring.h> // io_uring_params, io_uring_sqe, io_uring_cqe
+#include <sys/syscall.h> // __NR_io_uring_setup, __NR_io_uring_enter
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define HAVE_SSE2
+#include <emmintrin.h> // _mm_madd_epi16, _mm_cmplt_epi16, _mm_movemask_epi8
+#endif
+
+#ifdef HAVE_SSE2
+#define SIMD_NAME "SSE2" // control byte match used by probeBlock()
+#else
+#define SIMD_NAME "none"
+#endif
+
+#ifdef _WIN32
+#include <windows.h> // QueryPerformanceCounter
+#else
+#include <time.h> // clock_gettime
+#endif
+
+#ifdef HAVE_PTHREADS // threads of a shared table count and test bits at once, so they use atomic operations
+#define STAT_ADD(db, counter, n) ((db)->shared ? (void)__atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED) : (void)((counter) += (n)))
+#define PRESENCE_LOAD(db, i) ((db)->shared ? __atomic_load_n(&(db)->presence[i], __ATOMIC_RELAXED) : (db)->presence[i])
+#define PRESENCE_OR(db, i, bits) ((db)->shared ? (void)__atomic_fetch_or(&(db)->presence[i], (unsigned char)(bits), __ATOMIC_RELAXED) : (void)((db)->presence[i] |= (bits)))
+#define PRESENCE_AND(db, i, bits) ((db)->shared ? (void)__atomic_fetch_and(&(db)->presence[i], (unsigned char)(bits), __ATOMIC_RELAXED) : (void)((db)->presence[i] &= (bits)))
+#else
+#define STAT_ADD(db, counter, n) ((void)((counter) += (n)))
+#define PRESENCE_LOAD(db, i) ((db)->presence[i])
+#define PRESENCE_OR(db, i, bits) ((void)((db)->presence[i] |= (bits)))
+#define PRESENCE_AND(db, i, bits) ((void)((db)->presence[i] &= (bits)))
+#endif
+
+#ifdef BENCHMARK
+#ifndef _WIN32
+#include <fcntl.h> // posix_fadvise
+#include <signal.h> // kill
+#include <sys/wait.h> // waitpid
+#endif
+
+// count heap allocations so the benchmarks can check the record path is allocation-free
+long allocCount = 0;
+void *countAlloc(void *p)
+{
+	allocCount++;
+	return p;
+}
+#define malloc(n) countAlloc(malloc(n))
+#define calloc(n, size) countAlloc(calloc(n, size))
+#define realloc(p, n) countAlloc(realloc(p, n))
+#endif
 
 typedef struct record RECORD;
 struct record
@@ -30,61 +223,831 @@ struct record
 	int qty;
 };
 
+#if ID_SIZE <= 9
+typedef unsigned int PACKEDKEY; // an ID stored as a binary integer (see packID)
+#elif ID_SIZE <= 19
+typedef unsigned long long PACKEDKEY;
+#else
+#error "IDs wider than 19 digits do not fit in a packed key"
+#endif
+#if BUCKETSIZE > 32 || OFLOWSIZE > 32
+#error "control byte matches are 32-bit masks"
+#endif
+
+typedef struct payload PAYLOAD;
+struct payload // the part of a stored record after its key
+{
+	char name[NAME_SIZE]; // padded with '\0', not terminated at full length
+	short qty;
+};
+
+/*
+The hash file is a linear hash table. It starts with TABSIZE buckets,
+and every time the load factor is exceeded the bucket at the split
+pointer is split in two, so the file grows one bucket at a time.
+Buckets are reserved in groups: group 0 holds the first TABSIZE buckets,
+group g holds the TABSIZE * 2^(g-1) buckets created during round g-1.
+Records that do not fit in their bucket go to that bucket's own chain
+of overflow pages, allocated at the end of the file. The superblock
+is at offset 0, so a next pointer of 0 ends a chain.
+A bucket or page starts with one control byte per slot (CTRL_EMPTY,
+CTRL_TOMBSTONE, or CTRL_FULL and a 7-bit tag of the key, see ctrlByte),
+then its keys, then the payloads. A probe matches every control byte
+of the block against the key's with one SIMD compare (ctrlMatch), and
+only compares the keys of the slots that match and reads only the
+payload it finds. Keys keep their own KEY_EMPTY and KEY_TOMBSTONE
+states, so full scans can ignore the control bytes. On disk each
+block takes BUCKET_BYTES or PAGE_BYTES, its size rounded up to a
+power of two of at least a cache line, and starts at a multiple of
+that, so none straddles a 4 KB page (see alignOffset).
+*/
+typedef struct bucket BUCKET;
+struct bucket
+{
+	long next; // first overflow page of this bucket, 0 if none
+	unsigned char ctrl[CTRL_WIDTH(BUCKETSIZE)]; // padded to whole SIMD loads
+	PACKEDKEY key[BUCKETSIZE]; // KEY_EMPTY, KEY_TOMBSTONE or the record's packed ID
+	PAYLOAD data[BUCKETSIZE];
+};
+
+typedef struct oflowpage OFLOWPAGE;
+struct oflowpage
+{
+	long next; // next overflow page in the chain, 0 if none
+	unsigned char ctrl[CTRL_WIDTH(OFLOWSIZE)];
+	PACKEDKEY key[OFLOWSIZE];
+	PAYLOAD data[OFLOWSIZE];
+};
+
+typedef struct slotaddr SLOTADDR;
+struct slotaddr // file offsets of the three parts of a slot (see slotAddr)
+{
+	long ctrl;
+	long key;
+	long data;
+};
+
+#define BLOCK_BYTES(size) ((long)((size) <= 64 ? 64 : (size) <= 128 ? 128 : (size) <= 256 ? 256 : (size) <= 512 ? 512 : \
+	(size) <= 1024 ? 1024 : (size) <= 2048 ? 2048 : 4096)) // a power of two divides the 4 KB page
+#define BUCKET_BYTES BLOCK_BYTES(sizeof(BUCKET)) // file space per bucket
+#define PAGE_BYTES BLOCK_BYTES(sizeof(OFLOWPAGE)) // and per overflow page
+#define LINE_BYTES(size) ((long)(((size) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE)) // version 5 block spacing
+#define SAME_AS_V5 (BUCKET_BYTES == LINE_BYTES(sizeof(BUCKET)) && PAGE_BYTES == LINE_BYTES(sizeof(OFLOWPAGE))) // IDs up to 9 digits
+
+typedef struct loaditem LOADITEM;
+struct loaditem // a parsed record waiting to be bulk loaded
+{
+	long bucket;
+	long line; // input order, so the first of several duplicates wins
+	RECORD rec;
+};
+
+typedef struct loadlist LOADLIST;
+struct loadlist // records collected for loadList()
+{
+	LOADITEM *items;
+	long n;
+	long capacity;
+};
+
+typedef struct batchitem BATCHITEM;
+struct batchitem // one ID of a multiGet(), multiPut() or multiDelete() batch
+{
+	long index; // position in the caller's array
+	PACKEDKEY key;
+	long block; // next block of the ID's chain to search, 0 once the search is over
+	long link; // where the next pointer of the last block searched is
+	int searched; // put: the search for a duplicate is over
+	int dup; // put: the ID is stored already, or earlier in the batch
+	int dead; // put: the slot taken holds a tombstone
+	int oflow; // the slot is in an overflow page
+	SLOTADDR at; // where the record was found or, for a put, where it goes; at.key < 0 if nowhere
+};
+
+typedef struct parsebatch PARSEBATCH;
+struct parsebatch // parsed records on their way from a parser thread to the writer
+{
+	RECORD rec[PARSE_BATCH];
+	int n;
+	PARSEBATCH *next;
+};
+
+#ifdef HAVE_PTHREADS
+typedef struct ingest INGEST;
+struct ingest // shared state of one parallelLoad()
+{
+	char *filename;
+	PARSEBATCH *freeBatches; // empty batches for the parsers
+	PARSEBATCH *fullBatches; // filled batches for the writer
+	int running; // parser threads not finished yet
+	long lines; // lines read by all parsers
+	pthread_mutex_t lock;
+	pthread_cond_t hasFree, hasFull;
+};
+
+typedef struct ingestchunk INGESTCHUNK;
+struct ingestchunk // the byte range of the input one parser thread reads
+{
+	INGEST *ingest;
+	long start, end;
+};
+#endif
+
+#ifdef HAVE_EPOLL
+typedef struct conn CONN;
+struct conn // one client of server_control()
+{
+	int fd;
+	int eof; // the client sent its last request; close once the replies are out
+	int broken; // the connection failed or sent garbage; close it now
+	char in[SERVER_BUFSIZE]; // requests received but not served yet
+	size_t inLen;
+	char out[SERVER_BUFSIZE]; // replies not sent yet, from outStart to outLen
+	size_t outStart, outLen;
+	CONN *prev, *next; // open connections
+};
+#endif
+
+#ifdef BENCHMARK
+typedef struct histogram HISTOGRAM;
+struct histogram // HDR-style latency histogram: log-linear buckets of nanoseconds
+{
+	long long counts[(HIST_SHIFTS + 2) << HIST_SUBBITS];
+	long long total;
+	long long max;
+};
+
+typedef struct workload WORKLOAD;
+struct workload // one YCSB-style operation mix; the percentages add up to 100
+{
+	char *name;
+	int get; // lookups
+	int upd; // in-place updates of stored records
+	int churn; // delete a stored record, or put back a deleted one
+	int miss; // share of lookups aimed at IDs never stored
+	int zipf; // 1: Zipfian key choice (a few hot IDs), 0: uniform
+};
+
+typedef struct rangecheck RANGECHECK;
+struct rangecheck // what bench_range() checks about the records a range scan visits
+{
+	char last[ID_SIZE + 1]; // ID of the last record visited
+	long n; // records visited
+	long unordered; // records not after the one before them
+};
+
+#ifdef HAVE_PTHREADS
+typedef struct benchthread BENCHTHREAD;
+struct benchthread // one worker of bench_threads()
+{
+	struct hashdb *db; // HASHDB is declared further down
+	long n; // keys 0..n-1 are stored
+	long ops; // mixed phase: operations to run
+	long first, count; // churn phase: keys of this thread only
+	unsigned long long seed;
+	int churn; // 0: 95/5 lookup/update mix, 1: insert the keys, then delete the even ones
+};
+#endif
+
+#ifdef HAVE_EPOLL
+typedef struct loadclient LOADCLIENT;
+struct loadclient // one connection of the server load generator
+{
+	int fd;
+	double sent; // when the last round of requests was sent
+	char get[128]; // the requests of that round: 1 for GET, 0 for UPD
+	char buf[SERVER_BUFSIZE]; // replies read, from at to len
+	size_t len, at;
+};
+#endif
+#endif
+
+typedef struct tablestate TABLESTATE;
+struct tablestate // the table descriptor fields the superblock and the log restore
+{
+	long level, split, nbuckets, nrecords, oflowRecords, npages, freePages, fileEnd, tombstones;
+	long groupStart[MAXLEVEL + 1]; // only the first level + 2 are logged
+};
+
+typedef struct header HEADER;
+struct header // superblock, stored at offset 0 ahead of the presence bitmap
+{
+	char magic[8]; // HEADER_MAGIC, not NUL-terminated
+	int version; // HEADER_VERSION
+	int hashFunc; // HASH_CUBES, HASH_FNV or HASH_MIX
+	int idSize; // ID_SIZE the file was written with
+	int recordSize; // bytes of a packed key and payload, without the control byte (sizeof(RECORD) in version 3)
+	int bucketSize; // BUCKETSIZE
+	int oflowSize; // OFLOWSIZE
+	int tabSize; // TABSIZE
+	int clean; // 1 if the file was closed cleanly, so state is current
+	long presenceBytes; // size of the presence bitmap stored right after the header
+	TABLESTATE state; // geometry, record counts and the free page list
+};
+
+typedef struct frame FRAME;
+struct frame // one buffer pool page
+{
+	long page; // file page held (offset / POOL_PAGESIZE), -1 if free
+	int next; // next frame in the same index chain, -1 at the end
+	char ref; // CLOCK reference bit, set on every use
+	char dirty; // changed since it was read from the file
+	long lsn; // log position of the last change, which must be on disk before the page
+};
+
+typedef struct walentry WALENTRY;
+struct walentry // header of every write-ahead log entry; the payload and a checksum follow
+{
+	int type; // WAL_WRITE, WAL_OPEND or WAL_CHECKPOINT
+	long offset; // WAL_WRITE: where the bytes go in the hash file
+	long size; // WAL_WRITE: bytes written (the payload is twice this); else payload bytes
+};
+
+typedef struct opstats OPSTATS;
+struct opstats // engine statistics of one kind of operation
+{
+	long ops; // operations run
+	long probes; // buckets and overflow pages read by them
+	long oflow; // records found in (or, for puts, added to) an overflow page
+	long filtered; // answered from the presence bitmap without reading the file
+};
+
+typedef struct tablescan TABLESCAN;
+struct tablescan // what a full scan of the buckets and overflow chains finds
+{
+	long counts[DIAG_ROWS]; // buckets by records held, rows as in hashDiagnostics()
+	long probes; // blocks read to find every stored record
+	long missProbes; // blocks read to miss in every bucket
+	long tombstones; // deleted slots
+	long freeSlots; // overflow slots not holding a record, including free pages
+	long freePages; // pages on the free list
+};
+
+typedef struct namekey NAMEKEY;
+struct namekey // one name index entry; entries are sorted by name, then ID
+{
+	char name[NAME_SIZE]; // padded with '\0'
+	char id[ID_SIZE];
+};
+
+typedef struct namechange NAMECHANGE;
+struct namechange // a name index change not yet merged into the side file
+{
+	NAMEKEY key;
+	long seq; // of two changes to the same entry, the later one counts
+	int add; // 1: the entry was added, 0: removed
+};
+
+typedef struct nameheader NAMEHEADER;
+struct nameheader // first bytes of the name index file; the entries and then the fence keys follow
+{
+	char magic[8]; // NAMES_MAGIC
+	int idSize; // ID_SIZE the file was written with
+	int nameSize; // NAME_SIZE
+	int clean; // 1 if written when the hash file was closed, so the entries are current
+	long entries; // sorted entries in the file
+};
+
+typedef struct runreader RUNREADER;
+struct runreader // one sorted run being merged by rangeMerge()
+{
+	long next, end; // records of the run not read yet, as positions in the runs file
+	int at, have; // next record in buf, records in buf
+	RECORD buf[RANGE_READAHEAD];
+};
+
+typedef struct qtyheader QTYHEADER;
+struct qtyheader // first bytes of the quantity column file; the column starts QTY_HEADER bytes in
+{
+	char magic[8]; // QTY_MAGIC
+	int idSize; // ID_SIZE the file was written with
+	int clean; // 1 if written when the hash file was closed, so the column is current
+	long records; // records in the table when it was written
+};
+
+typedef struct stockitem STOCKITEM;
+struct stockitem // one result of a stock query
+{
+	long id; // the ID's value
+	int qty;
+};
+
+typedef struct stockscan STOCKSCAN;
+struct stockscan // a stock query answered by reading every record (see stockRow())
+{
+	long long sum; // quantities of every record
+	int low; // records with a quantity below this are counted...
+	long lowCount;
+	STOCKITEM *lowItems; // ...and the first lowMax of them copied here
+	long lowMax;
+	STOCKITEM *top; // min-heap of the topN largest quantities (see offerTop())
+	int topN, topCount;
+};
+
+typedef struct hashdb HASHDB;
+struct hashdb
+{
+	FILE *fp;
+	char *filename;
+	int level; // round number: TABSIZE * 2^level buckets at start of round
+	long split; // next bucket to split
+	long nbuckets; // buckets in use
+	long nrecords; // records stored
+	long oflowRecords; // records stored in overflow pages
+	long npages; // overflow pages in use
+	long freePages; // first page of the free page list, 0 if empty
+	long fileEnd; // offset of the first unallocated byte
+	long tombstones; // deleted slots not yet reclaimed by compaction
+	long compactCursor; // next bucket the compaction pass looks at
+	long compactClean; // buckets in a row the pass found nothing to do in
+	long compactMicros; // time budget of the compaction step after each delete, 0 for none
+	long groupStart[MAXLEVEL + 1]; // file offset of each bucket group
+	int hashFunc; // hash function recorded in the file header
+	unsigned char *presence; // one bit per possible ID (a Bloom filter for wide IDs), NULL to skip it
+	long presenceBits; // bits in presence
+	int presenceExact; // presence is an exact bitmap, so a set bit means the ID is stored
+	int presenceDirty; // presence changed since it was last written to the file
+	int quiet; // suppress per-record messages (benchmarks)
+	int bulk; // load input files with bulkLoad() instead of record by record
+	int threads; // parser threads for input files, 0 to read them on the main thread
+	int backend; // BACKEND_STDIO or BACKEND_MMAP
+	char *map; // BACKEND_MMAP: the mapped file
+	long mapSize; // BACKEND_MMAP: bytes of address space mapped
+	long nseeks, nreads, nwrites; // I/O calls made (a mapped fetch counts as a read)
+	OPSTATS stats[OP_COUNT]; // per operation kind: OP_GET, OP_PUT, OP_DEL, OP_UPD
+	long splits, compactions; // buckets split, and rewritten by the compaction pass
+	FRAME *frames; // BACKEND_STDIO buffer pool, NULL when disabled
+	char *poolData; // poolSize pages of POOL_PAGESIZE bytes
+	int *poolIndex; // first frame of each index chain, by page % poolSize
+	int poolSize; // pages in the pool
+	int clockHand; // next frame the CLOCK sweep looks at
+	long poolHits, poolMisses; // page lookups served from the pool, and read from the file
+	FILE *wal; // write-ahead log, NULL when updates are not logged
+	long walWindow; // group commit: microseconds an operation may wait for its fsync
+	double walPending; // when the oldest operation not yet on disk ended, 0 if none
+	long walLsn; // bytes appended to the log
+	long walDurable; // bytes of the log known to be on disk
+	long walCommits; // fsyncs of the log
+	int walSkip; // do not log writes (the presence bitmap is rebuilt instead)
+	RECORD *scratch; // reusable record buffer for splits and merges
+	long *scratchPages; // reusable page offset buffer for splits and merges
+	long scratchRecs, scratchPageCap; // capacity of the two buffers
+	FILE *names; // name index side file (see openNameIndex)
+	long nameEntries; // sorted entries in the side file
+	NAMEKEY *nameFence; // first entry of each block of NAMES_BLOCK entries in the side file
+	NAMECHANGE *nameLog; // changes since the side file was written
+	long nameChanges, nameLogCap; // changes logged, capacity of nameLog
+	long nameSorted; // leading changes of nameLog already sorted, at most one per entry
+	long nameSeq; // changes logged so far
+	long nameReads; // blocks read from the side file
+	short *qtyColumn; // quantity of every possible ID, 0 if not stored; NULL for wide IDs (see openQtyColumn)
+	char *qtyMap; // the column file in memory, QTYHEADER first
+	FILE *qtyFile;
+	long qtySize; // bytes of the column file
+	int shared; // several threads may use the table through the shared API (see shareHashFile)
+#ifdef HAVE_PTHREADS
+	int sharedPool; // pool size to restore when the table stops being shared
+	pthread_rwlock_t tableLock; // shared by every operation, exclusive for splits and compaction
+	pthread_rwlock_t *bucketLocks; // LOCK_STRIPES striped bucket locks
+	pthread_mutex_t metaLock; // overflow page allocation, the free list, counters and presence bitmap
+#endif
+};
+
+typedef struct aioreq AIOREQ;
+struct aioreq // one lookup or insert of an asynchronous queue (see openAio)
+{
+	int op; // OP_GET or OP_PUT
+	RECORD rec; // the record to insert, or the ID looked up and then the record found
+	PACKEDKEY key;
+	long address; // the ID's bucket
+	long block; // file offset of the block being read
+	int level; // 0 for the bucket, k for the k-th overflow page of its chain
+	long layout; // splits and compactions made around the queue when the search started
+	long seq; // changes made by the queue when the search started
+	int searched; // put: the search for a duplicate is over
+	int freeSlot, freeDead; // put: the slot found, as for placeRecord()
+	long link; // put: where the next pointer of the last block read is
+	SLOTADDR at; // put: where the record goes; at.key < 0 if nowhere yet
+	char *buf; // 2 * AIO_BLOCK bytes, aligned for O_DIRECT
+	void (*done)(int ok, const RECORD *rec, void *arg);
+	void *arg;
+};
+
+typedef struct aioqueue AIOQUEUE;
+struct aioqueue
+{
+	HASHDB *db;
+	int depth; // requests in flight at most
+	int fd; // the hash file, opened again for the reads of lookups
+	int putFd; // and for the reads of inserts, which always go through the page cache
+	int direct; // fd bypasses the page cache
+	int ring; // the io_uring, -1 to run requests at once (with fd < 0 through findRecord() and insert())
+	AIOREQ *reqs; // depth requests
+	int *freeReqs, nfree; // stack of requests not in use
+	char *bufs; // the requests' read buffers
+	int pending, inflight; // reads queued but not submitted, and submitted but not completed
+	long changes; // puts placed and buckets split by the queue
+	long splits; // buckets split by the queue
+	long conflicts[AIO_CONFLICTS]; // the number of the last change to each bucket, by address % AIO_CONFLICTS
+	long enters; // io_uring_enter calls
+#ifdef HAVE_IO_URING
+	void *sqRing, *cqRing;
+	size_t sqSize, cqSize, sqesSize;
+	struct io_uring_sqe *sqes;
+	unsigned *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe *cqes;
+#endif
+};
+
 // function prototypes
 FILE *openFile(char *infilename);
 void emptyFileTest(FILE *inFile);
-FILE *createHashFile();
-long hash(char *key, int size);
-void insert(const RECORD newRecord, FILE *hashFile);
-RECORD *parseLine(char line[100]);
-void search_record(FILE *hashFile);
-void insert_stdin(FILE *hashFile);
-void user_control(FILE *hashFile);
-void delete_record(FILE *hashFile);
+HASHDB *createHashFile(char *filename, int backend, int hashFunc);
+HASHDB *openHashFile(char *filename, int backend);
+int convertHashFile(char *filename);
+long legacyBytes(int version, int n);
+long legacySlots(int version, const char *block, long size, int n, LOADLIST *list);
+long alignOffset(long offset, long size);
+PACKEDKEY packID(const char *id);
+void unpackID(PACKEDKEY key, char *id);
+void packSlot(const RECORD *rec, unsigned char *ctrl, PACKEDKEY *key, PAYLOAD *data);
+void unpackSlot(PACKEDKEY key, const PAYLOAD *data, RECORD *rec);
+void slotAddr(long offset, int page, int i, SLOTADDR *at);
+unsigned char ctrlByte(PACKEDKEY key);
+unsigned int ctrlMatch(const unsigned char *ctrl, int n, unsigned char c);
+unsigned int ctrlMatchScalar(const unsigned char *ctrl, int n, unsigned char c);
+int lowestBit(unsigned int mask);
+int probeBlock(const unsigned char *ctrl, const PACKEDKEY *keys, int n, PACKEDKEY key, int *end);
+int checkHeader(const HEADER *header);
+void writeHeader(HASHDB *db, int clean);
+void closeHashFile(HASHDB *db);
+int shareHashFile(HASHDB *db, int on);
+void lockMeta(HASHDB *db);
+void unlockMeta(HASHDB *db);
+#ifdef HAVE_PTHREADS
+pthread_rwlock_t *lockBucket(HASHDB *db, const char *id, int write);
+void unlockBucket(HASHDB *db, pthread_rwlock_t *lock);
+void maintainShared(HASHDB *db);
+long sharedFind(HASHDB *db, char *targetID, RECORD *found);
+int sharedInsert(HASHDB *db, const RECORD *rec);
+long sharedDelete(HASHDB *db, char *targetID, RECORD *found);
+long sharedUpdate(HASHDB *db, const RECORD *rec);
+#endif
+void syncHashFile(HASHDB *db);
+void mapHashFile(HASHDB *db);
+void growFile(HASHDB *db, long newEnd);
+void *fetchBlock(HASHDB *db, long offset, size_t size, void *buf);
+void readBlock(HASHDB *db, long offset, size_t size, void *buf);
+void storeBlock(HASHDB *db, long offset, size_t size, const void *data);
+void setPoolSize(HASHDB *db, int npages);
+void flushPool(HASHDB *db);
+void writeFrame(HASHDB *db, int f);
+char *poolPage(HASHDB *db, long page);
+void poolCopy(HASHDB *db, long offset, size_t size, void *buf, int store);
+double clockMicros(void);
+void openWal(HASHDB *db, long windowMicros);
+void checkpointWal(HASHDB *db);
+void walWrite(HASHDB *db, long offset, size_t size, const void *data);
+void walOpEnd(HASHDB *db);
+long walTick(HASHDB *db);
+void walSync(HASHDB *db);
+void syncFile(FILE *fp);
+unsigned int walChecksum(unsigned int check, const void *data, size_t size);
+long walEntry(FILE *log, int type, long size, const void *payload);
+long getState(HASHDB *db, TABLESTATE *state);
+HASHDB *recoverHashFile(char *filename, long windowMicros);
+long walCopy(FILE *log, FILE *fp, long offset, long size, unsigned int *check);
+void rebuildPresence(HASHDB *db);
+void openNameIndex(HASHDB *db, int rebuild);
+void closeNameIndex(HASHDB *db);
+void nameIndexChange(HASHDB *db, const RECORD *rec, int add);
+void logNameChange(HASHDB *db, const RECORD *rec, int add);
+void sortNameLog(HASHDB *db);
+void mergeNameIndex(HASHDB *db);
+NAMEKEY *nameSearch(HASHDB *db, const char *name, int prefix, long *count);
+int nameQuery(char *text, int *prefix);
+int compareNameKeys(const void *a, const void *b);
+int compareNameChanges(const void *a, const void *b);
+void removeHashFile(const char *filename);
+long rangeScan(HASHDB *db, const char *low, const char *high, void (*visit)(const RECORD *rec, void *arg), void *arg);
+long rangeProbe(HASHDB *db, long low, long high, void (*visit)(const RECORD *rec, void *arg), void *arg);
+long rangeMerge(HASHDB *db, const char *low, const char *high, void (*visit)(const RECORD *rec, void *arg), void *arg);
+void spillRun(HASHDB *db, FILE **runs, RECORD *run, long n);
+int refillRun(FILE *runs, RUNREADER *reader);
+void siftRun(RUNREADER *readers, long *heap, long n, long i);
+int compareRecordIDs(const void *a, const void *b);
+long exportCatalog(HASHDB *db, const char *filename);
+void exportRecord(const RECORD *rec, void *out);
+void listRecord(const RECORD *rec, void *out);
+void batchRecord(const RECORD *rec, void *out);
+void openQtyColumn(HASHDB *db, int rebuild);
+void closeQtyColumn(HASHDB *db);
+long qtyLength(void);
+void setQty(HASHDB *db, const char *id, int qty);
+void columnRecord(const RECORD *rec, void *db);
+long scanRecords(HASHDB *db, void (*visit)(const RECORD *rec, void *arg), void *arg);
+long long stockSum(HASHDB *db);
+long lowStock(HASHDB *db, int threshold, STOCKITEM *items, long max);
+int topStock(HASHDB *db, int n, STOCKITEM *top);
+long long columnSum(HASHDB *db);
+long columnLow(HASHDB *db, int threshold, STOCKITEM *items, long max);
+int columnTop(HASHDB *db, int n, STOCKITEM *top);
+void stockRow(const RECORD *rec, void *scan);
+void offerTop(STOCKITEM *top, int n, int *count, long id, int qty);
+int compareStock(const void *a, const void *b);
+int compareStockIDs(const void *a, const void *b);
+void visitStock(HASHDB *db, const STOCKITEM *item, void (*visit)(const RECORD *rec, void *arg), void *arg);
+long findRecord(HASHDB *db, char *targetID, RECORD *found, int *oflowSlot);
+long probeRecord(HASHDB *db, char *targetID, RECORD *found, int *oflowSlot, SLOTADDR *at, OPSTATS *stats);
+long deleteRecord(HASHDB *db, char *targetID, RECORD *found, int *oflowSlot);
+long updateRecord(HASHDB *db, const RECORD *rec);
+long multiGet(HASHDB *db, RECORD *recs, long n, long *offsets);
+long multiPut(HASHDB *db, const RECORD *recs, long n, int *added);
+long multiDelete(HASHDB *db, RECORD *recs, long n, long *offsets);
+BATCHITEM *batchItems(HASHDB *db, const RECORD *recs, long n, int op);
+void multiProbe(HASHDB *db, BATCHITEM *items, long n, RECORD *recs, int op);
+void multiBlock(HASHDB *db, BATCHITEM *items, long n, const char *block, int level, RECORD *recs, int op);
+int compareBatchBlocks(const void *a, const void *b);
+int compareBatchSlots(const void *a, const void *b);
+AIOQUEUE *openAio(HASHDB *db, int depth, int flags);
+void closeAio(AIOQUEUE *q);
+void aioGet(AIOQUEUE *q, const char *id, void (*done)(int found, const RECORD *rec, void *arg), void *arg);
+void aioPut(AIOQUEUE *q, const RECORD *rec, void (*done)(int added, const RECORD *rec, void *arg), void *arg);
+AIOREQ *aioRequest(AIOQUEUE *q, int op, const RECORD *rec, void (*done)(int ok, const RECORD *rec, void *arg), void *arg);
+void aioStart(AIOQUEUE *q, AIOREQ *req);
+void aioRead(AIOQUEUE *q, AIOREQ *req);
+int aioPoll(AIOQUEUE *q, int wait);
+void aioDrain(AIOQUEUE *q);
+int aioStep(AIOQUEUE *q, AIOREQ *req);
+void aioFinish(AIOQUEUE *q, AIOREQ *req, int ok);
+long compactBucket(HASHDB *db, long bucket);
+void compactStep(HASHDB *db, long budgetMicros);
+long hash(char *key, int size, int func);
+int hashByName(char *name);
+long keySpace(void);
+void hashDiagnostics(HASHDB *db);
+void scanTable(HASHDB *db, TABLESCAN *scan);
+void fillLabel(int row, char label[20]);
+void engineStats(HASHDB *db, FILE *out, int batch);
+void statLine(FILE *out, int batch, const char *name, double value, int decimals);
+void compareHashes(char *infilename);
+long presenceBit(HASHDB *db, const char *id, int i);
+int presenceTest(HASHDB *db, const char *id);
+void presenceSet(HASHDB *db, const char *id);
+void presenceClear(HASHDB *db, const char *id);
+long bucketAddress(HASHDB *db, char *key);
+long bucketOffset(HASHDB *db, long bucket);
+long allocPage(HASHDB *db);
+void freePage(HASHDB *db, long offset);
+void fillBucket(HASHDB *db, long bucket, RECORD *recs, int n, long *pages, int *npages);
+long addBucket(HASHDB *db);
+void splitBucket(HASHDB *db);
+void reserveScratch(HASHDB *db, long nrecs, long npages);
+int insert(const RECORD *newRecord, HASHDB *db);
+void placeRecord(HASHDB *db, const RECORD *newRecord, long address, SLOTADDR *at, long link, int npages, int freeSlot, int freeDead);
+int compareLoadItems(const void *a, const void *b);
+void buildTable(HASHDB *db, LOADITEM *items, long n);
+long mergeBucket(HASHDB *db, long bucket, LOADITEM *items, long n);
+long bulkLoad(HASHDB *db, FILE *inFile);
+void addLoadItem(LOADLIST *list, const RECORD *rec);
+long loadList(HASHDB *db, LOADLIST *list);
+long parallelLoad(HASHDB *db, char *filename, int nthreads);
+#ifdef HAVE_PTHREADS
+void *ingestWorker(void *arg);
+void queueBatch(INGEST *ingest, PARSEBATCH *batch);
+#endif
+int parseRecord(const char *line, RECORD *rec, char field[LINE_SIZE]);
+void copyField(char field[LINE_SIZE], const char *token, size_t len);
+void parseMessage(int code, const char *field);
+int parseLine(char line[100], RECORD *rec);
+void search_record(HASHDB *db);
+void name_search(HASHDB *db);
+void range_search(HASHDB *db);
+void stock_report(HASHDB *db);
+void insert_stdin(HASHDB *db);
+void insert_file(HASHDB *db);
+void user_control(HASHDB *db);
+void delete_record(HASHDB *db);
+long batch_control(HASHDB *db, FILE *commands, FILE *results);
+int batchID(const char *arg);
+#ifdef HAVE_EPOLL
+long server_control(HASHDB *db, const char *path);
+void serverStop(int sig);
+long serveConnection(HASHDB *db, CONN *conn);
+size_t requestSize(char code);
+size_t serveRequest(HASHDB *db, const char *req, char *reply);
+#endif
+#ifdef BENCHMARK
+int benchmark(int argc, char *argv[]);
+#endif
 
 // argc = 2, argv[] = "HardwareDatabase.c", "input.txt"
+// add -mmap to probe a memory-mapped hash file instead of using fseek/fread
+// add -bulk to load input files in one sorted pass instead of record by record
+// add -threads N to parse input files on N threads
+// add -hash cubes|fnv|mix to pick the hash function stored in the new file
+// add -diag to load the input with every hash function and compare them
+// add -pool N to cache N pages of the hash file (0 turns the cache off)
+// add -wal MS to log updates, committing them at most MS milliseconds apart
+// add -recover to repair output.txt from its log after a crash and continue
+// add -rebuild to rebuild output.txt from the input file instead of reopening it
+// add -batch FILE to run the commands in FILE (- for stdin) instead of the menu
+// add -stats FILE to write the engine statistics to FILE on exit
+// add -serve PATH to serve the table over a Unix domain socket at PATH instead of the menu
+// add -export FILE to write every record to FILE in ID order, as input lines, instead of the menu
 int main(int argc, char *argv[])
 {
-	// debugging
-  	printf("Deleting old output.txt\n");
-	remove(DEFAULT_OUTPUT_FILENAME);
+	char *inArg = DEFAULT_INPUT_FILENAME, *batchArg = NULL, *statsArg = NULL, *serveArg = NULL, *exportArg = NULL;
+	int i, backend = BACKEND_STDIO, bulk = 0, threads = 0, hashFunc = HASH_DEFAULT, diag = 0;
+	int pool = POOL_PAGES, wal = 0, recover = 0, rebuild = 0;
+	long walWindow = WAL_WINDOW;
+	FILE *commands = NULL, *results = stdout;
+	HASHDB *db = NULL;
 
-	char infilename[100];
-	strcpy(infilename, argv[1]); // argv[1] is input.txt
+#ifdef BENCHMARK
+	if (argc > 1 && strcmp(argv[1], "-bench") == 0)
+		return benchmark(argc, argv);
+#endif
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-mmap") == 0)
+			backend = BACKEND_MMAP;
+		else if (strcmp(argv[i], "-bulk") == 0)
+			bulk = 1;
+		else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-hash") == 0 && i + 1 < argc)
+		{
+			hashFunc = hashByName(argv[++i]);
+			if (hashFunc < 0)
+			{
+				printf("Unknown hash function %s! Use cubes, fnv or mix.\n", argv[i]);
+				exit(105);
+			}
+		}
+		else if (strcmp(argv[i], "-diag") == 0)
+			diag = 1;
+		else if (strcmp(argv[i], "-pool") == 0 && i + 1 < argc)
+			pool = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-wal") == 0 && i + 1 < argc)
+		{
+			wal = 1;
+			walWindow = (long)(atof(argv[++i]) * 1000);
+		}
+		else if (strcmp(argv[i], "-recover") == 0)
+			recover = 1;
+		else if (strcmp(argv[i], "-rebuild") == 0)
+			rebuild = 1;
+		else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc)
+			batchArg = argv[++i];
+		else if (strcmp(argv[i], "-stats") == 0 && i + 1 < argc)
+			statsArg = argv[++i];
+		else if (strcmp(argv[i], "-serve") == 0 && i + 1 < argc)
+			serveArg = argv[++i];
+		else if (strcmp(argv[i], "-export") == 0 && i + 1 < argc)
+			exportArg = argv[++i];
+		else
+			inArg = argv[i];
+	}
 
-	FILE *inFile = openFile(infilename); // open the file
-	if (!inFile) 
+	if (batchArg)
 	{
-		printf("Using default file input.txt\n", infilename);
-		inFile = fopen(DEFAULT_INPUT_FILENAME, "r");
-		if (!inFile) // check for default file
+		commands = strcmp(batchArg, "-") == 0 ? stdin : fopen(batchArg, "r");
+		if (!commands)
+		{
+			printf("Unable to open %s!\n", batchArg);
+			exit(101);
+		}
+#ifndef _WIN32
+		// results keep stdout to themselves; everything else is printed to stderr
+		results = fdopen(dup(fileno(stdout)), "w");
+		if (!results || dup2(fileno(stderr), fileno(stdout)) < 0)
 		{
-			printf("Unable to open input.txt! Exiting.\n");
+			printf("Could not set up the batch results stream.\n");
 			exit(101);
 		}
+#endif
+		setvbuf(results, NULL, _IOFBF, BATCH_OUTBUF);
 	}
-	emptyFileTest(inFile); // check if input.txt is empty
 
-	FILE *hashFile = createHashFile(); // initialize binary file for item database
+	if (recover)
+		db = recoverHashFile(DEFAULT_OUTPUT_FILENAME, walWindow);
 
-	char line[100];
-	RECORD *newRecord;
-	// write item db from input file:
-	while (fgets(line, 100, inFile))
+	if (wal && backend == BACKEND_MMAP)
 	{
-		newRecord = parseLine(line);
-		insert(*newRecord, hashFile);
-		free(newRecord);
+		printf("The write-ahead log needs the stdio backend; ignoring -mmap.\n");
+		backend = BACKEND_STDIO;
 	}
 
-	user_control(hashFile);
+	// serve the table left by the last run unless asked to rebuild it
+	if (!db && !rebuild && !diag)
+	{
+		db = openHashFile(DEFAULT_OUTPUT_FILENAME, backend);
+		if (db)
+			printf("Run with -rebuild to load %s again.\n", inArg);
+	}
 
-	// close file validation
-	if (fclose(hashFile) == EOF)
+	if (db) // recovered or reopened: the options a new table gets below
 	{
-		printf("Error closing hash file!\nExiting.\n");
-		exit(104);
+		db->bulk = bulk;
+		db->threads = threads;
+		db->quiet = commands != NULL || serveArg != NULL || exportArg != NULL;
+		if (pool != db->poolSize)
+			setPoolSize(db, pool);
+		if (wal && !db->wal)
+			openWal(db, walWindow);
 	}
+	else
+	{
+		// debugging
+	  	printf("Deleting old output.txt\n");
+		removeHashFile(DEFAULT_OUTPUT_FILENAME);
+
+		char infilename[100];
+		strcpy(infilename, inArg); // argv[1] is input.txt
+
+		FILE *inFile = openFile(infilename); // open the file
+		if (!inFile) 
+		{
+			printf("Using default file input.txt\n", infilename);
+			strcpy(infilename, DEFAULT_INPUT_FILENAME);
+			inFile = fopen(DEFAULT_INPUT_FILENAME, "r");
+			if (!inFile) // check for default file
+			{
+				printf("Unable to open input.txt! Exiting.\n");
+				exit(101);
+			}
+		}
+		emptyFileTest(inFile); // check if input.txt is empty
+		if (diag)
+		{
+			fclose(inFile);
+			compareHashes(infilename);
+			return 0;
+		}
+
+		db = createHashFile(DEFAULT_OUTPUT_FILENAME, backend, hashFunc); // initialize binary file for item database
+		db->bulk = bulk;
+		db->threads = threads;
+		db->quiet = commands != NULL || serveArg != NULL || exportArg != NULL;
+		if (pool != POOL_PAGES)
+			setPoolSize(db, pool);
+		if (wal)
+			openWal(db, walWindow);
+
+		char line[100];
+		RECORD newRecord;
+		// write item db from input file:
+		if (db->threads > 0)
+			parallelLoad(db, infilename, db->threads);
+		else if (db->bulk)
+			bulkLoad(db, inFile);
+		else
+		{
+			while (fgets(line, 100, inFile))
+			{
+				if (parseLine(line, &newRecord) == PARSE_OK)
+					insert(&newRecord, db);
+			}
+			syncHashFile(db);
+		}
+	}
+
+	if (exportArg)
+		exportCatalog(db, exportArg);
+	else if (serveArg)
+	{
+#ifdef HAVE_EPOLL
+		server_control(db, serveArg);
+#else
+		printf("Server mode needs epoll, which this platform lacks.\n");
+#endif
+	}
+	else if (commands)
+	{
+		batch_control(db, commands, results);
+		if (commands != stdin)
+			fclose(commands);
+		if (results != stdout)
+			fclose(results);
+	}
+	else
+		user_control(db);
+
+	if (statsArg)
+	{
+		FILE *statsFile = fopen(statsArg, "w");
+		if (statsFile)
+		{
+			engineStats(db, statsFile, 0);
+			fclose(statsFile);
+		}
+		else
+			printf("Couldn't open %s for writing.\n", statsArg);
+	}
+	closeHashFile(db);
 
 	// check for memory leak
 	#ifdef _MSC_VER
@@ -135,398 +1098,7809 @@ void emptyFileTest(FILE *inFile)
 	}
 }
 
-/**********************CREATEHASHFILE*************************
-The createHashFile function takes no input and opens a default
-output file name. It tests to see if we can write to the file.
-Post  returns FILE * to the opened output file
+/**********************CREATEHASHFILE*************************
+The createHashFile function takes an output file name and opens
+it for writing. It writes the file header and the initial
+TABSIZE empty buckets and returns the table descriptor.
+backend selects how records are read and written afterwards;
+BACKEND_MMAP falls back to BACKEND_STDIO where mmap is missing.
+hashFunc is recorded in the header and used for every record.
+Post  returns HASHDB * which later needs closeHashFile()
+*/
+HASHDB *createHashFile(char *filename, int backend, int hashFunc)
+{
+	printf("Opening output file: %s\n\n", filename);
+	FILE *hashFile = fopen(filename, "w+b");
+	static char hashtable[TABSIZE * BUCKET_BYTES]; // empty buckets
+	HEADER header = { 0 };
+	long presenceBits = ID_SIZE <= PRESENCE_MAXDIGITS ? keySpace() : BLOOM_BITS;
+	long presenceBytes = alignOffset(sizeof(HEADER) + presenceBits / 8 + 1, POOL_PAGESIZE) - sizeof(HEADER); // buckets start on a page
+	unsigned char *presence = (unsigned char *)calloc(presenceBytes, 1);
+
+	if (!hashFile) // file validation
+	{
+		printf("Couldn't open %s for writing.\n", filename);
+		exit(201);
+	}
+
+	memcpy(header.magic, HEADER_MAGIC, sizeof header.magic);
+	header.hashFunc = hashFunc;
+	header.idSize = ID_SIZE;
+	header.presenceBytes = presenceBytes;
+	if (!presence)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	if (fwrite(&header, sizeof (HEADER), 1, hashFile) < 1 ||
+		fwrite(presence, 1, presenceBytes, hashFile) < (size_t)presenceBytes ||
+		fwrite(hashtable, BUCKET_BYTES, TABSIZE, hashFile) < TABSIZE ||
+		fflush(hashFile) == EOF)
+	{
+		printf("Hash table could not be created. Abort!\n");
+		exit(202);
+	}
+
+	HASHDB *db = (HASHDB *)calloc(1, sizeof(HASHDB));
+	if (!db)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	db->fp = hashFile;
+	db->filename = filename;
+	db->nbuckets = TABSIZE;
+	db->compactMicros = COMPACT_MICROS;
+	db->hashFunc = hashFunc;
+	db->presence = presence;
+	db->presenceBits = presenceBits;
+	db->presenceExact = ID_SIZE <= PRESENCE_MAXDIGITS;
+	db->fileEnd = sizeof(HEADER) + presenceBytes + TABSIZE * BUCKET_BYTES;
+	db->groupStart[0] = sizeof(HEADER) + presenceBytes;
+#ifdef HAVE_MMAP
+	db->backend = backend;
+	if (backend == BACKEND_MMAP)
+		mapHashFile(db);
+#else
+	if (backend == BACKEND_MMAP)
+		printf("Memory-mapped files are not supported here; using stdio.\n");
+#endif
+	setPoolSize(db, POOL_PAGES);
+	writeHeader(db, 0);
+	rewind(hashFile);
+	openNameIndex(db, 1);
+	openQtyColumn(db, 1);
+	return db;
+}
+
+/**********************OPENHASHFILE*************************
+Opens a hash file written by an earlier run without reading its
+records: the table geometry and counts come from the superblock
+and the presence bitmap is read in one call. A file that was not
+closed cleanly is repaired from its write-ahead log. Returns NULL
+if there is no usable file, so the caller can rebuild it.
+Post  returns HASHDB * which later needs closeHashFile()
+*/
+HASHDB *openHashFile(char *filename, int backend)
+{
+	char name[FILENAME_MAX];
+	HEADER header;
+	FILE *hashFile = fopen(filename, "r+b");
+	FILE *log;
+	HASHDB *db;
+
+	if (!hashFile)
+		return NULL;
+	if (fread(&header, sizeof header, 1, hashFile) == 1 && header.version >= OLDEST_VERSION &&
+		header.version < HEADER_VERSION && !(header.version == 5 && SAME_AS_V5) &&
+		memcmp(header.magic, HEADER_MAGIC, sizeof header.magic) == 0) // convert, then open that
+	{
+		fclose(hashFile);
+		return convertHashFile(filename) ? openHashFile(filename, backend) : NULL;
+	}
+	rewind(hashFile);
+	if (fread(&header, sizeof header, 1, hashFile) < 1 || !checkHeader(&header))
+	{
+		printf("%s is not a hash file this build can read.\n", filename);
+		fclose(hashFile);
+		return NULL;
+	}
+	sprintf(name, "%s%s", filename, WAL_SUFFIX);
+	if (!header.clean)
+	{
+		fclose(hashFile);
+		log = fopen(name, "rb");
+		if (log)
+		{
+			fclose(log);
+			return recoverHashFile(filename, WAL_WINDOW);
+		}
+		printf("%s was not closed cleanly and has no log to repair it from.\n", filename);
+		return NULL;
+	}
+	remove(name); // the file was closed after this log was last needed
+
+	printf("Opening hash file: %s\n\n", filename);
+	db = (HASHDB *)calloc(1, sizeof(HASHDB));
+	if (!db || !(db->presence = (unsigned char *)malloc(header.presenceBytes)))
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	if (fread(db->presence, header.presenceBytes, 1, hashFile) < 1)
+	{
+		printf("Fatal read error! Abort!\n");
+		exit(304);
+	}
+	db->fp = hashFile;
+	db->filename = filename;
+	db->hashFunc = header.hashFunc;
+	db->level = (int)header.state.level;
+	db->split = header.state.split;
+	db->nbuckets = header.state.nbuckets;
+	db->nrecords = header.state.nrecords;
+	db->oflowRecords = header.state.oflowRecords;
+	db->npages = header.state.npages;
+	db->freePages = header.state.freePages;
+	db->fileEnd = header.state.fileEnd;
+	db->tombstones = header.state.tombstones;
+	db->compactMicros = COMPACT_MICROS;
+	memcpy(db->groupStart, header.state.groupStart, sizeof db->groupStart);
+	db->presenceBits = ID_SIZE <= PRESENCE_MAXDIGITS ? keySpace() : BLOOM_BITS;
+	db->presenceExact = ID_SIZE <= PRESENCE_MAXDIGITS;
+#ifdef HAVE_MMAP
+	db->backend = backend;
+	if (backend == BACKEND_MMAP)
+		mapHashFile(db);
+#endif
+	setPoolSize(db, POOL_PAGES);
+	writeHeader(db, 0); // not clean again until closeHashFile()
+	syncHashFile(db);
+	openNameIndex(db, 0);
+	openQtyColumn(db, 0);
+	printf("%ld records in %ld buckets.\n", db->nrecords, db->nbuckets);
+	return db;
+}
+
+/**********************CONVERTHASHFILE*************************
+Rewrites a version 3, 4 or 5 hash file in the current layout.
+Version 3 stored each record as its text ID, name and quantity,
+three to a 104-byte bucket, so buckets straddled cache lines and
+every probe compared strings. Version 4 packed the keys but had no
+control bytes, so a probe compared every key up to the first empty
+slot. Version 5 rounded blocks up to whole cache lines only, so
+with IDs wider than 9 digits they straddled 4 KB pages; files of
+narrower IDs have the current layout and are opened as they are.
+Every bucket and overflow chain of the old file is read once, the
+records are bulk loaded into a new file with the same hash function,
+and the new file, with its name index and quantity column, replaces
+the old one. Returns 1 if the file was converted, or 0 if it was
+written with other sizes or was not closed cleanly.
+*/
+int convertHashFile(char *filename)
+{
+	char name[FILENAME_MAX], from[FILENAME_MAX], newName[FILENAME_MAX], *block;
+	char *suffixes[] = { "", NAMES_SUFFIX, QTY_SUFFIX };
+	HEADER header;
+	FILE *old = fopen(filename, "rb"), *side;
+	long bucketBytes, pageBytes, blockBytes, bucket, first, size, offset, oldSize, newSize, records;
+	int group, nslots, i;
+	LOADLIST list = { NULL, 0, 0 };
+	HASHDB *db;
+
+	if (!old || fread(&header, sizeof header, 1, old) < 1)
+	{
+		printf("Couldn't read %s.\n", filename);
+		exit(208);
+	}
+	if (header.idSize != ID_SIZE || header.tabSize != TABSIZE || header.hashFunc < 0 || header.hashFunc >= HASH_COUNT ||
+		header.recordSize != (int)(header.version == 3 ? sizeof(RECORD) : sizeof(PACKEDKEY) + sizeof(PAYLOAD)) || !header.clean)
+	{
+		printf(header.clean ? "%s was written with other sizes and cannot be converted.\n" :
+			"%s was not closed cleanly; recover it with the build that wrote it first.\n", filename);
+		fclose(old);
+		return 0;
+	}
+	bucketBytes = legacyBytes(header.version, header.bucketSize);
+	pageBytes = legacyBytes(header.version, header.oflowSize);
+	block = (char *)malloc(bucketBytes > pageBytes ? bucketBytes : pageBytes);
+	if (!block)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	printf("Converting %s from version %d to the version %d layout.\n", filename, header.version, HEADER_VERSION);
+	for (group = 0, first = 0, size = TABSIZE; first < header.state.nbuckets; group++)
+	{
+		for (bucket = first; bucket < first + size && bucket < header.state.nbuckets; bucket++)
+		{
+			offset = header.state.groupStart[group] + (bucket - first) * bucketBytes;
+			nslots = header.bucketSize;
+			blockBytes = bucketBytes;
+			while (offset)
+			{
+				if (fseek(old, offset, SEEK_SET) != 0 || fread(block, blockBytes, 1, old) < 1)
+				{
+					printf("Fatal read error! Abort!\n");
+					exit(304);
+				}
+				offset = legacySlots(header.version, block, blockBytes, nslots, &list);
+				nslots = header.oflowSize;
+				blockBytes = pageBytes;
+			}
+		}
+		first += size;
+		size = first;
+	}
+	fseek(old, 0, SEEK_END);
+	oldSize = ftell(old);
+	fclose(old);
+	free(block);
+
+	sprintf(newName, "%s.convert", filename);
+	db = createHashFile(newName, BACKEND_STDIO, header.hashFunc);
+	db->quiet = 1;
+	records = loadList(db, &list);
+	newSize = db->fileEnd;
+	closeHashFile(db);
+	for (i = 0; i < (int)(sizeof suffixes / sizeof suffixes[0]); i++)
+	{
+		sprintf(name, "%s%s", filename, suffixes[i]);
+		sprintf(from, "%s%s", newName, suffixes[i]);
+		if (i > 0 && !(side = fopen(from, "rb"))) // wide IDs have no quantity column
+			continue;
+		if (i > 0)
+			fclose(side);
+		remove(name);
+		if (rename(from, name) != 0)
+		{
+			printf("Could not replace %s with %s. Abort!\n", name, from);
+			exit(206);
+		}
+	}
+	printf("Converted %ld records: %ld bytes before, %ld after (%.1f and %.1f bytes per record).\n", records,
+		oldSize, newSize, oldSize / (records + 1e-9), newSize / (records + 1e-9));
+	return 1;
+}
+
+/**********************LEGACYBYTES*************************
+Returns the bytes a block of n slots took in a version 3, 4 or 5 file.
+*/
+long legacyBytes(int version, int n)
+{
+	if (version == 3) // the records, then the next pointer, padded as the struct was
+		return alignOffset(n * sizeof(RECORD), sizeof(long)) + sizeof(long);
+	// version 4: the next pointer, the keys, then the payloads, in whole cache lines; version 5 adds the control bytes
+	return alignOffset(alignOffset(sizeof(long) + (version == 5 ? CTRL_WIDTH(n) : 0) +
+		n * (sizeof(PACKEDKEY) + sizeof(PAYLOAD)), sizeof(long)), CACHE_LINE);
+}
+
+/**********************LEGACYSLOTS*************************
+Adds the records of a block of n slots read from a version 3, 4 or
+5 file to a bulk load list. Returns the block's next pointer.
+*/
+long legacySlots(int version, const char *block, long size, int n, LOADLIST *list)
+{
+	long keyStart = sizeof(long) + (version == 5 ? CTRL_WIDTH(n) : 0); // version 5 has control bytes before the keys
+	const RECORD *slots = (const RECORD *)block;
+	const PACKEDKEY *keys = (const PACKEDKEY *)(block + keyStart);
+	const PAYLOAD *data = (const PAYLOAD *)(block + keyStart + n * sizeof(PACKEDKEY));
+	RECORD rec;
+	long next;
+	int k;
+
+	for (k = 0; k < n; k++)
+	{
+		if (version == 3 && *slots[k].id != '\0' && *slots[k].id != LEGACY_TOMBSTONE)
+			addLoadItem(list, &slots[k]);
+		else if (version >= 4 && KEY_LIVE(keys[k]))
+		{
+			unpackSlot(keys[k], &data[k], &rec);
+			addLoadItem(list, &rec);
+		}
+	}
+	memcpy(&next, version == 3 ? block + size - sizeof(long) : block, sizeof(long));
+	return next;
+}
+
+/**********************CHECKHEADER*************************
+Returns 1 if a superblock was written by a build with the same
+record and table layout as this one.
+*/
+int checkHeader(const HEADER *header)
+{
+	long presenceBits = ID_SIZE <= PRESENCE_MAXDIGITS ? keySpace() : BLOOM_BITS;
+
+	return memcmp(header->magic, HEADER_MAGIC, sizeof header->magic) == 0 &&
+		(header->version == HEADER_VERSION || (header->version == 5 && SAME_AS_V5)) && header->idSize == ID_SIZE &&
+		header->recordSize == sizeof(PACKEDKEY) + sizeof(PAYLOAD) && header->bucketSize == BUCKETSIZE &&
+		header->oflowSize == OFLOWSIZE && header->tabSize == TABSIZE &&
+		header->hashFunc >= 0 && header->hashFunc < HASH_COUNT &&
+		header->presenceBytes > presenceBits / 8;
+}
+
+/**********************WRITEHEADER*************************
+Writes the superblock with the current table state. clean is 1
+only when the file is being closed. The log keeps its own copy
+of the state, so the superblock is not logged.
+*/
+void writeHeader(HASHDB *db, int clean)
+{
+	HEADER header;
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, HEADER_MAGIC, sizeof header.magic);
+	header.version = HEADER_VERSION;
+	header.hashFunc = db->hashFunc;
+	header.idSize = ID_SIZE;
+	header.recordSize = sizeof(PACKEDKEY) + sizeof(PAYLOAD);
+	header.bucketSize = BUCKETSIZE;
+	header.oflowSize = OFLOWSIZE;
+	header.tabSize = TABSIZE;
+	header.clean = clean;
+	header.presenceBytes = db->groupStart[0] - sizeof(HEADER);
+	getState(db, &header.state);
+	db->walSkip = 1;
+	storeBlock(db, 0, sizeof header, &header);
+	db->walSkip = 0;
+}
+
+/**********************CLOSEHASHFILE*************************
+Flushes the hash file, marks its superblock clean and closes it,
+and releases the table descriptor.
+*/
+void closeHashFile(HASHDB *db)
+{
+	char name[FILENAME_MAX];
+
+	shareHashFile(db, 0);
+	closeNameIndex(db);
+	closeQtyColumn(db);
+	syncHashFile(db);
+	if (db->wal) // the records are on disk before the superblock says so
+		syncFile(db->fp);
+	writeHeader(db, 1);
+	syncHashFile(db);
+	if (db->wal) // a clean shutdown leaves nothing to recover
+	{
+		syncFile(db->fp);
+		fclose(db->wal);
+		sprintf(name, "%s%s", db->filename, WAL_SUFFIX);
+		remove(name);
+	}
+#ifdef HAVE_MMAP
+	if (db->map)
+		munmap(db->map, db->mapSize);
+#endif
+	// close file validation
+	if (fclose(db->fp) == EOF)
+	{
+		printf("Error closing hash file!\nExiting.\n");
+		exit(104);
+	}
+	setPoolSize(db, 0);
+	free(db->presence);
+	free(db->scratch);
+	free(db->scratchPages);
+	free(db);
+}
+
+/**********************SHAREHASHFILE*************************
+Turns the shared API on or off. While a table is shared, any
+number of threads may call sharedFind(), sharedInsert(),
+sharedDelete() and sharedUpdate() at once. All I/O is positioned
+(pread/pwrite), so no thread moves a file position another relies
+on. Every operation holds tableLock shared and the striped lock of
+its bucket, shared for lookups and exclusive for changes, so
+lookups run in parallel with each other and with changes to other
+buckets. Overflow page allocation, the free list, the record
+counters and the presence bitmap are guarded by metaLock. Splits
+and compaction move records between buckets, so they wait for
+tableLock exclusively. The buffer pool is switched off while the
+table is shared, and a logged or mapped table cannot be shared.
+The engine statistics are counted, and the presence bits read,
+with atomic operations while the table is shared (see STAT_ADD).
+Returns 1 on success.
+*/
+int shareHashFile(HASHDB *db, int on)
+{
+#ifdef HAVE_PTHREADS
+	int i;
+
+	if (on == db->shared)
+		return 1;
+	if (on)
+	{
+		if (db->wal || db->backend == BACKEND_MMAP)
+		{
+			printf("Only an unlogged stdio table can be shared between threads.\n");
+			return 0;
+		}
+		syncHashFile(db);
+		db->sharedPool = db->poolSize;
+		setPoolSize(db, 0);
+		db->bucketLocks = (pthread_rwlock_t *)malloc(LOCK_STRIPES * sizeof(pthread_rwlock_t));
+		if (!db->bucketLocks)
+		{
+			printf("Out of memory! Abort!\n");
+			exit(204);
+		}
+		for (i = 0; i < LOCK_STRIPES; i++)
+			pthread_rwlock_init(&db->bucketLocks[i], NULL);
+		pthread_rwlock_init(&db->tableLock, NULL);
+		pthread_mutex_init(&db->metaLock, NULL);
+		db->shared = 1;
+		return 1;
+	}
+	for (i = 0; i < LOCK_STRIPES; i++)
+		pthread_rwlock_destroy(&db->bucketLocks[i]);
+	free(db->bucketLocks);
+	db->bucketLocks = NULL;
+	pthread_rwlock_destroy(&db->tableLock);
+	pthread_mutex_destroy(&db->metaLock);
+	db->shared = 0;
+	fflush(db->fp); // drop anything stdio read ahead before the positioned writes
+	setPoolSize(db, db->sharedPool);
+	return 1;
+#else
+	if (on)
+		printf("Threads are not supported here; the table cannot be shared.\n");
+	return !on;
+#endif
+}
+
+/**********************LOCKMETA*************************
+Takes the lock on overflow page allocation, the free list,
+the record counters and the presence bitmap, if the table is
+shared between threads.
+*/
+void lockMeta(HASHDB *db)
+{
+#ifdef HAVE_PTHREADS
+	if (db->shared)
+		pthread_mutex_lock(&db->metaLock);
+#endif
+}
+
+/**********************UNLOCKMETA*************************
+Releases the lock taken by lockMeta().
+*/
+void unlockMeta(HASHDB *db)
+{
+#ifdef HAVE_PTHREADS
+	if (db->shared)
+		pthread_mutex_unlock(&db->metaLock);
+#endif
+}
+
+#ifdef HAVE_PTHREADS
+/**********************LOCKBUCKET*************************
+Takes tableLock shared, so the table cannot split under the
+caller, then the striped lock of the bucket an ID hashes to:
+shared to read it, exclusive (write) to change it. Returns the
+bucket lock for unlockBucket().
+*/
+pthread_rwlock_t *lockBucket(HASHDB *db, const char *id, int write)
+{
+	pthread_rwlock_t *lock;
+
+	pthread_rwlock_rdlock(&db->tableLock);
+	lock = &db->bucketLocks[bucketAddress(db, (char *)id) % LOCK_STRIPES];
+	if (write)
+		pthread_rwlock_wrlock(lock);
+	else
+		pthread_rwlock_rdlock(lock);
+	return lock;
+}
+
+/**********************UNLOCKBUCKET*************************
+Releases the locks taken by lockBucket().
+*/
+void unlockBucket(HASHDB *db, pthread_rwlock_t *lock)
+{
+	pthread_rwlock_unlock(lock);
+	pthread_rwlock_unlock(&db->tableLock);
+}
+
+/**********************MAINTAINSHARED*************************
+Does the upkeep insert() and deleteRecord() leave out while the
+table is shared: splits buckets while the load factor is exceeded,
+and runs a compaction step once tombstones are dense enough.
+Both wait for every other operation to finish first.
+*/
+void maintainShared(HASHDB *db)
+{
+	if (db->nrecords <= LOAD_FACTOR * db->nbuckets * BUCKETSIZE &&
+		db->tombstones * COMPACT_DENSITY <= db->nbuckets) // checked again under the lock
+		return;
+	pthread_rwlock_wrlock(&db->tableLock);
+	while (db->nrecords > LOAD_FACTOR * db->nbuckets * BUCKETSIZE)
+		splitBucket(db);
+	if (db->tombstones * COMPACT_DENSITY > db->nbuckets)
+		compactStep(db, db->compactMicros);
+	pthread_rwlock_unlock(&db->tableLock);
+}
+
+/**********************SHAREDFIND*************************
+Thread-safe findRecord() for a shared table.
+*/
+long sharedFind(HASHDB *db, char *targetID, RECORD *found)
+{
+	pthread_rwlock_t *lock = lockBucket(db, targetID, 0);
+	int slot;
+	long offset = findRecord(db, targetID, found, &slot);
+
+	unlockBucket(db, lock);
+	return offset;
+}
+
+/**********************SHAREDINSERT*************************
+Thread-safe insert() for a shared table.
+*/
+int sharedInsert(HASHDB *db, const RECORD *rec)
+{
+	pthread_rwlock_t *lock = lockBucket(db, rec->id, 1);
+	int added = insert(rec, db);
+
+	unlockBucket(db, lock);
+	if (added)
+		maintainShared(db);
+	return added;
+}
+
+/**********************SHAREDDELETE*************************
+Thread-safe deleteRecord() for a shared table.
+*/
+long sharedDelete(HASHDB *db, char *targetID, RECORD *found)
+{
+	pthread_rwlock_t *lock = lockBucket(db, targetID, 1);
+	int slot;
+	long offset = deleteRecord(db, targetID, found, &slot);
+
+	unlockBucket(db, lock);
+	if (offset >= 0)
+		maintainShared(db);
+	return offset;
+}
+
+/**********************SHAREDUPDATE*************************
+Thread-safe updateRecord() for a shared table.
+*/
+long sharedUpdate(HASHDB *db, const RECORD *rec)
+{
+	pthread_rwlock_t *lock = lockBucket(db, rec->id, 1);
+	long offset = updateRecord(db, rec);
+
+	unlockBucket(db, lock);
+	return offset;
+}
+#endif
+
+/**********************SYNCHASHFILE*************************
+Pushes every change made so far out to the file: msync for a
+mapped file, fflush for stdio. Called after each batch of
+updates rather than after every record. The presence
+bitmap is written back first if it changed, and logged
+operations are committed.
+*/
+void syncHashFile(HASHDB *db)
+{
+	if (db->presenceDirty)
+	{
+		db->walSkip = 1; // rebuilt from the records after a crash
+		storeBlock(db, sizeof(HEADER), db->presenceBits / 8 + 1, db->presence);
+		db->walSkip = 0;
+		db->presenceDirty = 0;
+	}
+	if (db->wal)
+		walSync(db);
+	flushPool(db);
+#ifdef HAVE_MMAP
+	if (db->backend == BACKEND_MMAP)
+	{
+		if (msync(db->map, db->fileEnd, MS_SYNC) != 0)
+		{
+			printf("Could not sync %s. Abort!\n", db->filename);
+			exit(206);
+		}
+		return;
+	}
+#endif
+	if (fflush(db->fp) == EOF)
+	{
+		printf("Could not sync %s. Abort!\n", db->filename);
+		exit(206);
+	}
+}
+
+/**********************MAPHASHFILE*************************
+(Re)maps the hash file. The mapping reserves address space in
+doubling steps beyond the end of the file so that most growth
+does not need a new mapping; only bytes below fileEnd are used.
+*/
+void mapHashFile(HASHDB *db)
+{
+#ifdef HAVE_MMAP
+	long size = db->mapSize ? db->mapSize : MAP_MINSIZE;
+
+	while (size < db->fileEnd)
+		size *= 2;
+	if (db->map)
+		munmap(db->map, db->mapSize);
+	db->map = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(db->fp), 0);
+	if (db->map == MAP_FAILED)
+	{
+		printf("Could not map %s. Abort!\n", db->filename);
+		exit(205);
+	}
+	db->mapSize = size;
+#endif
+}
+
+/**********************GROWFILE*************************
+Extends the file to newEnd bytes. The new space reads back
+as zeros, which are empty records and null page pointers.
+*/
+void growFile(HASHDB *db, long newEnd)
+{
+#ifdef HAVE_MMAP
+	if (db->backend == BACKEND_MMAP)
+	{
+		if (ftruncate(fileno(db->fp), newEnd) != 0)
+		{
+			printf("Hash table could not be grown. Abort!\n");
+			exit(303);
+		}
+		db->fileEnd = newEnd;
+		if (newEnd > db->mapSize)
+			mapHashFile(db);
+		return;
+	}
+#endif
+	STAT_ADD(db, db->nwrites, 1);
+#ifdef HAVE_PTHREADS
+	if (db->shared)
+	{
+		if (pwrite(fileno(db->fp), "", 1, newEnd - 1) != 1)
+		{
+			printf("Hash table could not be grown. Abort!\n");
+			exit(303);
+		}
+		db->fileEnd = newEnd;
+		return;
+	}
+#endif
+	db->nseeks++;
+	if (fseek(db->fp, newEnd - 1, SEEK_SET) != 0 || fputc('\0', db->fp) == EOF)
+	{
+		printf("Hash table could not be grown. Abort!\n");
+		exit(303);
+	}
+	db->fileEnd = newEnd;
+}
+
+/**********************FETCHBLOCK*************************
+Returns a pointer to size bytes of the file starting at offset.
+A mapped file is read in place, a block within one buffer pool
+page is read from the page, and anything else is read into buf.
+The pointer is only good until the next read, write or growth
+of the file.
+*/
+void *fetchBlock(HASHDB *db, long offset, size_t size, void *buf)
+{
+	if (db->frames) // buffer pool: only misses read the file
+	{
+		if (offset % POOL_PAGESIZE + size <= POOL_PAGESIZE)
+			return poolPage(db, offset / POOL_PAGESIZE) + offset % POOL_PAGESIZE;
+		poolCopy(db, offset, size, buf, 0);
+		return buf;
+	}
+	STAT_ADD(db, db->nreads, 1);
+	if (db->backend == BACKEND_MMAP)
+		return db->map + offset;
+#ifdef HAVE_PTHREADS
+	if (db->shared) // positioned read: there is no shared file position to move
+	{
+		if (pread(fileno(db->fp), buf, size, offset) != (ssize_t)size)
+		{
+			printf("Fatal read error! Abort!\n");
+			exit(304);
+		}
+		return buf;
+	}
+#endif
+
+	db->nseeks++;
+	if (fseek(db->fp, offset, SEEK_SET) != 0)
+	{
+		printf("Fatal seek error! Abort!\n");
+		exit(301);
+	}
+	if (fread(buf, size, 1, db->fp) < 1)
+	{
+		printf("Fatal read error! Abort!\n");
+		exit(304);
+	}
+	return buf;
+}
+
+/**********************READBLOCK*************************
+Copies size bytes starting at offset into buf.
+*/
+void readBlock(HASHDB *db, long offset, size_t size, void *buf)
+{
+	void *data = fetchBlock(db, offset, size, buf);
+
+	if (data != buf)
+		memcpy(buf, data, size);
+}
+
+/**********************STOREBLOCK*************************
+Writes size bytes starting at offset. With a buffer pool the
+bytes go to the cached pages and reach the file when a page is
+evicted or flushed; writes larger than POOL_BYPASS go straight
+to the file, updating any of their pages that are cached.
+With a write-ahead log the write is logged first.
+*/
+void storeBlock(HASHDB *db, long offset, size_t size, const void *data)
+{
+	long page;
+	size_t skip, len;
+
+	if (db->wal && !db->walSkip)
+		walWrite(db, offset, size, data);
+	if (db->frames)
+	{
+		if (size <= POOL_BYPASS)
+		{
+			poolCopy(db, offset, size, (void *)data, 1);
+			return;
+		}
+		for (page = offset / POOL_PAGESIZE; page * POOL_PAGESIZE < offset + (long)size; page++)
+		{
+			int f;
+			for (f = db->poolIndex[page % db->poolSize]; f >= 0 && db->frames[f].page != page; f = db->frames[f].next)
+				;
+			if (f < 0)
+				continue;
+			skip = page * POOL_PAGESIZE > offset ? page * POOL_PAGESIZE - offset : 0;
+			len = (page + 1) * POOL_PAGESIZE - offset - skip;
+			if (len > size - skip)
+				len = size - skip;
+			memcpy(db->poolData + (long)f * POOL_PAGESIZE + (offset + skip) % POOL_PAGESIZE,
+				(const char *)data + skip, len);
+		}
+	}
+	STAT_ADD(db, db->nwrites, 1);
+	if (db->backend == BACKEND_MMAP)
+	{
+		memmove(db->map + offset, data, size);
+		return;
+	}
+
+	if (db->wal && db->walLsn > db->walDurable) // the log goes first
+		walSync(db);
+#ifdef HAVE_PTHREADS
+	if (db->shared)
+	{
+		if (pwrite(fileno(db->fp), data, size, offset) != (ssize_t)size)
+		{
+			printf("Fatal write error! Abort!\n");
+			exit(305);
+		}
+		return;
+	}
+#endif
+	db->nseeks++;
+	if (fseek(db->fp, offset, SEEK_SET) != 0)
+	{
+		printf("Fatal seek error! Abort!\n");
+		exit(301);
+	}
+	if (fwrite(data, size, 1, db->fp) < 1)
+	{
+		printf("Fatal write error! Abort!\n");
+		exit(305);
+	}
+}
+
+/**********************SETPOOLSIZE*************************
+Replaces the buffer pool with an empty one of npages pages,
+writing back the dirty pages of the old one first. 0 turns
+the pool off. Mapped files are cached by the OS instead, so
+they never get a pool.
+*/
+void setPoolSize(HASHDB *db, int npages)
+{
+	int f;
+
+	flushPool(db);
+	free(db->frames);
+	free(db->poolData);
+	free(db->poolIndex);
+	db->frames = NULL;
+	db->poolData = NULL;
+	db->poolIndex = NULL;
+	db->poolSize = 0;
+	if (npages <= 0 || db->backend == BACKEND_MMAP)
+		return;
+
+	db->frames = (FRAME *)malloc(npages * sizeof(FRAME));
+	db->poolData = (char *)malloc((long)npages * POOL_PAGESIZE);
+	db->poolIndex = (int *)malloc(npages * sizeof(int));
+	if (!db->frames || !db->poolData || !db->poolIndex)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	for (f = 0; f < npages; f++)
+	{
+		db->frames[f].page = -1;
+		db->frames[f].next = -1;
+		db->frames[f].ref = db->frames[f].dirty = 0;
+		db->frames[f].lsn = 0;
+		db->poolIndex[f] = -1;
+	}
+	db->poolSize = npages;
+	db->clockHand = 0;
+}
+
+/**********************FLUSHPOOL*************************
+Writes every dirty pool page back to the file.
+*/
+void flushPool(HASHDB *db)
+{
+	int f;
+
+	for (f = 0; f < db->poolSize; f++)
+		if (db->frames[f].dirty)
+			writeFrame(db, f);
+}
+
+/**********************WRITEFRAME*************************
+Writes one pool page back to the file and marks it clean. The
+last page is cut short at the end of the file. If the log entry
+of its last change is not on disk yet, the log is synced first.
+*/
+void writeFrame(HASHDB *db, int f)
+{
+	long offset = db->frames[f].page * POOL_PAGESIZE;
+	long size = db->fileEnd - offset < POOL_PAGESIZE ? db->fileEnd - offset : POOL_PAGESIZE;
+
+	db->frames[f].dirty = 0;
+	if (size <= 0)
+		return;
+	if (db->wal && db->frames[f].lsn > db->walDurable) // the log goes first
+		walSync(db);
+	db->nseeks++;
+	db->nwrites++;
+	if (fseek(db->fp, offset, SEEK_SET) != 0)
+	{
+		printf("Fatal seek error! Abort!\n");
+		exit(301);
+	}
+	if (fwrite(db->poolData + (long)f * POOL_PAGESIZE, size, 1, db->fp) < 1)
+	{
+		printf("Fatal write error! Abort!\n");
+		exit(305);
+	}
+}
+
+/**********************POOLPAGE*************************
+Returns the pool's copy of a file page, reading it in on a
+miss. The frame to reuse is picked by the CLOCK algorithm:
+the sweep clears reference bits until it finds a frame that
+has not been used since the last pass, and writes it back
+first if it is dirty. Bytes past the end of the file read
+as zeros.
+*/
+char *poolPage(HASHDB *db, long page)
+{
+	FRAME *frames = db->frames;
+	int *link, f;
+	size_t got;
+	char *data;
+
+	for (f = db->poolIndex[page % db->poolSize]; f >= 0; f = frames[f].next)
+		if (frames[f].page == page)
+		{
+			frames[f].ref = 1;
+			db->poolHits++;
+			return db->poolData + (long)f * POOL_PAGESIZE;
+		}
+
+	db->poolMisses++;
+	while (frames[db->clockHand].ref)
+	{
+		frames[db->clockHand].ref = 0;
+		db->clockHand = (db->clockHand + 1) % db->poolSize;
+	}
+	f = db->clockHand;
+	db->clockHand = (db->clockHand + 1) % db->poolSize;
+	if (frames[f].page >= 0) // evict
+	{
+		if (frames[f].dirty)
+			writeFrame(db, f);
+		for (link = &db->poolIndex[frames[f].page % db->poolSize]; *link != f; link = &frames[*link].next)
+			;
+		*link = frames[f].next;
+	}
+
+	data = db->poolData + (long)f * POOL_PAGESIZE;
+	db->nseeks++;
+	db->nreads++;
+	if (fseek(db->fp, page * POOL_PAGESIZE, SEEK_SET) != 0)
+	{
+		printf("Fatal seek error! Abort!\n");
+		exit(301);
+	}
+	got = fread(data, 1, POOL_PAGESIZE, db->fp);
+	if (got < POOL_PAGESIZE)
+	{
+		if (ferror(db->fp))
+		{
+			printf("Fatal read error! Abort!\n");
+			exit(304);
+		}
+		clearerr(db->fp);
+		memset(data + got, 0, POOL_PAGESIZE - got);
+	}
+	frames[f].page = page;
+	frames[f].ref = 1;
+	frames[f].dirty = 0;
+	frames[f].next = db->poolIndex[page % db->poolSize];
+	db->poolIndex[page % db->poolSize] = f;
+	return data;
+}
+
+/**********************POOLCOPY*************************
+Copies size bytes at offset between buf and the pool, page by
+page: into buf, or from buf into the pages (store), which are
+then dirty.
+*/
+void poolCopy(HASHDB *db, long offset, size_t size, void *buf, int store)
+{
+	char *bytes = (char *)buf;
+	size_t len;
+	char *data;
+
+	while (size > 0)
+	{
+		data = poolPage(db, offset / POOL_PAGESIZE);
+		len = POOL_PAGESIZE - offset % POOL_PAGESIZE;
+		if (len > size)
+			len = size;
+		if (store)
+		{
+			memcpy(data + offset % POOL_PAGESIZE, bytes, len);
+			db->frames[(data - db->poolData) / POOL_PAGESIZE].dirty = 1;
+			db->frames[(data - db->poolData) / POOL_PAGESIZE].lsn = db->walLsn;
+		}
+		else
+			memcpy(bytes, data + offset % POOL_PAGESIZE, len);
+		offset += len;
+		bytes += len;
+		size -= len;
+	}
+}
+
+/**********************OPENWAL*************************
+Starts logging every change to the hash file in a write-ahead
+log next to it (the file name plus WAL_SUFFIX). An operation is
+on disk once the log has been fsynced; operations that end within
+windowMicros of the oldest unsynced one share a single fsync
+(group commit). The window is checked as each operation ends and
+by walTick(), which the server and batch mode call while they wait;
+elsewhere a lone operation waits for the next one or a sync. The hash file itself is written lazily and made
+durable at each checkpoint. Mapped files are not logged, since
+the OS may write a mapped page back before the log.
+*/
+void openWal(HASHDB *db, long windowMicros)
+{
+	if (db->backend == BACKEND_MMAP)
+	{
+		printf("The write-ahead log needs the stdio backend; updates will not be logged.\n");
+		return;
+	}
+	db->walWindow = windowMicros;
+	db->walCommits = 0;
+	checkpointWal(db);
+}
+
+/**********************CHECKPOINTWAL*************************
+Makes the hash file durable and starts a new log holding only a
+checkpoint of the table state. The new log is written beside the
+old one and renamed over it, so a crash leaves one or the other.
+*/
+void checkpointWal(HASHDB *db)
+{
+	char name[FILENAME_MAX], tmpName[FILENAME_MAX + 4];
+	TABLESTATE state;
+	long size = getState(db, &state);
+	FILE *log;
+
+	if (db->wal)
+		walSync(db);
+	flushPool(db);
+	syncFile(db->fp);
+
+	sprintf(name, "%s%s", db->filename, WAL_SUFFIX);
+	sprintf(tmpName, "%s.tmp", name);
+	log = fopen(tmpName, "w+b");
+	if (!log)
+	{
+		printf("Couldn't open %s for writing.\n", tmpName);
+		exit(201);
+	}
+	db->walLsn = db->walDurable = walEntry(log, WAL_CHECKPOINT, size, &state);
+	syncFile(log);
+	if (db->wal)
+		fclose(db->wal);
+#ifdef _WIN32
+	remove(name); // rename() does not replace files here
+#endif
+	if (rename(tmpName, name) != 0)
+	{
+		printf("Could not replace %s. Abort!\n", name);
+		exit(206);
+	}
+	db->wal = log;
+	db->walPending = 0;
+}
+
+#if defined(BENCHMARK) && !defined(_WIN32)
+long crashWrites = 0; // bench_crash: logged writes left before the process kills itself, 0 for never
+#endif
+
+/**********************WALWRITE*************************
+Logs a write to the hash file before it is made: the bytes
+there now (to undo it) and the new bytes (to redo it).
+*/
+void walWrite(HASHDB *db, long offset, size_t size, const void *data)
+{
+	WALENTRY entry;
+	char chunk[WAL_CHUNK];
+	unsigned int check;
+	size_t done, len;
+
+	memset(&entry, 0, sizeof entry);
+	entry.type = WAL_WRITE;
+	entry.offset = offset;
+	entry.size = (long)size;
+	check = walChecksum(2166136261U, &entry, sizeof entry);
+	if (fwrite(&entry, sizeof entry, 1, db->wal) < 1)
+	{
+		printf("Could not write the log of %s. Abort!\n", db->filename);
+		exit(206);
+	}
+	for (done = 0; done < size; done += len)
+	{
+		len = size - done < WAL_CHUNK ? size - done : WAL_CHUNK;
+		readBlock(db, offset + done, len, chunk);
+		check = walChecksum(check, chunk, len);
+		if (fwrite(chunk, len, 1, db->wal) < 1)
+		{
+			printf("Could not write the log of %s. Abort!\n", db->filename);
+			exit(206);
+		}
+	}
+	check = walChecksum(check, data, size);
+	if ((size > 0 && fwrite(data, size, 1, db->wal) < 1) || fwrite(&check, sizeof check, 1, db->wal) < 1)
+	{
+		printf("Could not write the log of %s. Abort!\n", db->filename);
+		exit(206);
+	}
+	db->walLsn += sizeof entry + 2 * size + sizeof check;
+#if defined(BENCHMARK) && !defined(_WIN32)
+	if (crashWrites > 0 && --crashWrites == 0)
+		raise(SIGKILL); // the write itself is never made: an operation cut short
+#endif
+}
+
+/**********************WALOPEND*************************
+Marks the end of an insert, delete or bulk load in the log,
+with the table state after it. Recovery rolls the hash file
+back to the last such mark. The log is fsynced once the
+oldest operation waiting for it has waited walWindow, and
+checkpointed once it passes WAL_CHECKPOINT_BYTES.
+*/
+void walOpEnd(HASHDB *db)
+{
+	TABLESTATE state;
+	double now;
+
+	if (!db->wal)
+		return;
+	db->walLsn += walEntry(db->wal, WAL_OPEND, getState(db, &state), &state);
+	if (db->walLsn > WAL_CHECKPOINT_BYTES)
+	{
+		checkpointWal(db);
+		return;
+	}
+	now = clockMicros();
+	if (db->walPending == 0)
+		db->walPending = now;
+	if (now - db->walPending >= db->walWindow)
+		walSync(db);
+}
+
+/**********************WALTICK*************************
+Commits the log if the oldest operation waiting for it has
+waited walWindow, so a lone operation is not left unsynced
+until the next one. Returns the milliseconds left until that
+deadline (at least 1), or -1 if nothing is waiting.
+*/
+long walTick(HASHDB *db)
+{
+	double left;
+
+	if (!db->wal || db->walPending == 0)
+		return -1;
+	left = db->walPending + db->walWindow - clockMicros();
+	if (left <= 0)
+	{
+		walSync(db);
+		return -1;
+	}
+	return (long)(left / 1000) + 1;
+}
+
+/**********************WALSYNC*************************
+Commits every logged operation: flushes the log and waits for
+it to reach the disk.
+*/
+void walSync(HASHDB *db)
+{
+	if (db->walLsn == db->walDurable)
+		return;
+	syncFile(db->wal);
+	db->walDurable = db->walLsn;
+	db->walPending = 0;
+	db->walCommits++;
+}
+
+/**********************SYNCFILE*************************
+Flushes a stream and waits for the OS to put it on disk.
+*/
+void syncFile(FILE *fp)
+{
+	if (fflush(fp) == EOF)
+	{
+		printf("Could not sync a file. Abort!\n");
+		exit(206);
+	}
+#ifdef HAVE_FSYNC
+	if (fsync(fileno(fp)) != 0)
+	{
+		printf("Could not sync a file. Abort!\n");
+		exit(206);
+	}
+#endif
+}
+
+/**********************WALCHECKSUM*************************
+FNV-1a over size bytes, continuing from check. Torn or
+partly written log entries fail it.
+*/
+unsigned int walChecksum(unsigned int check, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		check = (check ^ bytes[i]) * 16777619U;
+	return check;
+}
+
+/**********************WALENTRY*************************
+Appends an entry with a payload of size bytes to a log and
+returns the number of bytes appended.
+*/
+long walEntry(FILE *log, int type, long size, const void *payload)
+{
+	WALENTRY entry;
+	unsigned int check;
+
+	memset(&entry, 0, sizeof entry);
+	entry.type = type;
+	entry.size = size;
+	check = walChecksum(walChecksum(2166136261U, &entry, sizeof entry), payload, size);
+	if (fwrite(&entry, sizeof entry, 1, log) < 1 || fwrite(payload, size, 1, log) < 1 ||
+		fwrite(&check, sizeof check, 1, log) < 1)
+	{
+		printf("Could not write the log. Abort!\n");
+		exit(206);
+	}
+	return sizeof entry + size + sizeof check;
+}
+
+/**********************GETSTATE*************************
+Copies the table descriptor fields that change as records are
+added into state and returns how many bytes of it to log.
+*/
+long getState(HASHDB *db, TABLESTATE *state)
+{
+	memset(state, 0, sizeof *state);
+	state->level = db->level;
+	state->split = db->split;
+	state->nbuckets = db->nbuckets;
+	state->nrecords = db->nrecords;
+	state->oflowRecords = db->oflowRecords;
+	state->npages = db->npages;
+	state->freePages = db->freePages;
+	state->fileEnd = db->fileEnd;
+	state->tombstones = db->tombstones;
+	memcpy(state->groupStart, db->groupStart, sizeof db->groupStart);
+	if (db->level + 2 > MAXLEVEL + 1)
+		return sizeof *state;
+	return offsetof(TABLESTATE, groupStart) + (db->level + 2) * sizeof(long);
+}
+
+/**********************WALCOPY*************************
+Reads size bytes from the log in chunks, adding them to *check
+if check is not NULL and writing them to fp at offset if fp is
+not NULL. Returns 0 if the log ends first.
+*/
+long walCopy(FILE *log, FILE *fp, long offset, long size, unsigned int *check)
+{
+	char chunk[WAL_CHUNK];
+	long len;
+
+	if (fp && fseek(fp, offset, SEEK_SET) != 0)
+	{
+		printf("Fatal seek error! Abort!\n");
+		exit(301);
+	}
+	for (; size > 0; size -= len)
+	{
+		len = size < WAL_CHUNK ? size : WAL_CHUNK;
+		if (fread(chunk, len, 1, log) < 1)
+			return 0;
+		if (check)
+			*check = walChecksum(*check, chunk, len);
+		if (fp && fwrite(chunk, len, 1, fp) < 1)
+		{
+			printf("Fatal write error! Abort!\n");
+			exit(305);
+		}
+	}
+	return 1;
+}
+
+/**********************RECOVERHASHFILE*************************
+Reopens a hash file left behind by a crash and repairs it from
+its write-ahead log: every complete operation in the log is
+redone, and the writes of an operation cut off by the crash are
+undone, newest first. The presence bitmap is rebuilt from the
+records, a fresh checkpoint is taken, and logging continues
+with the given group commit window.
+Post  returns HASHDB * which later needs closeHashFile()
+*/
+HASHDB *recoverHashFile(char *filename, long windowMicros)
+{
+	char name[FILENAME_MAX];
+	HEADER header;
+	WALENTRY entry;
+	TABLESTATE state;
+	unsigned int check, stored;
+	long pos = 0, lastOp = -1, payload, *undo = NULL, nundo = 0, maxUndo = 0, redone = 0, k;
+	FILE *hashFile, *log;
+	HASHDB *db;
+
+	printf("Recovering %s\n\n", filename);
+	sprintf(name, "%s%s", filename, WAL_SUFFIX);
+	hashFile = fopen(filename, "r+b");
+	log = fopen(name, "rb");
+	if (!hashFile || !log)
+	{
+		printf("Couldn't open %s and its log %s.\n", filename, name);
+		exit(201);
+	}
+	if (fread(&header, sizeof header, 1, hashFile) < 1 || !checkHeader(&header))
+	{
+		printf("%s is not a hash file written by this program. Abort!\n", filename);
+		exit(208);
+	}
+
+	// find the last complete operation and the writes made after it
+	while (fread(&entry, sizeof entry, 1, log) == 1)
+	{
+		if (entry.type < WAL_WRITE || entry.type > WAL_CHECKPOINT || entry.size < 0 ||
+			(pos == 0) != (entry.type == WAL_CHECKPOINT) ||
+			(entry.type != WAL_WRITE && entry.size > (long)sizeof state))
+			break;
+		payload = entry.type == WAL_WRITE ? 2 * entry.size : entry.size;
+		check = walChecksum(2166136261U, &entry, sizeof entry);
+		if (!walCopy(log, NULL, 0, payload, &check) || fread(&stored, sizeof stored, 1, log) < 1 || stored != check)
+			break; // torn entry: the log ends here
+		if (entry.type == WAL_WRITE)
+		{
+			if (nundo == maxUndo)
+			{
+				maxUndo = maxUndo ? 2 * maxUndo : 64;
+				undo = (long *)realloc(undo, maxUndo * sizeof(long));
+				if (!undo)
+				{
+					printf("Out of memory! Abort!\n");
+					exit(204);
+				}
+			}
+			undo[nundo++] = pos;
+		}
+		pos = ftell(log);
+		if (entry.type != WAL_WRITE)
+		{
+			lastOp = pos;
+			nundo = 0;
+		}
+	}
+	if (lastOp < 0)
+	{
+		printf("The log %s is damaged. Abort!\n", name);
+		exit(208);
+	}
+
+	// redo every complete operation, then undo the one cut short
+	rewind(log);
+	while (ftell(log) < lastOp && fread(&entry, sizeof entry, 1, log) == 1)
+	{
+		if (entry.type == WAL_WRITE)
+		{
+			walCopy(log, NULL, 0, entry.size, NULL);
+			walCopy(log, hashFile, entry.offset, entry.size, NULL);
+			redone++;
+		}
+		else
+		{
+			memset(&state, 0, sizeof state);
+			if (fread(&state, entry.size, 1, log) < 1)
+				break;
+		}
+		fseek(log, sizeof stored, SEEK_CUR);
+	}
+	for (k = nundo - 1; k >= 0; k--)
+	{
+		fseek(log, undo[k], SEEK_SET);
+		if (fread(&entry, sizeof entry, 1, log) == 1)
+			walCopy(log, hashFile, entry.offset, entry.size, NULL);
+	}
+	free(undo);
+	fclose(log);
+
+	// anything past the recorded end was added by the lost operation
+	if (fflush(hashFile) == EOF)
+	{
+		printf("Could not sync %s. Abort!\n", filename);
+		exit(206);
+	}
+#ifdef HAVE_FSYNC
+	if (ftruncate(fileno(hashFile), state.fileEnd) != 0)
+	{
+		printf("Hash table could not be grown. Abort!\n");
+		exit(303);
+	}
+#endif
+
+	db = (HASHDB *)calloc(1, sizeof(HASHDB));
+	if (!db)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	db->fp = hashFile;
+	db->filename = filename;
+	db->hashFunc = header.hashFunc;
+	db->level = (int)state.level;
+	db->split = state.split;
+	db->nbuckets = state.nbuckets;
+	db->nrecords = state.nrecords;
+	db->oflowRecords = state.oflowRecords;
+	db->npages = state.npages;
+	db->freePages = state.freePages;
+	db->fileEnd = state.fileEnd;
+	db->tombstones = state.tombstones;
+	db->compactMicros = COMPACT_MICROS;
+	memcpy(db->groupStart, state.groupStart, sizeof db->groupStart);
+	db->presenceBits = ID_SIZE <= PRESENCE_MAXDIGITS ? keySpace() : BLOOM_BITS;
+	db->presenceExact = ID_SIZE <= PRESENCE_MAXDIGITS;
+	db->presence = (unsigned char *)calloc(header.presenceBytes, 1);
+	if (!db->presence)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	setPoolSize(db, POOL_PAGES);
+	rebuildPresence(db);
+	syncHashFile(db);
+	openNameIndex(db, 1);
+	openQtyColumn(db, 1);
+	openWal(db, windowMicros);
+	printf("Recovered %ld records: %ld writes redone, %ld undone.\n", db->nrecords, redone, nundo);
+	return db;
+}
+
+/**********************REBUILDPRESENCE*************************
+Clears the presence bitmap and sets the bit of every record in
+the table, reading each bucket and overflow chain once.
+*/
+void rebuildPresence(HASHDB *db)
+{
+	BUCKET home;
+	OFLOWPAGE page;
+	long bucket, next;
+	char id[ID_SIZE + 1];
+	int k;
+
+	memset(db->presence, 0, db->presenceBits / 8 + 1);
+	for (bucket = 0; bucket < db->nbuckets; bucket++)
+	{
+		readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+		for (k = 0; k < BUCKETSIZE; k++)
+			if (KEY_LIVE(home.key[k]))
+			{
+				unpackID(home.key[k], id);
+				presenceSet(db, id);
+			}
+		for (next = home.next; next; next = page.next)
+		{
+			readBlock(db, next, sizeof(OFLOWPAGE), &page);
+			for (k = 0; k < OFLOWSIZE; k++)
+				if (KEY_LIVE(page.key[k]))
+				{
+					unpackID(page.key[k], id);
+					presenceSet(db, id);
+				}
+		}
+	}
+	db->presenceDirty = 1;
+}
+
+/**********************OPENNAMEINDEX*************************
+Opens the name index of a hash file. It is a side file, named
+after the hash file plus NAMES_SUFFIX, holding one entry per record
+sorted by name and then ID, followed by the first entry of every
+block of NAMES_BLOCK entries. Those fence keys are kept in memory,
+so a query reads only the blocks that can hold its matches.
+Changes are logged in memory and merged into the file once there
+are enough of them (see nameIndexChange()). The index is rebuilt
+from the table if rebuild is set, or if the file is missing, does
+not match the table, or was not closed with it.
+*/
+void openNameIndex(HASHDB *db, int rebuild)
+{
+	char name[FILENAME_MAX];
+	NAMEHEADER header;
+	BUCKET home;
+	OFLOWPAGE page;
+	RECORD rec;
+	long bucket, next, nfence;
+	int k;
+
+	sprintf(name, "%s%s", db->filename, NAMES_SUFFIX);
+	db->names = rebuild ? NULL : fopen(name, "r+b");
+	if (db->names && fread(&header, sizeof header, 1, db->names) == 1 &&
+		memcmp(header.magic, NAMES_MAGIC, sizeof header.magic) == 0 && header.idSize == ID_SIZE &&
+		header.nameSize == NAME_SIZE && header.clean && header.entries == db->nrecords)
+	{
+		nfence = (header.entries + NAMES_BLOCK - 1) / NAMES_BLOCK;
+		db->nameFence = (NAMEKEY *)malloc((nfence + 1) * sizeof(NAMEKEY));
+		if (!db->nameFence)
+		{
+			printf("Out of memory! Abort!\n");
+			exit(204);
+		}
+		if (fseek(db->names, sizeof header + header.entries * sizeof(NAMEKEY), SEEK_SET) != 0 ||
+			(long)fread(db->nameFence, sizeof(NAMEKEY), nfence, db->names) != nfence)
+		{
+			printf("Fatal read error! Abort!\n");
+			exit(304);
+		}
+		db->nameEntries = header.entries;
+		header.clean = 0; // not clean again until closeNameIndex()
+		rewind(db->names);
+		if (fwrite(&header, sizeof header, 1, db->names) < 1 || fflush(db->names) == EOF)
+		{
+			printf("Fatal write error! Abort!\n");
+			exit(305);
+		}
+		return;
+	}
+
+	if (db->names)
+		fclose(db->names);
+	if (!rebuild)
+		printf("Rebuilding the name index %s.\n", name);
+	db->names = fopen(name, "w+b");
+	if (!db->names)
+	{
+		printf("Couldn't open %s for writing.\n", name);
+		exit(201);
+	}
+	db->nameEntries = 0;
+	for (bucket = 0; bucket < db->nbuckets; bucket++)
+	{
+		readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+		for (k = 0; k < BUCKETSIZE; k++)
+			if (KEY_LIVE(home.key[k]))
+			{
+				unpackSlot(home.key[k], &home.data[k], &rec);
+				logNameChange(db, &rec, 1);
+			}
+		for (next = home.next; next; next = page.next)
+		{
+			readBlock(db, next, sizeof(OFLOWPAGE), &page);
+			for (k = 0; k < OFLOWSIZE; k++)
+				if (KEY_LIVE(page.key[k]))
+				{
+					unpackSlot(page.key[k], &page.data[k], &rec);
+					logNameChange(db, &rec, 1);
+				}
+		}
+	}
+	mergeNameIndex(db);
+}
+
+/**********************CLOSENAMEINDEX*************************
+Merges the logged changes into the name index side file, marks
+it clean and closes it.
+*/
+void closeNameIndex(HASHDB *db)
+{
+	NAMEHEADER header;
+
+	if (!db->names)
+		return;
+	if (db->nameChanges > 0)
+		mergeNameIndex(db);
+	rewind(db->names);
+	if (fread(&header, sizeof header, 1, db->names) < 1)
+	{
+		printf("Fatal read error! Abort!\n");
+		exit(304);
+	}
+	header.clean = 1;
+	rewind(db->names);
+	if (fwrite(&header, sizeof header, 1, db->names) < 1 || fclose(db->names) == EOF)
+	{
+		printf("Error closing the name index!\nExiting.\n");
+		exit(104);
+	}
+	free(db->nameFence);
+	free(db->nameLog);
+	db->names = NULL;
+	db->nameFence = NULL;
+	db->nameLog = NULL;
+	db->nameEntries = db->nameChanges = db->nameLogCap = db->nameSorted = 0;
+}
+
+/**********************NAMEINDEXCHANGE*************************
+Records that rec was added to the table (add = 1) or removed from
+it. The side file is rewritten once NAMES_DELTA changes and at
+least half as many changes as it has entries have been logged, so
+each entry is rewritten a bounded number of times on average.
+*/
+void nameIndexChange(HASHDB *db, const RECORD *rec, int add)
+{
+	if (!db->names)
+		return;
+	logNameChange(db, rec, add);
+	if (db->nameChanges >= NAMES_DELTA && db->nameChanges * 2 >= db->nameEntries)
+		mergeNameIndex(db);
+}
+
+/**********************LOGNAMECHANGE*************************
+Appends a change to the in-memory name index log.
+*/
+void logNameChange(HASHDB *db, const RECORD *rec, int add)
+{
+	NAMECHANGE *grown, *change;
+
+	if (db->nameChanges == db->nameLogCap)
+	{
+		db->nameLogCap = db->nameLogCap ? 2 * db->nameLogCap : 1024;
+		grown = (NAMECHANGE *)realloc(db->nameLog, db->nameLogCap * sizeof(NAMECHANGE));
+		if (!grown)
+		{
+			printf("Out of memory! Abort!\n");
+			exit(204);
+		}
+		db->nameLog = grown;
+	}
+	change = &db->nameLog[db->nameChanges++];
+	memset(&change->key, 0, sizeof change->key);
+	memcpy(change->key.name, rec->name, strlen(rec->name));
+	memcpy(change->key.id, rec->id, ID_SIZE);
+	change->seq = db->nameSeq++;
+	change->add = add;
+}
+
+/**********************SORTNAMELOG*************************
+Sorts the name index log by entry and keeps only the last change
+to each entry.
+*/
+void sortNameLog(HASHDB *db)
+{
+	long i, j;
+
+	if (db->nameSorted == db->nameChanges)
+		return;
+	qsort(db->nameLog, db->nameChanges, sizeof(NAMECHANGE), compareNameChanges);
+	for (i = 0, j = 0; i < db->nameChanges; i++)
+	{
+		if (j > 0 && compareNameKeys(&db->nameLog[j - 1].key, &db->nameLog[i].key) == 0)
+			j--; // the later change replaces the earlier one
+		db->nameLog[j++] = db->nameLog[i];
+	}
+	db->nameChanges = db->nameSorted = j;
+}
+
+/**********************MERGENAMEINDEX*************************
+Rewrites the name index side file with the logged changes merged
+into its entries, reading the old file and writing the new one
+sequentially, and empties the log. The new file replaces the old
+one only when it is complete.
+*/
+void mergeNameIndex(HASHDB *db)
+{
+	char name[FILENAME_MAX], tmpName[FILENAME_MAX + 4];
+	NAMEKEY block[NAMES_BLOCK], *fence, *key;
+	NAMEHEADER header;
+	NAMECHANGE *change, *end;
+	FILE *out;
+	long in = 0, have = 0, at = 0, written = 0, nfence = 0;
+	int cmp;
+
+	sortNameLog(db);
+	change = db->nameLog;
+	end = db->nameLog + db->nameChanges;
+	sprintf(name, "%s%s", db->filename, NAMES_SUFFIX);
+	sprintf(tmpName, "%s.tmp", name);
+	out = fopen(tmpName, "w+b");
+	fence = (NAMEKEY *)malloc(((db->nameEntries + db->nameChanges) / NAMES_BLOCK + 1) * sizeof(NAMEKEY));
+	if (!out || !fence)
+	{
+		printf("Couldn't rewrite the name index %s.\n", name);
+		exit(201);
+	}
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, NAMES_MAGIC, sizeof header.magic);
+	header.idSize = ID_SIZE;
+	header.nameSize = NAME_SIZE;
+	fwrite(&header, sizeof header, 1, out);
+	fseek(db->names, sizeof header, SEEK_SET);
+
+	for (;;)
+	{
+		if (at == have && in < db->nameEntries)
+		{
+			have = db->nameEntries - in < NAMES_BLOCK ? db->nameEntries - in : NAMES_BLOCK;
+			if ((long)fread(block, sizeof(NAMEKEY), have, db->names) != have)
+			{
+				printf("Fatal read error! Abort!\n");
+				exit(304);
+			}
+			in += have;
+			at = 0;
+		}
+		if (at == have && change == end)
+			break;
+		cmp = at == have ? 1 : change == end ? -1 : compareNameKeys(&block[at], &change->key);
+		if (cmp < 0)
+			key = &block[at++];
+		else
+		{
+			at += cmp == 0; // the change replaces the entry
+			key = change->add ? &change->key : NULL;
+			change++;
+		}
+		if (!key)
+			continue;
+		if (written % NAMES_BLOCK == 0)
+			fence[nfence++] = *key;
+		fwrite(key, sizeof(NAMEKEY), 1, out);
+		written++;
+	}
+	fwrite(fence, sizeof(NAMEKEY), nfence, out);
+	header.entries = written;
+	rewind(out);
+	if (fwrite(&header, sizeof header, 1, out) < 1 || fclose(out) == EOF)
+	{
+		printf("Fatal write error! Abort!\n");
+		exit(305);
+	}
+
+	fclose(db->names);
+#ifdef _WIN32
+	remove(name); // rename() does not replace files here
+#endif
+	if (rename(tmpName, name) != 0 || !(db->names = fopen(name, "r+b")))
+	{
+		printf("Could not replace %s. Abort!\n", name);
+		exit(206);
+	}
+	free(db->nameFence);
+	db->nameFence = fence;
+	db->nameEntries = written;
+	db->nameChanges = db->nameSorted = 0;
+}
+
+/**********************NAMESEARCH*************************
+Finds the records named name, or whose names start with it if
+prefix is set, without reading the hash file: the fence keys give
+the first block of the name index that can hold a match, blocks are
+read from there until the names stop matching, and the logged
+changes are merged in. Returns the matching entries in name order
+and sets *count. Needs free().
+*/
+NAMEKEY *nameSearch(HASHDB *db, const char *name, int prefix, long *count)
+{
+	NAMEKEY block[NAMES_BLOCK], low, *matches = NULL, *grown, *key;
+	NAMECHANGE *change, *end;
+	size_t len = strlen(name) < NAME_SIZE ? strlen(name) : NAME_SIZE;
+	long lo, hi, mid, in, have = 0, at = 0, cap = 0, n = 0;
+	int cmp;
+
+	sortNameLog(db);
+	memset(&low, 0, sizeof low);
+	memcpy(low.name, name, len);
+	if (!prefix)
+		len = NAME_SIZE; // the padding must match too
+
+	// the first match is in the last block starting below low, if any
+	for (lo = 0, hi = (db->nameEntries + NAMES_BLOCK - 1) / NAMES_BLOCK; lo < hi; )
+	{
+		mid = (lo + hi) / 2;
+		if (compareNameKeys(&db->nameFence[mid], &low) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	in = (lo > 0 ? lo - 1 : 0) * NAMES_BLOCK;
+	if (in < db->nameEntries)
+		fseek(db->names, sizeof(NAMEHEADER) + in * sizeof(NAMEKEY), SEEK_SET);
+	for (lo = 0, hi = db->nameChanges; lo < hi; )
+	{
+		mid = (lo + hi) / 2;
+		if (compareNameKeys(&db->nameLog[mid].key, &low) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	change = db->nameLog + lo;
+	end = db->nameLog + db->nameChanges;
+
+	for (;;)
+	{
+		if (at == have && in < db->nameEntries)
+		{
+			have = db->nameEntries - in < NAMES_BLOCK ? db->nameEntries - in : NAMES_BLOCK;
+			if ((long)fread(block, sizeof(NAMEKEY), have, db->names) != have)
+			{
+				printf("Fatal read error! Abort!\n");
+				exit(304);
+			}
+			db->nameReads++;
+			in += have;
+			for (at = 0; at < have && compareNameKeys(&block[at], &low) < 0; at++)
+				;
+			continue;
+		}
+		if (at == have && change == end)
+			break;
+		cmp = at == have ? 1 : change == end ? -1 : compareNameKeys(&block[at], &change->key);
+		if (cmp < 0)
+			key = &block[at++];
+		else
+		{
+			at += cmp == 0; // the logged change replaces the entry
+			key = change->add ? &change->key : NULL;
+			change++;
+		}
+		if (!key)
+			continue;
+		if (memcmp(key->name, low.name, len) != 0) // sorted: no later entry matches either
+			break;
+		if (n == cap)
+		{
+			cap = cap ? 2 * cap : 64;
+			grown = (NAMEKEY *)realloc(matches, cap * sizeof(NAMEKEY));
+			if (!grown)
+			{
+				printf("Out of memory! Abort!\n");
+				exit(204);
+			}
+			matches = grown;
+		}
+		matches[n++] = *key;
+	}
+	*count = n;
+	return matches;
+}
+
+/**********************NAMEQUERY*************************
+Turns text into a name query in place: a trailing '*' asks for
+names starting with the rest, and letters are made uppercase as
+names are when stored. Returns 1 if what is left could be (the
+start of) a name.
+*/
+int nameQuery(char *text, int *prefix)
+{
+	size_t len = strlen(text), i;
+
+	*prefix = len > 0 && text[len - 1] == '*';
+	if (*prefix)
+		text[--len] = '\0';
+	for (i = 0; i < len; i++)
+		text[i] = toupper((unsigned char)text[i]);
+	return len <= NAME_SIZE && strspn(text, NAME_CHARS) == len && (len > 0 || *prefix);
+}
+
+/**********************COMPARENAMEKEYS*************************
+Orders name index entries by name, then ID.
+*/
+int compareNameKeys(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(NAMEKEY));
+}
+
+/**********************COMPARENAMECHANGES*************************
+Orders name index changes by entry, then by when they were made.
+*/
+int compareNameChanges(const void *a, const void *b)
+{
+	const NAMECHANGE *x = (const NAMECHANGE *)a, *y = (const NAMECHANGE *)b;
+	int cmp = compareNameKeys(&x->key, &y->key);
+
+	if (cmp != 0)
+		return cmp;
+	return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/**********************REMOVEHASHFILE*************************
+Deletes a hash file along with its log, name index and quantity
+column.
+*/
+void removeHashFile(const char *filename)
+{
+	char name[FILENAME_MAX];
+
+	remove(filename);
+	sprintf(name, "%s%s", filename, WAL_SUFFIX);
+	remove(name);
+	sprintf(name, "%s%s", filename, NAMES_SUFFIX);
+	remove(name);
+	sprintf(name, "%s%s", filename, QTY_SUFFIX);
+	remove(name);
+}
+
+/**********************RANGESCAN*************************
+Calls visit for every record with an ID from low to high, both
+included, in ID order. With an exact presence bitmap the set bits
+in the range are counted first; if looking those records up one by
+one costs less than reading the whole table (a lookup costing about
+RANGE_SEEK_RATIO blocks read in order), they are (rangeProbe()).
+Otherwise the table is read once and sorted in bounded memory
+(rangeMerge()). Returns the records visited.
+*/
+long rangeScan(HASHDB *db, const char *low, const char *high, void (*visit)(const RECORD *rec, void *arg), void *arg)
+{
+	long lo = atol(low), hi = atol(high), value, count = 0;
+	int bits;
+
+	if (db->presence && db->presenceExact)
+	{
+		for (value = lo; value <= hi; value++)
+		{
+			if (value % 8 == 0 && value + 7 <= hi) // a whole byte at once
+			{
+				for (bits = db->presence[value / 8]; bits; bits &= bits - 1)
+					count++;
+				value += 7;
+			}
+			else
+				count += db->presence[value / 8] >> value % 8 & 1;
+		}
+		if (count * RANGE_SEEK_RATIO < db->nbuckets + db->npages)
+			return rangeProbe(db, lo, hi, visit, arg);
+	}
+	return rangeMerge(db, low, high, visit, arg);
+}
+
+/**********************RANGEPROBE*************************
+rangeScan() for ranges holding few records: walks the exact
+presence bitmap from low to high and looks up each ID set in it.
+*/
+long rangeProbe(HASHDB *db, long low, long high, void (*visit)(const RECORD *rec, void *arg), void *arg)
+{
+	char id[ID_SIZE + 1];
+	long value, visited = 0;
+	int slot;
+	RECORD rec;
+
+	for (value = low; value <= high; value++)
+	{
+		if (value % 8 == 0 && value + 7 <= high && db->presence[value / 8] == 0)
+			value += 7; // skip a byte with no IDs in it
+		else if (db->presence[value / 8] >> value % 8 & 1)
+		{
+			sprintf(id, "%0*ld", ID_SIZE, value);
+			if (findRecord(db, id, &rec, &slot) >= 0)
+			{
+				visit(&rec, arg);
+				visited++;
+			}
+		}
+	}
+	return visited;
+}
+
+/**********************RANGEMERGE*************************
+rangeScan() by sorting: reads every bucket and overflow chain
+once, keeping the records in the range. Up to RANGE_RUN of them
+are sorted in memory; past that each full buffer is sorted and
+spilled to a runs file next to the hash file, and the sorted runs
+are merged through a heap, reading RANGE_READAHEAD records of each
+at a time. Memory stays bounded whatever the table size, and every
+file is read and written sequentially.
+*/
+long rangeMerge(HASHDB *db, const char *low, const char *high, void (*visit)(const RECORD *rec, void *arg), void *arg)
+{
+	char name[FILENAME_MAX];
+	BUCKET home;
+	OFLOWPAGE page;
+	RECORD *run = (RECORD *)malloc(RANGE_RUN * sizeof(RECORD));
+	RUNREADER *readers;
+	FILE *runs = NULL;
+	PACKEDKEY lowKey = packID(low), highKey = packID(high), *keys;
+	PAYLOAD *data;
+	long *heap, bucket, next, n = 0, spilled = 0, nruns, i, r;
+	int nslots, k;
+
+	if (!run)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	for (bucket = 0; bucket < db->nbuckets; bucket++)
+	{
+		readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+		keys = home.key;
+		data = home.data;
+		nslots = BUCKETSIZE;
+		next = home.next;
+		for (;;)
+		{
+			for (k = 0; k < nslots; k++)
+				if (keys[k] >= lowKey && keys[k] <= highKey) // packed keys sort as the IDs do
+				{
+					unpackSlot(keys[k], &data[k], &run[n++]);
+					if (n == RANGE_RUN)
+					{
+						spillRun(db, &runs, run, n);
+						spilled += n;
+						n = 0;
+					}
+				}
+			if (!next)
+				break;
+			readBlock(db, next, sizeof(OFLOWPAGE), &page);
+			keys = page.key;
+			data = page.data;
+			nslots = OFLOWSIZE;
+			next = page.next;
+		}
+	}
+
+	if (!runs) // everything fit in memory
+	{
+		qsort(run, n, sizeof(RECORD), compareRecordIDs);
+		for (i = 0; i < n; i++)
+			visit(&run[i], arg);
+		free(run);
+		return n;
+	}
+	if (n > 0)
+		spillRun(db, &runs, run, n);
+	spilled += n;
+	free(run);
+
+	nruns = (spilled + RANGE_RUN - 1) / RANGE_RUN;
+	readers = (RUNREADER *)malloc(nruns * sizeof(RUNREADER));
+	heap = (long *)malloc(nruns * sizeof(long));
+	if (!readers || !heap)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	for (r = 0; r < nruns; r++)
+	{
+		readers[r].next = r * RANGE_RUN;
+		readers[r].end = r + 1 < nruns ? (r + 1) * RANGE_RUN : spilled;
+		refillRun(runs, &readers[r]);
+		heap[r] = r;
+	}
+	for (i = nruns / 2 - 1; i >= 0; i--)
+		siftRun(readers, heap, nruns, i);
+	for (n = nruns; n > 0; )
+	{
+		r = heap[0];
+		visit(&readers[r].buf[readers[r].at++], arg);
+		if (readers[r].at == readers[r].have && !refillRun(runs, &readers[r]))
+			heap[0] = heap[--n]; // run used up
+		siftRun(readers, heap, n, 0);
+	}
+
+	free(readers);
+	free(heap);
+	fclose(runs);
+	sprintf(name, "%s%s", db->filename, RANGE_RUNS_SUFFIX);
+	remove(name);
+	return spilled;
+}
+
+/**********************SPILLRUN*************************
+Sorts n records by ID and appends them to the runs file of an
+ordered scan, creating it on first use.
+*/
+void spillRun(HASHDB *db, FILE **runs, RECORD *run, long n)
+{
+	char name[FILENAME_MAX];
+
+	sprintf(name, "%s%s", db->filename, RANGE_RUNS_SUFFIX);
+	if (!*runs && !(*runs = fopen(name, "w+b")))
+	{
+		printf("Couldn't open %s for writing.\n", name);
+		exit(201);
+	}
+	qsort(run, n, sizeof(RECORD), compareRecordIDs);
+	if ((long)fwrite(run, sizeof(RECORD), n, *runs) != n)
+	{
+		printf("Fatal write error! Abort!\n");
+		exit(305);
+	}
+}
+
+/**********************REFILLRUN*************************
+Reads the next records of a sorted run into its buffer. Returns 0
+once the run is used up.
+*/
+int refillRun(FILE *runs, RUNREADER *reader)
+{
+	reader->at = 0;
+	reader->have = reader->end - reader->next < RANGE_READAHEAD ? (int)(reader->end - reader->next) : RANGE_READAHEAD;
+	if (reader->have == 0)
+		return 0;
+	if (fseek(runs, reader->next * sizeof(RECORD), SEEK_SET) != 0 ||
+		fread(reader->buf, sizeof(RECORD), reader->have, runs) != (size_t)reader->have)
+	{
+		printf("Fatal read error! Abort!\n");
+		exit(304);
+	}
+	reader->next += reader->have;
+	return 1;
+}
+
+/**********************SIFTRUN*************************
+Moves heap entry i down the merge heap of n runs until the run
+with the lowest next ID is on top.
+*/
+void siftRun(RUNREADER *readers, long *heap, long n, long i)
+{
+	long child, top;
+
+	while ((child = 2 * i + 1) < n)
+	{
+		if (child + 1 < n && strcmp(readers[heap[child + 1]].buf[readers[heap[child + 1]].at].id,
+			readers[heap[child]].buf[readers[heap[child]].at].id) < 0)
+			child++;
+		if (strcmp(readers[heap[child]].buf[readers[heap[child]].at].id,
+			readers[heap[i]].buf[readers[heap[i]].at].id) >= 0)
+			break;
+		top = heap[i];
+		heap[i] = heap[child];
+		heap[child] = top;
+		i = child;
+	}
+}
+
+/**********************COMPARERECORDIDS*************************
+Orders records by ID; IDs are all ID_SIZE digits, so this is
+numeric order.
+*/
+int compareRecordIDs(const void *a, const void *b)
+{
+	return strcmp(((const RECORD *)a)->id, ((const RECORD *)b)->id);
+}
+
+/**********************EXPORTCATALOG*************************
+Writes every record to a file in ID order, one input line each,
+so the file can be loaded again. Returns the records written.
+*/
+long exportCatalog(HASHDB *db, const char *filename)
+{
+	char low[ID_SIZE + 1], high[ID_SIZE + 1];
+	FILE *out = fopen(filename, "w");
+	long n;
+	double start = clockMicros();
+
+	if (!out)
+	{
+		printf("Couldn't open %s for writing.\n", filename);
+		exit(201);
+	}
+	memset(low, '0', ID_SIZE);
+	memset(high, '9', ID_SIZE);
+	low[ID_SIZE] = high[ID_SIZE] = '\0';
+	n = rangeScan(db, low, high, exportRecord, out);
+	if (fclose(out) == EOF)
+	{
+		printf("Error closing %s!\n", filename);
+		exit(104);
+	}
+	printf("Exported %ld records to %s in %.3f s.\n", n, filename, (clockMicros() - start) / 1e6);
+	return n;
+}
+
+/**********************EXPORTRECORD*************************
+rangeScan() visitor: writes a record as an input line.
+*/
+void exportRecord(const RECORD *rec, void *out)
+{
+	fprintf((FILE *)out, "%s,%s:%d\n", rec->id, rec->name, rec->qty);
+}
+
+/**********************LISTRECORD*************************
+rangeScan() visitor: writes a record as search_record() shows it.
+*/
+void listRecord(const RECORD *rec, void *out)
+{
+	fprintf((FILE *)out, "%s %s %d\n", rec->id, rec->name, rec->qty);
+}
+
+/**********************BATCHRECORD*************************
+rangeScan() visitor: writes a record as a batch result line.
+*/
+void batchRecord(const RECORD *rec, void *out)
+{
+	fprintf((FILE *)out, "REC\t%s\t%s\t%d\n", rec->id, rec->name, rec->qty);
+}
+
+/**********************OPENQTYCOLUMN*************************
+Opens the quantity column of a hash file: a side file, named after
+the hash file plus QTY_SUFFIX, holding a short for every possible
+ID at the ID's value, 0 where no record is stored. With the exact
+presence bitmap as its occupancy bitmap it answers the stock
+queries (stockSum(), lowStock(), topStock()) by streaming through
+memory instead of reading every record. The file is mapped where
+mmap is available, so only the parts holding records are written.
+Wide IDs have no exact bitmap to index by, so they get no column
+and the stock queries read the table instead. The column is
+rebuilt from the table if rebuild is set, or if the file is
+missing, does not match the table, or was not closed with it.
+*/
+void openQtyColumn(HASHDB *db, int rebuild)
+{
+	char name[FILENAME_MAX];
+	QTYHEADER header;
+	int valid;
+
+	if (!db->presenceExact)
+		return;
+	sprintf(name, "%s%s", db->filename, QTY_SUFFIX);
+	db->qtySize = QTY_HEADER + qtyLength() * (long)sizeof(short);
+	db->qtyFile = rebuild ? NULL : fopen(name, "r+b");
+	valid = db->qtyFile && fread(&header, sizeof header, 1, db->qtyFile) == 1 &&
+		memcmp(header.magic, QTY_MAGIC, sizeof header.magic) == 0 && header.idSize == ID_SIZE &&
+		header.clean && header.records == db->nrecords;
+	if (!valid)
+	{
+		if (db->qtyFile)
+			fclose(db->qtyFile);
+		if (!rebuild)
+			printf("Rebuilding the quantity column %s.\n", name);
+		db->qtyFile = fopen(name, "w+b");
+		if (!db->qtyFile)
+		{
+			printf("Couldn't open %s for writing.\n", name);
+			exit(201);
+		}
+	}
+#ifdef HAVE_MMAP
+	if (ftruncate(fileno(db->qtyFile), db->qtySize) != 0) // a new file reads back as zeros
+	{
+		printf("Quantity column could not be grown. Abort!\n");
+		exit(303);
+	}
+	db->qtyMap = (char *)mmap(NULL, db->qtySize, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(db->qtyFile), 0);
+	if (db->qtyMap == MAP_FAILED)
+	{
+		printf("Could not map %s. Abort!\n", name);
+		exit(205);
+	}
+#else
+	db->qtyMap = (char *)calloc(db->qtySize, 1);
+	if (!db->qtyMap)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	rewind(db->qtyFile);
+	if (valid && (long)fread(db->qtyMap, 1, db->qtySize, db->qtyFile) != db->qtySize)
+	{
+		printf("Fatal read error! Abort!\n");
+		exit(304);
+	}
+#endif
+	db->qtyColumn = (short *)(db->qtyMap + QTY_HEADER);
+	if (!valid)
+		scanRecords(db, columnRecord, db);
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, QTY_MAGIC, sizeof header.magic);
+	header.idSize = ID_SIZE;
+	header.clean = 0; // not clean again until closeQtyColumn()
+	memcpy(db->qtyMap, &header, sizeof header);
+}
+
+/**********************CLOSEQTYCOLUMN*************************
+Marks the quantity column clean, writes it back and closes it.
+*/
+void closeQtyColumn(HASHDB *db)
+{
+	QTYHEADER header;
+
+	if (!db->qtyColumn)
+		return;
+	memcpy(&header, db->qtyMap, sizeof header);
+	header.clean = 1;
+	header.records = db->nrecords;
+	memcpy(db->qtyMap, &header, sizeof header);
+#ifdef HAVE_MMAP
+	if (msync(db->qtyMap, db->qtySize, MS_SYNC) != 0 || munmap(db->qtyMap, db->qtySize) != 0)
+	{
+		printf("Could not sync the quantity column. Abort!\n");
+		exit(206);
+	}
+#else
+	rewind(db->qtyFile);
+	if ((long)fwrite(db->qtyMap, 1, db->qtySize, db->qtyFile) != db->qtySize)
+	{
+		printf("Fatal write error! Abort!\n");
+		exit(305);
+	}
+	free(db->qtyMap);
+#endif
+	if (fclose(db->qtyFile) == EOF)
+	{
+		printf("Error closing the quantity column!\nExiting.\n");
+		exit(104);
+	}
+	db->qtyColumn = NULL;
+	db->qtyMap = NULL;
+	db->qtyFile = NULL;
+}
+
+/**********************QTYLENGTH*************************
+Returns the entries in the quantity column: one per possible ID,
+rounded up to a whole 64-bit word of the presence bitmap.
+*/
+long qtyLength(void)
+{
+	return (keySpace() + 63) / 64 * 64;
+}
+
+/**********************SETQTY*************************
+Records the quantity stored under an ID; 0 once it is deleted.
+*/
+void setQty(HASHDB *db, const char *id, int qty)
+{
+	long value;
+
+	if (db->qtyColumn && (value = presenceBit(db, id, 0)) >= 0)
+		db->qtyColumn[value] = (short)qty;
+}
+
+/**********************COLUMNRECORD*************************
+scanRecords() visitor: copies a record's quantity to the column.
+*/
+void columnRecord(const RECORD *rec, void *db)
+{
+	setQty((HASHDB *)db, rec->id, rec->qty);
+}
+
+/**********************SCANRECORDS*************************
+Calls visit for every record in the table, in file order, reading
+each bucket and overflow chain once. Returns the records visited.
+*/
+long scanRecords(HASHDB *db, void (*visit)(const RECORD *rec, void *arg), void *arg)
+{
+	BUCKET home;
+	OFLOWPAGE page;
+	RECORD rec;
+	long bucket, next, visited = 0;
+	int k;
+
+	for (bucket = 0; bucket < db->nbuckets; bucket++)
+	{
+		readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+		for (k = 0; k < BUCKETSIZE; k++)
+			if (KEY_LIVE(home.key[k]))
+			{
+				unpackSlot(home.key[k], &home.data[k], &rec);
+				visit(&rec, arg);
+				visited++;
+			}
+		for (next = home.next; next; next = page.next)
+		{
+			readBlock(db, next, sizeof(OFLOWPAGE), &page);
+			for (k = 0; k < OFLOWSIZE; k++)
+				if (KEY_LIVE(page.key[k]))
+				{
+					unpackSlot(page.key[k], &page.data[k], &rec);
+					visit(&rec, arg);
+					visited++;
+				}
+		}
+	}
+	return visited;
+}
+
+/**********************STOCKSUM*************************
+Returns the total quantity of every record in the table.
+*/
+long long stockSum(HASHDB *db)
+{
+	STOCKSCAN scan;
+
+	if (db->qtyColumn)
+		return columnSum(db);
+	memset(&scan, 0, sizeof scan);
+	scanRecords(db, stockRow, &scan);
+	return scan.sum;
+}
+
+/**********************LOWSTOCK*************************
+Counts the records with a quantity below threshold and copies the
+first max of them, in ID order, to items. Returns the count.
+*/
+long lowStock(HASHDB *db, int threshold, STOCKITEM *items, long max)
+{
+	STOCKSCAN scan;
+
+	if (threshold > 10000) // quantities are 0-9999
+		threshold = 10000;
+	if (threshold <= 0)
+		return 0;
+	if (db->qtyColumn && db->presence)
+		return columnLow(db, threshold, items, max);
+	memset(&scan, 0, sizeof scan);
+	scan.low = threshold;
+	scan.lowItems = items;
+	scan.lowMax = max;
+	scanRecords(db, stockRow, &scan);
+	if (items)
+		qsort(items, scan.lowCount < max ? scan.lowCount : max, sizeof(STOCKITEM), compareStockIDs);
+	return scan.lowCount;
+}
+
+/**********************TOPSTOCK*************************
+Copies the n records with the largest quantities to top, largest
+first, and returns how many there were (fewer than n only if the
+table holds fewer records).
+*/
+int topStock(HASHDB *db, int n, STOCKITEM *top)
+{
+	STOCKSCAN scan;
+
+	if (n <= 0)
+		return 0;
+	if (db->qtyColumn && db->presence)
+		return columnTop(db, n, top);
+	memset(&scan, 0, sizeof scan);
+	scan.top = top;
+	scan.topN = n;
+	scanRecords(db, stockRow, &scan);
+	qsort(top, scan.topCount, sizeof(STOCKITEM), compareStock);
+	return scan.topCount;
+}
+
+/**********************COLUMNSUM*************************
+stockSum() from the quantity column. IDs not stored hold 0, so
+the whole column is added up without the bitmap, eight quantities
+per SSE2 step where the compiler targets it. A 32-bit lane gains
+at most 2 * 9999 per step, so the lanes are emptied into the total
+every QTY_SUMSTEPS steps, before they could overflow.
+*/
+long long columnSum(HASHDB *db)
+{
+	long i, n = qtyLength();
+	long long sum = 0;
+#ifdef HAVE_SSE2
+	__m128i ones = _mm_set1_epi16(1), lanes;
+	int part[4];
+	long stop;
+
+	for (i = 0; i < n; )
+	{
+		lanes = _mm_setzero_si128();
+		for (stop = n - i > QTY_SUMSTEPS * 8L ? i + QTY_SUMSTEPS * 8L : n; i < stop; i += 8)
+			lanes = _mm_add_epi32(lanes, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(db->qtyColumn + i)), ones));
+		_mm_storeu_si128((__m128i *)part, lanes);
+		sum += (long long)part[0] + part[1] + part[2] + part[3];
+	}
+#else
+	for (i = 0; i < n; i++)
+		sum += db->qtyColumn[i];
+#endif
+	return sum;
+}
+
+/**********************COLUMNLOW*************************
+lowStock() from the quantity column. Eight quantities, one byte of
+the presence bitmap, are compared with the threshold at a time;
+the lanes that are below it are packed into a byte and masked with
+the bitmap byte, so IDs not stored drop out. Bitmap words with no
+IDs skip 64 quantities at once.
+*/
+long columnLow(HASHDB *db, int threshold, STOCKITEM *items, long max)
+{
+	long i, n = qtyLength(), count = 0;
+	unsigned long long word;
+	int bits, k;
+#ifdef HAVE_SSE2
+	__m128i limit = _mm_set1_epi16((short)threshold), zero = _mm_setzero_si128();
+#endif
+
+	for (i = 0; i < n; i += 8)
+	{
+		if (i % 64 == 0)
+		{
+			memcpy(&word, db->presence + i / 8, sizeof word);
+			if (word == 0)
+			{
+				i += 56;
+				continue;
+			}
+		}
+		if (!(bits = db->presence[i / 8]))
+			continue;
+#ifdef HAVE_SSE2
+		bits &= _mm_movemask_epi8(_mm_packs_epi16(_mm_cmplt_epi16(
+			_mm_loadu_si128((const __m128i *)(db->qtyColumn + i)), limit), zero));
+#else
+		for (k = 0; k < 8; k++)
+			if (db->qtyColumn[i + k] >= threshold)
+				bits &= ~(1 << k);
+#endif
+		for (; bits; bits &= bits - 1)
+		{
+			for (k = 0; !(bits >> k & 1); k++)
+				;
+			if (count < max)
+			{
+				items[count].id = i + k;
+				items[count].qty = db->qtyColumn[i + k];
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+/**********************COLUMNTOP*************************
+topStock() from the quantity column. Once the heap holds n records
+only larger quantities can enter it, so each group of eight is
+first compared with the smallest quantity in the heap and most
+groups are passed over without looking at a single record.
+*/
+int columnTop(HASHDB *db, int n, STOCKITEM *top)
+{
+	long i, len = qtyLength();
+	unsigned long long word;
+	int bits, k, count = 0, least = -1; // quantities up to this cannot enter the heap
+#ifdef HAVE_SSE2
+	__m128i zero = _mm_setzero_si128();
+#endif
+
+	for (i = 0; i < len; i += 8)
+	{
+		if (i % 64 == 0)
+		{
+			memcpy(&word, db->presence + i / 8, sizeof word);
+			if (word == 0)
+			{
+				i += 56;
+				continue;
+			}
+		}
+		if (!(bits = db->presence[i / 8]))
+			continue;
+#ifdef HAVE_SSE2
+		bits &= _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(
+			_mm_loadu_si128((const __m128i *)(db->qtyColumn + i)), _mm_set1_epi16((short)least)), zero));
+#else
+		for (k = 0; k < 8; k++)
+			if (db->qtyColumn[i + k] <= least)
+				bits &= ~(1 << k);
+#endif
+		for (; bits; bits &= bits - 1)
+		{
+			for (k = 0; !(bits >> k & 1); k++)
+				;
+			if (db->qtyColumn[i + k] > least)
+			{
+				offerTop(top, n, &count, i + k, db->qtyColumn[i + k]);
+				if (count == n)
+					least = top[0].qty;
+			}
+		}
+	}
+	qsort(top, count, sizeof(STOCKITEM), compareStock);
+	return count;
+}
+
+/**********************STOCKROW*************************
+scanRecords() visitor answering the stock queries from the records
+themselves, for tables without a quantity column.
+*/
+void stockRow(const RECORD *rec, void *arg)
+{
+	STOCKSCAN *scan = (STOCKSCAN *)arg;
+
+	scan->sum += rec->qty;
+	if (rec->qty < scan->low)
+	{
+		if (scan->lowCount < scan->lowMax)
+		{
+			scan->lowItems[scan->lowCount].id = atol(rec->id);
+			scan->lowItems[scan->lowCount].qty = rec->qty;
+		}
+		scan->lowCount++;
+	}
+	if (scan->topN > 0)
+		offerTop(scan->top, scan->topN, &scan->topCount, atol(rec->id), rec->qty);
+}
+
+/**********************OFFERTOP*************************
+Adds a record to a min-heap of the n largest quantities seen so
+far, holding *count of them; once it is full a record only enters
+by replacing the smallest.
+*/
+void offerTop(STOCKITEM *top, int n, int *count, long id, int qty)
+{
+	STOCKITEM item;
+	int i, child;
+
+	item.id = id;
+	item.qty = qty;
+	if (*count < n)
+	{
+		for (i = (*count)++; i > 0 && top[(i - 1) / 2].qty > qty; i = (i - 1) / 2)
+			top[i] = top[(i - 1) / 2];
+		top[i] = item;
+		return;
+	}
+	if (qty <= top[0].qty)
+		return;
+	for (i = 0; (child = 2 * i + 1) < n; i = child)
+	{
+		if (child + 1 < n && top[child + 1].qty < top[child].qty)
+			child++;
+		if (top[child].qty >= qty)
+			break;
+		top[i] = top[child];
+	}
+	top[i] = item;
+}
+
+/**********************COMPARESTOCK*************************
+qsort() comparison: largest quantity first, then by ID.
+*/
+int compareStock(const void *a, const void *b)
+{
+	const STOCKITEM *x = (const STOCKITEM *)a, *y = (const STOCKITEM *)b;
+
+	if (x->qty != y->qty)
+		return y->qty - x->qty;
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/**********************COMPARESTOCKIDS*************************
+qsort() comparison: by ID.
+*/
+int compareStockIDs(const void *a, const void *b)
+{
+	const STOCKITEM *x = (const STOCKITEM *)a, *y = (const STOCKITEM *)b;
+
+	return (x->id > y->id) - (x->id < y->id);
+}
+
+/**********************VISITSTOCK*************************
+Looks up the record of a stock query result and hands it to a
+rangeScan() visitor, so the reports print whole records.
+*/
+void visitStock(HASHDB *db, const STOCKITEM *item, void (*visit)(const RECORD *rec, void *arg), void *arg)
+{
+	char id[ID_SIZE + 1];
+	RECORD rec;
+	int slot;
+
+	sprintf(id, "%0*ld", ID_SIZE, item->id);
+	if (findRecord(db, id, &rec, &slot) >= 0)
+		visit(&rec, arg);
+}
+
+/************************HASH************************
+Hashes the first size characters of key (fewer if it is
+shorter) with the selected function. The caller reduces
+the result to a bucket number (see bucketAddress).
+HASH_CUBES sums each ASCII code cubed, so every permutation
+of the same digits lands in the same bucket; HASH_FNV and
+HASH_MIX depend on every character and its position.
+*/
+long hash(char *key, int size, int func)
+{
+	unsigned long long h;
+	int i;
+
+	switch (func)
+	{
+	case HASH_CUBES:
+		h = 0;
+		for (i = 0; i < size && key[i] != '\0'; i++)
+			h += key[i] * key[i] * key[i];
+		return (long)h;
+	case HASH_FNV:
+		h = 14695981039346656037ULL;
+		for (i = 0; i < size && key[i] != '\0'; i++)
+			h = (h ^ (unsigned char)key[i]) * 1099511628211ULL;
+		break;
+	default: // HASH_MIX
+		h = (unsigned long long)size * 0x9E3779B97F4A7C15ULL;
+		for (i = 0; i < size && key[i] != '\0'; i++)
+			h = (h ^ (unsigned char)key[i]) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 33; // avalanche so the low bits depend on every character
+		h *= 0xC2B2AE3D27D4EB4FULL;
+		h ^= h >> 29;
+		h *= 0x165667B19E3779F9ULL;
+		h ^= h >> 32;
+		break;
+	}
+	return (long)(h & LONG_MAX);
+}
+
+/************************HASHBYNAME************************
+Returns the HASH_ constant for "cubes", "fnv" or "mix",
+or -1 for any other name.
+*/
+int hashByName(char *name)
+{
+	char *names[HASH_COUNT] = { "cubes", "fnv", "mix" };
+	int i;
+
+	for (i = 0; i < HASH_COUNT; i++)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/************************KEYSPACE************************
+Returns the number of IDs that fit in ID_SIZE digits.
+*/
+long keySpace(void)
+{
+	long space = 1;
+	int i;
+	for (i = 0; i < ID_SIZE && i < 18; i++)
+		space *= 10;
+	return space;
+}
+
+/************************PRESENCEBIT************************
+Returns the presence bit for an ID. An exact bitmap has one
+bit per ID, the ID's own value; a Bloom filter takes bit i of
+BLOOM_HASHES from the ID's hash. Returns -1 for an ID that
+is not ID_SIZE digits, since such an ID is never stored.
+*/
+long presenceBit(HASHDB *db, const char *id, int i)
+{
+	unsigned long long h;
+	long value = 0;
+	int k;
+
+	for (k = 0; k < ID_SIZE; k++)
+	{
+		if (!isdigit((unsigned char)id[k]))
+			return -1;
+		value = value * 10 + (id[k] - '0');
+	}
+	if (id[k] != '\0')
+		return -1;
+	if (db->presenceExact)
+		return value;
+	h = (unsigned long long)hash((char *)id, ID_SIZE, HASH_MIX);
+	return (long)((h + i * ((h >> 31) | 1)) % db->presenceBits);
+}
+
+/************************PRESENCETEST************************
+Returns 0 if the ID is certainly not in the table, so callers
+can skip the disk; 1 if it is (exact bitmap) or may be (Bloom
+filter, where the bucket still has to be read to be sure).
+*/
+int presenceTest(HASHDB *db, const char *id)
+{
+	long bit;
+	int i;
+
+	if (!db->presence)
+		return 1;
+	for (i = 0; i < (db->presenceExact ? 1 : BLOOM_HASHES); i++)
+	{
+		if ((bit = presenceBit(db, id, i)) < 0)
+			return 0;
+		if (!(PRESENCE_LOAD(db, bit / 8) & (1 << bit % 8)))
+			return 0;
+	}
+	return 1;
+}
+
+/************************PRESENCESET************************
+Records that an ID has been stored.
+*/
+void presenceSet(HASHDB *db, const char *id)
+{
+	long bit;
+	int i;
+
+	if (!db->presence)
+		return;
+	for (i = 0; i < (db->presenceExact ? 1 : BLOOM_HASHES); i++)
+		if ((bit = presenceBit(db, id, i)) >= 0)
+			PRESENCE_OR(db, bit / 8, 1 << bit % 8);
+	db->presenceDirty = 1;
+}
+
+/************************PRESENCECLEAR************************
+Records that an ID has been deleted. A Bloom filter cannot
+forget an ID, so its bits stay set and later lookups of the
+ID read the bucket to find it gone.
+*/
+void presenceClear(HASHDB *db, const char *id)
+{
+	long bit;
+
+	if (!db->presence || !db->presenceExact)
+		return;
+	if ((bit = presenceBit(db, id, 0)) >= 0)
+		PRESENCE_AND(db, bit / 8, ~(1 << bit % 8));
+	db->presenceDirty = 1;
+}
+
+/**********************BUCKETADDRESS*************************
+Linear hashing: reduce the hash modulo the table size at the
+start of the current round. Buckets before the split pointer
+have already been split, so use the next round's size for them.
+*/
+long bucketAddress(HASHDB *db, char *key)
+{
+	long h = hash(key, ID_SIZE, db->hashFunc);
+	long address = h % ((long)TABSIZE << db->level);
+
+	if (address < db->split)
+		address = h % ((long)TABSIZE << (db->level + 1));
+	return address;
+}
+
+/**********************BUCKETOFFSET*************************
+Returns the file offset of a bucket. Group 0 holds buckets
+0 to TABSIZE-1; every later group is as large as all the
+groups before it, and starts wherever it was reserved.
+*/
+long bucketOffset(HASHDB *db, long bucket)
+{
+	int group = 0;
+	long first = 0, size = TABSIZE;
+
+	while (bucket >= first + size)
+	{
+		first += size;
+		size = first;
+		group++;
+	}
+	return db->groupStart[group] + (bucket - first) * BUCKET_BYTES;
+}
+
+/**********************ALIGNOFFSET*************************
+Rounds a file offset up to a multiple of size.
+*/
+long alignOffset(long offset, long size)
+{
+	return (offset + size - 1) / size * size;
+}
+
+/**********************PACKID*************************
+Returns the packed key of an ID: its value plus 2, so no ID packs
+to KEY_EMPTY or KEY_TOMBSTONE. Anything that is not ID_SIZE digits
+packs to KEY_EMPTY, which matches no stored record.
+*/
+PACKEDKEY packID(const char *id)
+{
+	PACKEDKEY key = 0;
+	int i;
+
+	for (i = 0; i < ID_SIZE; i++)
+	{
+		if (id[i] < '0' || id[i] > '9')
+			return KEY_EMPTY;
+		key = key * 10 + (id[i] - '0');
+	}
+	return id[ID_SIZE] == '\0' ? key + 2 : KEY_EMPTY;
+}
+
+/**********************UNPACKID*************************
+Writes the ID a live packed key stands for, with its leading zeros.
+*/
+void unpackID(PACKEDKEY key, char *id)
+{
+	int i;
+
+	key -= 2;
+	for (i = ID_SIZE - 1; i >= 0; i--, key /= 10)
+		id[i] = (char)('0' + key % 10);
+	id[ID_SIZE] = '\0';
+}
+
+/**********************PACKSLOT*************************
+Splits a record into the control byte, key and payload stored in
+a slot.
+*/
+void packSlot(const RECORD *rec, unsigned char *ctrl, PACKEDKEY *key, PAYLOAD *data)
+{
+	size_t len = strlen(rec->name);
+
+	*key = packID(rec->id);
+	*ctrl = ctrlByte(*key);
+	memset(data->name, 0, NAME_SIZE);
+	memcpy(data->name, rec->name, len < NAME_SIZE ? len : NAME_SIZE);
+	data->qty = (short)rec->qty;
+}
+
+/**********************UNPACKSLOT*************************
+Rebuilds the record held by a live slot.
+*/
+void unpackSlot(PACKEDKEY key, const PAYLOAD *data, RECORD *rec)
+{
+	unpackID(key, rec->id);
+	memcpy(rec->name, data->name, NAME_SIZE);
+	rec->name[NAME_SIZE] = '\0';
+	rec->qty = data->qty;
+}
+
+/**********************SLOTADDR*************************
+Sets the file offsets of slot i of the bucket (page 0) or the
+overflow page (page 1) at offset.
+*/
+void slotAddr(long offset, int page, int i, SLOTADDR *at)
+{
+	at->ctrl = offset + (page ? offsetof(OFLOWPAGE, ctrl) : offsetof(BUCKET, ctrl)) + i;
+	at->key = offset + (page ? offsetof(OFLOWPAGE, key) : offsetof(BUCKET, key)) + i * sizeof(PACKEDKEY);
+	at->data = offset + (page ? offsetof(OFLOWPAGE, data) : offsetof(BUCKET, data)) + i * sizeof(PAYLOAD);
+}
+
+/**********************CTRLBYTE*************************
+Returns the control byte of a live slot holding key: CTRL_FULL and
+a 7-bit tag from the top of a multiplicative hash of the key. The
+tag does not depend on the bits that chose the bucket, so a probe
+compares the key of about one other slot in 128.
+*/
+unsigned char ctrlByte(PACKEDKEY key)
+{
+	return (unsigned char)(CTRL_FULL | (unsigned int)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> 57));
+}
+
+/**********************CTRLMATCH*************************
+Returns a mask with bit i set for every slot i < n whose control
+byte is c. The CTRL_WIDTH(n) control bytes are compared 16 at a
+time with SSE2, or by ctrlMatchScalar() without. Blocks hold at
+most 16 slots, so one compare covers a block; a 32-byte AVX2
+compare would only read past its control bytes.
+*/
+unsigned int ctrlMatch(const unsigned char *ctrl, int n, unsigned char c)
+{
+#ifdef HAVE_SSE2
+	unsigned int mask = 0;
+	int i = 0, width = CTRL_WIDTH(n);
+	for (; i < width; i += CTRL_GROUP)
+		mask |= (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(ctrl + i)), _mm_set1_epi8((char)c))) << i;
+	return n < 32 ? mask & ((1u << n) - 1) : mask;
+#else
+	return ctrlMatchScalar(ctrl, n, c);
+#endif
+}
+
+/**********************CTRLMATCHSCALAR*************************
+ctrlMatch() a byte at a time, for builds without SSE2.
+*/
+unsigned int ctrlMatchScalar(const unsigned char *ctrl, int n, unsigned char c)
+{
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		mask |= (unsigned int)(ctrl[i] == c) << i;
+	return mask;
+}
+
+/**********************LOWESTBIT*************************
+Returns the number of the lowest set bit of a nonzero mask.
+*/
+int lowestBit(unsigned int mask)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(mask);
+#else
+	int i = 0;
+
+	for (; !(mask & 1); mask >>= 1)
+		i++;
+	return i;
+#endif
+}
+
+/**********************PROBEBLOCK*************************
+Looks for a packed key among the n slots of a bucket or overflow
+page. Every control byte is matched against the key's at once,
+and only the keys of the slots that match are compared. Returns
+the slot, or -1, setting *end if the block has a slot never used,
+which ends the records of a chain.
+*/
+int probeBlock(const unsigned char *ctrl, const PACKEDKEY *keys, int n, PACKEDKEY key, int *end)
+{
+	unsigned int match = ctrlMatch(ctrl, n, ctrlByte(key));
+	int i;
+
+	for (; match; match &= match - 1)
+	{
+		i = lowestBit(match);
+		if (keys[i] == key)
+			return i;
+	}
+	*end = ctrlMatch(ctrl, n, CTRL_EMPTY) != 0;
+	return -1;
+}
+
+/**********************ALLOCPAGE*************************
+Returns the offset of an empty overflow page, reusing a page
+from the free list when there is one and otherwise appending
+one to the end of the file.
+*/
+long allocPage(HASHDB *db)
+{
+	OFLOWPAGE page = { 0 };
+	long offset = db->freePages;
+
+	if (offset)
+	{
+		readBlock(db, offset, sizeof(OFLOWPAGE), &page);
+		db->freePages = page.next;
+		memset(&page, 0, sizeof page);
+		storeBlock(db, offset, sizeof(OFLOWPAGE), &page);
+	}
+	else
+	{
+		offset = alignOffset(db->fileEnd, PAGE_BYTES);
+		growFile(db, offset + PAGE_BYTES);
+	}
+	db->npages++;
+	return offset;
+}
+
+/**********************FREEPAGE*************************
+Puts an overflow page on the free list.
+*/
+void freePage(HASHDB *db, long offset)
+{
+	OFLOWPAGE page = { 0 };
+
+	page.next = db->freePages;
+	storeBlock(db, offset, sizeof(OFLOWPAGE), &page);
+	db->freePages = offset;
+	db->npages--;
+}
+
+/**********************FILLBUCKET*************************
+Rewrites a bucket with n records. Records that do not fit in the
+bucket go to overflow pages taken from the end of pages[] (then
+from allocPage); *npages is reduced by the pages used.
+*/
+void fillBucket(HASHDB *db, long bucket, RECORD *recs, int n, long *pages, int *npages)
+{
+	BUCKET home = { 0 };
+	OFLOWPAGE page;
+	long offset = 0, next;
+	int i, k;
+
+	for (i = 0; i < n && i < BUCKETSIZE; i++)
+		packSlot(&recs[i], &home.ctrl[i], &home.key[i], &home.data[i]);
+	if (i < n)
+		offset = home.next = *npages > 0 ? pages[--*npages] : allocPage(db);
+	storeBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+
+	while (i < n)
+	{
+		memset(&page, 0, sizeof page);
+		for (k = 0; k < OFLOWSIZE && i < n; k++, i++)
+			packSlot(&recs[i], &page.ctrl[k], &page.key[k], &page.data[k]);
+		next = 0;
+		if (i < n)
+			next = page.next = *npages > 0 ? pages[--*npages] : allocPage(db);
+		storeBlock(db, offset, sizeof(OFLOWPAGE), &page);
+		offset = next;
+	}
+	if (n > BUCKETSIZE)
+		db->oflowRecords += n - BUCKETSIZE;
+}
+
+/**********************ADDBUCKET*************************
+Adds an empty bucket to the end of the table and advances the
+split pointer. The first bucket of a round reserves space for
+every bucket that round will create, starting on a 4 KB boundary,
+so buckets stay at computable, aligned offsets. Returns the new
+bucket's number.
+*/
+long addBucket(HASHDB *db)
+{
+	long roundSize = (long)TABSIZE << db->level;
+	long newBucket = db->split + roundSize;
+
+	if (db->split == 0) // reserve the next group (read back as empty buckets)
+	{
+		db->groupStart[db->level + 1] = alignOffset(db->fileEnd, POOL_PAGESIZE);
+		growFile(db, db->groupStart[db->level + 1] + roundSize * BUCKET_BYTES);
+	}
+	db->nbuckets++;
+	if (++db->split == roundSize) // every bucket of this round has been split
+	{
+		db->level++;
+		db->split = 0;
+	}
+	return newBucket;
+}
+
+/**********************SPLITBUCKET*************************
+Splits the bucket at the split pointer. The records in it and
+in its overflow chain are divided between the old bucket and
+the new bucket at the end of the table, each with its own chain.
+*/
+void splitBucket(HASHDB *db)
+{
+	BUCKET home;
+	OFLOWPAGE page;
+	long roundSize = (long)TABSIZE << db->level;
+	long oldBucket = db->split;
+	long newBucket = addBucket(db);
+	long next, *pages, nslots;
+	RECORD *keep, *move, rec;
+	int nkeep = 0, nmove = 0, npages = 0, i;
+
+	db->splits++;
+	// count the chain so both halves can be sized
+	readBlock(db, bucketOffset(db, oldBucket), sizeof(BUCKET), &home);
+	for (next = home.next; next; next = page.next, npages++)
+		readBlock(db, next, sizeof(OFLOWPAGE), &page);
+	nslots = BUCKETSIZE + npages * OFLOWSIZE;
+	reserveScratch(db, 2 * nslots, npages + 1);
+	pages = db->scratchPages;
+	keep = db->scratch;
+	move = db->scratch + nslots;
+
+	for (i = 0; i < BUCKETSIZE; i++)
+	{
+		db->tombstones -= home.key[i] == KEY_TOMBSTONE; // splitting reclaims them
+		if (!KEY_LIVE(home.key[i]))
+			continue;
+		unpackSlot(home.key[i], &home.data[i], &rec);
+		if (hash(rec.id, ID_SIZE, db->hashFunc) % (2 * roundSize) == oldBucket)
+			keep[nkeep++] = rec;
+		else
+			move[nmove++] = rec;
+	}
+	for (next = home.next, npages = 0; next; next = page.next)
+	{
+		pages[npages++] = next;
+		readBlock(db, next, sizeof(OFLOWPAGE), &page);
+		for (i = 0; i < OFLOWSIZE; i++)
+		{
+			db->tombstones -= page.key[i] == KEY_TOMBSTONE;
+			if (!KEY_LIVE(page.key[i]))
+				continue;
+			db->oflowRecords--;
+			unpackSlot(page.key[i], &page.data[i], &rec);
+			if (hash(rec.id, ID_SIZE, db->hashFunc) % (2 * roundSize) == oldBucket)
+				keep[nkeep++] = rec;
+			else
+				move[nmove++] = rec;
+		}
+	}
+
+	// the old chain's pages are reused for the two new chains
+	fillBucket(db, oldBucket, keep, nkeep, pages, &npages);
+	fillBucket(db, newBucket, move, nmove, pages, &npages);
+	while (npages > 0)
+		freePage(db, pages[--npages]);
+}
+
+/**********************RESERVESCRATCH*************************
+Makes sure the table's scratch buffers hold at least nrecs records
+and npages page offsets. The buffers only ever grow, so splits
+and merges stop allocating once the largest chain has been seen.
+*/
+void reserveScratch(HASHDB *db, long nrecs, long npages)
+{
+	if (nrecs > db->scratchRecs)
+	{
+		free(db->scratch);
+		db->scratchRecs = nrecs > 2 * db->scratchRecs ? nrecs : 2 * db->scratchRecs;
+		db->scratch = (RECORD *)malloc(db->scratchRecs * sizeof(RECORD));
+	}
+	if (npages > db->scratchPageCap)
+	{
+		free(db->scratchPages);
+		db->scratchPageCap = npages > 2 * db->scratchPageCap ? npages : 2 * db->scratchPageCap;
+		db->scratchPages = (long *)malloc(db->scratchPageCap * sizeof(long));
+	}
+	if (!db->scratch || !db->scratchPages)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+}
+
+/****************************INSERT****************************
+The insert function accepts a pointer to a record and a hash
+table as input. The record is packed into a control byte, a key
+and a payload. It hashes the record id, and writes the information
+to the file. Records that do not fit in the bucket go to its
+overflow chain. The first tombstone on the way is reused, but the
+search for a duplicate goes on to the first slot never used, which
+ends the records of a bucket. Once the table is fuller than
+LOAD_FACTOR, one bucket is split.
+Returns 1 if the record was added, 0 for a duplicate ID.
+*/
+int insert(const RECORD *newRecord, HASHDB *db)
+{
+	BUCKET homeBuf, *home;
+	OFLOWPAGE pageBuf, *page;
+	int i, k, end = 0, freeSlot = -1, freeDead = 0;
+	int known = db->presence && db->presenceExact; // the bitmap has ruled out a duplicate
+	unsigned int open;
+
+	long address = bucketAddress(db, (char *)newRecord->id);
+	long offset = bucketOffset(db, address);
+	long link = offset + offsetof(BUCKET, next); // where to hook on a new page
+	long next;
+	SLOTADDR at = { -1, -1, -1 };
+	unsigned char ctrl;
+	PACKEDKEY key;
+	PAYLOAD data;
+	OPSTATS *stats = &db->stats[OP_PUT];
+
+	// an exact presence bitmap rejects duplicates without reading the bucket
+	STAT_ADD(db, stats->ops, 1);
+	if (known && presenceTest(db, newRecord->id))
+	{
+		STAT_ADD(db, stats->filtered, 1);
+		if (!db->quiet)
+			printf("Duplicate ID detected! Unable to insert %s.\n", newRecord->name);
+		return 0;
+	}
+	packSlot(newRecord, &ctrl, &key, &data);
+
+	// find the first reusable slot in the bucket (one read for the whole bucket)
+	home = (BUCKET *)fetchBlock(db, offset, sizeof(BUCKET), &homeBuf);
+	STAT_ADD(db, stats->probes, 1);
+	next = home->next;
+	if (!known && probeBlock(home->ctrl, home->key, BUCKETSIZE, key, &end) >= 0) // do not insert duplicate IDs! (bucket)
+	{
+		if (!db->quiet)
+			printf("Duplicate ID detected! Unable to insert %s.\n", newRecord->name);
+		return 0;
+	}
+	open = ctrlMatch(home->ctrl, BUCKETSIZE, CTRL_EMPTY) | ctrlMatch(home->ctrl, BUCKETSIZE, CTRL_TOMBSTONE);
+	if (open) // available slot
+	{
+		i = lowestBit(open);
+		slotAddr(offset, 0, i, &at);
+		freeDead = home->ctrl[i] == CTRL_TOMBSTONE;
+		end |= known;
+	}
+	// then search this bucket's overflow chain
+	for (k = 0; next && !end; k++)
+	{
+		offset = next;
+		page = (OFLOWPAGE *)fetchBlock(db, offset, sizeof(OFLOWPAGE), &pageBuf);
+		STAT_ADD(db, stats->probes, 1);
+		link = offset + offsetof(OFLOWPAGE, next);
+		next = page->next;
+		if (!known && probeBlock(page->ctrl, page->key, OFLOWSIZE, key, &end) >= 0) // do not insert duplicate IDs! (oflow)
+		{
+			if (!db->quiet)
+				printf("Duplicate ID detected! Unable to insert %s.\n", newRecord->name);
+			return 0;
+		}
+		open = ctrlMatch(page->ctrl, OFLOWSIZE, CTRL_EMPTY) | ctrlMatch(page->ctrl, OFLOWSIZE, CTRL_TOMBSTONE);
+		if (at.key < 0 && open)
+		{
+			i = lowestBit(open);
+			slotAddr(offset, 1, i, &at);
+			freeSlot = k * OFLOWSIZE + i;
+			freeDead = page->ctrl[i] == CTRL_TOMBSTONE;
+			end |= known;
+		}
+	}
+	placeRecord(db, newRecord, address, &at, link, k, freeSlot, freeDead);
+	return 1;
+}
+
+/****************************PLACERECORD****************************
+Writes a record to the slot insert() found for it. When its chain
+of npages overflow pages had no free slot (at->key < 0), a new page
+is hooked on at link and the record goes there. Then updates the
+table's counts and, once the table is fuller than LOAD_FACTOR,
+splits one bucket. freeSlot is the chain slot, or -1 for the
+bucket, and freeDead is 1 if the slot held a tombstone.
+*/
+void placeRecord(HASHDB *db, const RECORD *newRecord, long address, SLOTADDR *at, long link, int npages, int freeSlot, int freeDead)
+{
+	unsigned char ctrl;
+	PACKEDKEY key;
+	PAYLOAD data;
+	long offset;
+	OPSTATS *stats = &db->stats[OP_PUT];
+
+	packSlot(newRecord, &ctrl, &key, &data);
+	// chain full: hook a new page onto the end of it
+	if (at->key < 0)
+	{
+		lockMeta(db);
+		offset = allocPage(db);
+		unlockMeta(db);
+		freeSlot = npages * OFLOWSIZE;
+		storeBlock(db, link, sizeof(long), &offset);
+		slotAddr(offset, 1, 0, at);
+	}
+	// the payload and key before the control byte that makes them live
+	storeBlock(db, at->data, sizeof(PAYLOAD), &data);
+	storeBlock(db, at->key, sizeof(PACKEDKEY), &key);
+	storeBlock(db, at->ctrl, 1, &ctrl);
+	if (!db->quiet && freeSlot < 0)
+		printf("Insert: Record %s added to bucket %ld.\n", newRecord->id, address);
+	else if (!db->quiet)
+		printf("Insert: Record %s added to bucket %ld overflow slot %d.\n", newRecord->id, address, freeSlot);
+
+	lockMeta(db);
+	presenceSet(db, newRecord->id);
+	setQty(db, newRecord->id, newRecord->qty);
+	nameIndexChange(db, newRecord, 1);
+	db->nrecords++;
+	db->tombstones -= freeDead;
+	if (freeSlot >= 0)
+	{
+		db->oflowRecords++;
+		STAT_ADD(db, stats->oflow, 1);
+	}
+	unlockMeta(db);
+	if (!db->shared && db->nrecords > LOAD_FACTOR * db->nbuckets * BUCKETSIZE) // see maintainShared()
+		splitBucket(db);
+	walOpEnd(db);
+}
+
+/****************************FINDRECORD****************************
+Looks up an ID in its bucket and then in the bucket's overflow
+chain. Returns the file offset of the record and copies it to
+*found, or returns -1 if the ID is not in the table. *oflowSlot
+is set to the slot number in the chain, or -1 for the bucket.
+Counted as a lookup in the engine statistics.
+*/
+long findRecord(HASHDB *db, char *targetID, RECORD *found, int *oflowSlot)
+{
+	SLOTADDR at;
+
+	return probeRecord(db, targetID, found, oflowSlot, &at, &db->stats[OP_GET]);
+}
+
+/****************************PROBERECORD****************************
+The search behind findRecord(), deleteRecord() and updateRecord(),
+counting the blocks it reads in the given statistics.
+IDs the presence bitmap has never seen are rejected without
+reading the file, and the search stops at the first block with a
+slot never used; tombstones are stepped over. The target is packed
+once, each block is searched by probeBlock(), and only the matching
+payload is read. Returns the file offset of the record's key, and
+sets *at to the offsets of its slot.
+*/
+long probeRecord(HASHDB *db, char *targetID, RECORD *found, int *oflowSlot, SLOTADDR *at, OPSTATS *stats)
+{
+	BUCKET homeBuf, *home;
+	OFLOWPAGE pageBuf, *page;
+	PACKEDKEY key = packID(targetID);
+	int i, k, end = 0;
+	long next, offset;
+
+	STAT_ADD(db, stats->ops, 1);
+	if (!presenceTest(db, targetID))
+	{
+		STAT_ADD(db, stats->filtered, 1);
+		return -1;
+	}
+	offset = bucketOffset(db, bucketAddress(db, targetID));
+	home = (BUCKET *)fetchBlock(db, offset, sizeof(BUCKET), &homeBuf);
+	STAT_ADD(db, stats->probes, 1);
+	if ((i = probeBlock(home->ctrl, home->key, BUCKETSIZE, key, &end)) >= 0) // found it!
+	{
+		unpackSlot(key, &home->data[i], found);
+		*oflowSlot = -1;
+		slotAddr(offset, 0, i, at);
+		return at->key;
+	}
+	// check the overflow chain, unless nothing is stored past the bucket
+	for (k = 0, next = home->next; next && !end; k++)
+	{
+		offset = next;
+		page = (OFLOWPAGE *)fetchBlock(db, offset, sizeof(OFLOWPAGE), &pageBuf);
+		STAT_ADD(db, stats->probes, 1);
+		next = page->next;
+		if ((i = probeBlock(page->ctrl, page->key, OFLOWSIZE, key, &end)) >= 0) // found it!
+		{
+			unpackSlot(key, &page->data[i], found);
+			*oflowSlot = k * OFLOWSIZE + i;
+			STAT_ADD(db, stats->oflow, 1);
+			slotAddr(offset, 1, i, at);
+			return at->key;
+		}
+	}
+	return -1;
+}
+
+/****************************DELETERECORD****************************
+Deletes an ID from the table, leaving a tombstone in its slot's
+control byte and key so that searches step over it instead of
+stopping there. Then runs one compaction step, once tombstones
+are dense enough for the pass to find them quickly. Returns the
+file offset the key had and copies the record to *found, or
+returns -1 if the ID is not in the table; *oflowSlot is set as by
+findRecord().
+*/
+long deleteRecord(HASHDB *db, char *targetID, RECORD *found, int *oflowSlot)
+{
+	unsigned char ctrl = CTRL_TOMBSTONE;
+	PACKEDKEY tombstone = KEY_TOMBSTONE;
+	SLOTADDR at;
+	long offset = probeRecord(db, targetID, found, oflowSlot, &at, &db->stats[OP_DEL]);
+
+	if (offset < 0)
+		return -1;
+	storeBlock(db, at.ctrl, 1, &ctrl);
+	storeBlock(db, at.key, sizeof(PACKEDKEY), &tombstone);
+	lockMeta(db);
+	presenceClear(db, targetID);
+	setQty(db, targetID, 0);
+	nameIndexChange(db, found, 0);
+	db->nrecords--;
+	db->tombstones++;
+	if (*oflowSlot >= 0)
+		db->oflowRecords--;
+	unlockMeta(db);
+	walOpEnd(db);
+	if (!db->shared && db->tombstones * COMPACT_DENSITY > db->nbuckets) // see maintainShared()
+		compactStep(db, db->compactMicros);
+	return offset;
+}
+
+/****************************UPDATERECORD****************************
+Replaces the name and quantity of a stored record in place; only
+the payload is written. Returns the file offset of the record's
+key, or -1 if its ID is not in the table.
+*/
+long updateRecord(HASHDB *db, const RECORD *rec)
+{
+	RECORD old;
+	unsigned char ctrl;
+	PACKEDKEY key;
+	PAYLOAD data;
+	SLOTADDR at;
+	int slot;
+	long offset = probeRecord(db, (char *)rec->id, &old, &slot, &at, &db->stats[OP_UPD]);
+
+	if (offset < 0)
+		return -1;
+	packSlot(rec, &ctrl, &key, &data);
+	storeBlock(db, at.data, sizeof(PAYLOAD), &data);
+	setQty(db, rec->id, rec->qty);
+	if (strcmp(old.name, rec->name) != 0)
+	{
+		lockMeta(db);
+		nameIndexChange(db, &old, 0);
+		nameIndexChange(db, rec, 1);
+		unlockMeta(db);
+	}
+	walOpEnd(db);
+	return offset;
+}
+
+/****************************MULTIGET****************************
+Looks up a batch of IDs, given in recs[i].id, with the reads of
+the whole batch sorted by file offset (see multiProbe()). Each
+record found is copied to recs[i] and offsets[i] is set to what
+findRecord() would return for it, or to -1. Returns the number of
+records found. Counted as lookups in the engine statistics.
+*/
+long multiGet(HASHDB *db, RECORD *recs, long n, long *offsets)
+{
+	BATCHITEM *items;
+	long found = 0, i;
+
+	if (n <= 0)
+		return 0;
+	items = batchItems(db, recs, n, OP_GET);
+	multiProbe(db, items, n, recs, OP_GET);
+	for (i = 0; i < n; i++)
+	{
+		offsets[items[i].index] = items[i].at.key;
+		found += items[i].at.key >= 0;
+	}
+	free(items);
+	return found;
+}
+
+/****************************MULTIPUT****************************
+Inserts a batch of records as insert() would one at a time, but
+the buckets and chains of the whole batch are searched together
+(see multiProbe()). The table is grown for the batch first, so no
+bucket moves while it is in flight. The records are then written
+in file order, and records no chain had room for go to new pages,
+one page per OFLOWSIZE records of a chain. Of several records with
+the same ID, the first is added. Sets added[i], unless added is
+NULL, to 1 if recs[i] was added and 0 for a duplicate. Not for a
+shared table. Returns the number of records added.
+*/
+long multiPut(HASHDB *db, const RECORD *recs, long n, int *added)
+{
+	BATCHITEM *items, *item;
+	OFLOWPAGE page;
+	long count = 0, offset, next, i, j, m;
+	int k;
+	unsigned char ctrl;
+	PACKEDKEY key;
+	PAYLOAD data;
+
+	if (n <= 0)
+		return 0;
+	items = batchItems(db, recs, n, OP_PUT);
+	for (i = 0; i < n; i++)
+		count += !items[i].dup;
+	// grow the table for the records that may be new; an empty table has nothing to move
+	while (db->nrecords + count > LOAD_FACTOR * db->nbuckets * BUCKETSIZE)
+	{
+		if (db->nrecords > 0)
+			splitBucket(db);
+		else
+			addBucket(db);
+	}
+	for (i = 0; i < n; i++)
+		if (!items[i].dup)
+			items[i].block = bucketOffset(db, bucketAddress(db, (char *)recs[items[i].index].id));
+	multiProbe(db, items, n, NULL, OP_PUT);
+
+	// free slots in file order, then new pages chain by chain
+	qsort(items, n, sizeof(BATCHITEM), compareBatchSlots);
+	for (i = 0; i < n && items[i].at.key >= 0; i++)
+	{
+		if (items[i].dup)
+			continue;
+		packSlot(&recs[items[i].index], &ctrl, &key, &data);
+		// the payload and key before the control byte that makes them live
+		storeBlock(db, items[i].at.data, sizeof(PAYLOAD), &data);
+		storeBlock(db, items[i].at.key, sizeof(PACKEDKEY), &key);
+		storeBlock(db, items[i].at.ctrl, 1, &ctrl);
+	}
+	for (; i < n; i = j)
+	{
+		for (j = i; j < n && items[j].link == items[i].link; j++)
+			;
+		for (m = i, offset = 0, k = OFLOWSIZE; m < j; m++)
+		{
+			if (items[m].dup)
+				continue;
+			if (k == OFLOWSIZE) // hook a new page onto the chain
+			{
+				next = allocPage(db);
+				if (offset)
+				{
+					page.next = next;
+					storeBlock(db, offset, sizeof(OFLOWPAGE), &page);
+				}
+				else
+					storeBlock(db, items[i].link, sizeof(long), &next);
+				memset(&page, 0, sizeof page);
+				offset = next;
+				k = 0;
+			}
+			packSlot(&recs[items[m].index], &page.ctrl[k], &page.key[k], &page.data[k]);
+			items[m].oflow = 1;
+			k++;
+		}
+		if (offset)
+			storeBlock(db, offset, sizeof(OFLOWPAGE), &page);
+	}
+
+	for (i = 0, count = 0; i < n; i++)
+	{
+		item = &items[i];
+		if (added)
+			added[item->index] = !item->dup;
+		if (item->dup)
+		{
+			if (!db->quiet)
+				printf("Duplicate ID detected! Unable to insert %s.\n", recs[item->index].name);
+			continue;
+		}
+		presenceSet(db, recs[item->index].id);
+		setQty(db, recs[item->index].id, recs[item->index].qty);
+		nameIndexChange(db, &recs[item->index], 1);
+		db->tombstones -= item->dead;
+		if (item->oflow)
+		{
+			db->oflowRecords++;
+			db->stats[OP_PUT].oflow++;
+		}
+		count++;
+	}
+	db->nrecords += count;
+	free(items);
+	walOpEnd(db);
+	return count;
+}
+
+/****************************MULTIDELETE****************************
+Deletes a batch of IDs, given in recs[i].id, as deleteRecord()
+would one at a time, but the buckets and chains of the whole
+batch are searched together (see multiProbe()) and the tombstones
+are written in file order. Each record deleted is copied to
+recs[i], and offsets[i] is set as by multiGet(); an ID given twice
+is deleted once. Runs one compaction step for the batch. Not for
+a shared table. Returns the number of records deleted.
+*/
+long multiDelete(HASHDB *db, RECORD *recs, long n, long *offsets)
+{
+	unsigned char ctrl = CTRL_TOMBSTONE;
+	PACKEDKEY tombstone = KEY_TOMBSTONE;
+	BATCHITEM *items, *item;
+	long count = 0, last = -1, i;
+
+	if (n <= 0)
+		return 0;
+	items = batchItems(db, recs, n, OP_DEL);
+	multiProbe(db, items, n, recs, OP_DEL);
+	qsort(items, n, sizeof(BATCHITEM), compareBatchSlots);
+	for (i = 0; i < n; i++)
+	{
+		item = &items[i];
+		if (item->at.key >= 0 && item->at.key == last) // deleted already
+			item->at.key = -1;
+		else
+			last = item->at.key;
+		offsets[item->index] = item->at.key;
+		if (item->at.key < 0)
+			continue;
+		storeBlock(db, item->at.ctrl, 1, &ctrl);
+		storeBlock(db, item->at.key, sizeof(PACKEDKEY), &tombstone);
+		presenceClear(db, recs[item->index].id);
+		setQty(db, recs[item->index].id, 0);
+		nameIndexChange(db, &recs[item->index], 0);
+		db->oflowRecords -= item->oflow;
+		count++;
+	}
+	db->nrecords -= count;
+	db->tombstones += count;
+	free(items);
+	walOpEnd(db);
+	if (db->tombstones * COMPACT_DENSITY > db->nbuckets)
+		compactStep(db, db->compactMicros);
+	return count;
+}
+
+/****************************BATCHITEMS****************************
+Returns the search state of a batch of IDs, given in recs[i].id,
+each starting at its bucket. IDs the presence bitmap rules out are
+done at once: for a get or delete they are missing, and for a put
+they are duplicates (exact bitmap only). Counts the operations.
+*/
+BATCHITEM *batchItems(HASHDB *db, const RECORD *recs, long n, int op)
+{
+	BATCHITEM *items = (BATCHITEM *)malloc(n * sizeof(BATCHITEM));
+	OPSTATS *stats = &db->stats[op];
+	int known = op == OP_PUT && db->presence && db->presenceExact;
+	long i;
+
+	if (!items)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	memset(items, 0, n * sizeof(BATCHITEM));
+	for (i = 0; i < n; i++)
+	{
+		items[i].index = i;
+		items[i].key = packID(recs[i].id);
+		items[i].searched = known;
+		items[i].at.ctrl = items[i].at.key = items[i].at.data = -1;
+		stats->ops++;
+		if (op == OP_PUT ? known && presenceTest(db, recs[i].id) : !presenceTest(db, recs[i].id))
+		{
+			stats->filtered++;
+			items[i].dup = op == OP_PUT;
+		}
+		else if (op != OP_PUT) // multiPut() grows the table before it finds the buckets
+			items[i].block = bucketOffset(db, bucketAddress(db, (char *)recs[i].id));
+	}
+	return items;
+}
+
+/****************************MULTIPROBE****************************
+Searches for a batch of IDs together, a chain level at a time:
+first every ID's bucket, then the first overflow page of every
+chain still being searched, and so on. Each level is sorted by
+file offset, a block wanted by several IDs is read once, and
+blocks at most MULTI_GAP apart are read together, up to MULTI_SPAN
+bytes at a time, so each level is one pass over the file in order.
+The blocks are searched by multiBlock(). For a put, an ID that
+comes again later in the batch is a duplicate. Reorders items[].
+*/
+void multiProbe(HASHDB *db, BATCHITEM *items, long n, RECORD *recs, int op)
+{
+	union { BUCKET home; OFLOWPAGE page; } one; // a run of one block is read here
+	char *buf = NULL, *run;
+	BATCHITEM swap;
+	size_t size;
+	long live, span, first, i, j, k, m;
+	int level;
+
+	for (level = 0, live = n; ; level++)
+	{
+		// the IDs still searching go to the front, and only they are sorted
+		for (i = 0, j = 0; i < live; i++)
+			if (items[i].block)
+			{
+				swap = items[j];
+				items[j++] = items[i];
+				items[i] = swap;
+			}
+		if ((live = j) == 0)
+			break;
+		qsort(items, live, sizeof(BATCHITEM), compareBatchBlocks);
+		if (level == 0 && op == OP_PUT) // the same ID sorts into the same bucket, first in batch order first
+			for (i = 1; i < live; i++)
+				items[i].dup |= items[i].key == items[i - 1].key && items[i].block == items[i - 1].block;
+
+		size = level ? sizeof(OFLOWPAGE) : sizeof(BUCKET);
+		for (i = 0; i < live; i = j)
+		{
+			first = items[i].block;
+			for (j = i + 1; j < live && items[j].block + (long)size - first <= MULTI_SPAN &&
+				items[j].block - items[j - 1].block - (long)size <= MULTI_GAP; j++)
+				;
+			span = items[j - 1].block + size - first;
+			if (span > (long)sizeof one && !buf && !(buf = (char *)malloc(MULTI_SPAN)))
+			{
+				printf("Out of memory! Abort!\n");
+				exit(204);
+			}
+			run = (char *)fetchBlock(db, first, span, span > (long)sizeof one ? buf : (char *)&one);
+			for (k = i; k < j; k = m)
+			{
+				for (m = k; m < j && items[m].block == items[k].block; m++)
+					;
+				multiBlock(db, items + k, m - k, run + (items[k].block - first), level, recs, op);
+			}
+		}
+	}
+	free(buf);
+}
+
+/****************************MULTIBLOCK****************************
+Searches one block read by multiProbe() for the n IDs whose chains
+are at it; level 0 is a bucket, and level l the l-th page of a
+chain. A get or delete that finds its ID copies the record to
+recs[] and is done, and one that reaches a slot never used is done
+too. A put stops at a duplicate, and otherwise takes the block's
+first free slot left by the IDs before it. It goes on down the
+chain while it has no slot, or until the search for a duplicate
+is over, as in insert().
+*/
+void multiBlock(HASHDB *db, BATCHITEM *items, long n, const char *block, int level, RECORD *recs, int op)
+{
+	const BUCKET *home = (const BUCKET *)block;
+	const OFLOWPAGE *page = (const OFLOWPAGE *)block;
+	const unsigned char *ctrl = level ? page->ctrl : home->ctrl;
+	const PACKEDKEY *keys = level ? page->key : home->key;
+	const PAYLOAD *data = level ? page->data : home->data;
+	int size = level ? OFLOWSIZE : BUCKETSIZE, i, end;
+	long offset = items[0].block, next = level ? page->next : home->next, k;
+	unsigned int open = 0;
+	BATCHITEM *item;
+	OPSTATS *stats = &db->stats[op];
+
+	if (op == OP_PUT)
+		open = ctrlMatch(ctrl, size, CTRL_EMPTY) | ctrlMatch(ctrl, size, CTRL_TOMBSTONE);
+	for (k = 0; k < n; k++)
+	{
+		item = &items[k];
+		if (item->dup) // a duplicate within the batch
+		{
+			item->block = 0;
+			continue;
+		}
+		stats->probes++;
+		end = 0;
+		if (!item->searched && (i = probeBlock(ctrl, keys, size, item->key, &end)) >= 0) // found it!
+		{
+			if (op == OP_PUT) // do not insert duplicate IDs!
+				item->dup = 1;
+			else
+			{
+				unpackSlot(item->key, &data[i], &recs[item->index]);
+				slotAddr(offset, level > 0, i, &item->at);
+				item->oflow = level > 0;
+				stats->oflow += level > 0;
+			}
+			item->block = 0;
+			continue;
+		}
+		item->link = offset + (level ? (long)offsetof(OFLOWPAGE, next) : (long)offsetof(BUCKET, next));
+		if (op != OP_PUT)
+		{
+			item->block = end ? 0 : next;
+			continue;
+		}
+		if (item->at.key < 0 && open)
+		{
+			i = lowestBit(open);
+			open &= open - 1;
+			slotAddr(offset, level > 0, i, &item->at);
+			item->dead = ctrl[i] == CTRL_TOMBSTONE;
+			item->oflow = level > 0;
+		}
+		item->searched |= end;
+		item->block = !item->searched || item->at.key < 0 ? next : 0;
+	}
+}
+
+/****************************COMPAREBATCHBLOCKS****************************
+Orders batch items by the block to search next, then by ID and by
+position in the batch.
+*/
+int compareBatchBlocks(const void *a, const void *b)
+{
+	const BATCHITEM *x = (const BATCHITEM *)a, *y = (const BATCHITEM *)b;
+
+	if (x->block != y->block)
+		return x->block < y->block ? -1 : 1;
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+/****************************COMPAREBATCHSLOTS****************************
+Orders batch items by the slot found or taken, in file order, then
+those without one by the chain they end, then by position in the
+batch.
+*/
+int compareBatchSlots(const void *a, const void *b)
+{
+	const BATCHITEM *x = (const BATCHITEM *)a, *y = (const BATCHITEM *)b;
+	unsigned long xs = (unsigned long)x->at.key, ys = (unsigned long)y->at.key; // -1 wraps to the end
+
+	if (xs != ys)
+		return xs < ys ? -1 : 1;
+	if (x->link != y->link)
+		return x->link < y->link ? -1 : 1;
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+/****************************OPENAIO****************************
+Opens a queue of asynchronous lookups and inserts on a table, with
+up to depth of them in flight at once. aioGet() and aioPut() queue
+a request, and aioPoll() and aioDrain() run the completions, each
+of which calls the request's done function. Each block a request
+needs is read as the aligned AIO_BLOCK pages that hold it through
+io_uring, so many reads are with the disk at once. The reads queued
+between two polls go in one system call. With AIO_DIRECT in flags,
+the reads of lookups bypass the page cache (O_DIRECT) where the
+file system allows it. Without io_uring (another OS, an old
+kernel, a sandbox that forbids it) or with AIO_SYNC, every request
+runs at once through findRecord() or insert(), except that AIO_SYNC
+with AIO_DIRECT reads the same pages as the io_uring queue, through
+the same descriptors, one pread at a time. While requests are in
+flight, the table may only be changed through the queue.
+*/
+AIOQUEUE *openAio(HASHDB *db, int depth, int flags)
+{
+	AIOQUEUE *q = (AIOQUEUE *)calloc(1, sizeof(AIOQUEUE));
+	int i;
+#ifdef HAVE_IO_URING
+	struct io_uring_params params;
+#endif
+
+	if (!q)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	q->db = db;
+	q->depth = depth > 0 ? depth : AIO_DEPTH;
+	q->fd = q->putFd = q->ring = -1;
+#ifdef HAVE_IO_URING
+	memset(&params, 0, sizeof params);
+	if (!(flags & AIO_SYNC))
+		q->ring = (int)syscall(__NR_io_uring_setup, q->depth, &params);
+	if (q->ring >= 0)
+	{
+		q->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		q->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP) // one mapping holds both rings
+			q->sqSize = q->cqSize = q->sqSize > q->cqSize ? q->sqSize : q->cqSize;
+		q->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		q->sqRing = mmap(NULL, q->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->ring, IORING_OFF_SQ_RING);
+		q->cqRing = params.features & IORING_FEAT_SINGLE_MMAP ? q->sqRing :
+			mmap(NULL, q->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, q->ring, IORING_OFF_CQ_RING);
+		q->sqes = (struct io_uring_sqe *)mmap(NULL, q->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			q->ring, IORING_OFF_SQES);
+		if (q->sqRing == MAP_FAILED || q->cqRing == MAP_FAILED || (void *)q->sqes == MAP_FAILED)
+		{
+			printf("Could not map the io_uring queues! Abort!\n");
+			exit(205);
+		}
+		q->sqTail = (unsigned *)((char *)q->sqRing + params.sq_off.tail);
+		q->sqMask = (unsigned *)((char *)q->sqRing + params.sq_off.ring_mask);
+		q->sqArray = (unsigned *)((char *)q->sqRing + params.sq_off.array);
+		q->cqHead = (unsigned *)((char *)q->cqRing + params.cq_off.head);
+		q->cqTail = (unsigned *)((char *)q->cqRing + params.cq_off.tail);
+		q->cqMask = (unsigned *)((char *)q->cqRing + params.cq_off.ring_mask);
+		q->cqes = (struct io_uring_cqe *)((char *)q->cqRing + params.cq_off.cqes);
+	}
+	if (q->ring >= 0 || (flags & AIO_SYNC && flags & AIO_DIRECT))
+	{
+		// new descriptors for the reads, so O_DIRECT leaves the table's own alone; inserts
+		// dirty the pages they read, and an O_DIRECT read of such a page waits for it to be written
+		if ((q->putFd = open(db->filename, O_RDONLY)) < 0)
+		{
+			printf("Unable to open %s! Abort!\n", db->filename);
+			exit(208);
+		}
+		if (flags & AIO_DIRECT)
+			q->direct = (q->fd = open(db->filename, O_RDONLY | O_DIRECT)) >= 0;
+		if (!q->direct)
+			q->fd = q->putFd;
+	}
+#endif
+	q->reqs = (AIOREQ *)calloc(q->depth, sizeof(AIOREQ));
+	q->freeReqs = (int *)malloc(q->depth * sizeof(int));
+#ifdef HAVE_MMAP
+	if (posix_memalign((void **)&q->bufs, AIO_BLOCK, (size_t)q->depth * 2 * AIO_BLOCK) != 0)
+		q->bufs = NULL;
+#else
+	q->bufs = (char *)malloc((size_t)q->depth * 2 * AIO_BLOCK); // no O_DIRECT here, so no alignment needed
+#endif
+	if (!q->reqs || !q->freeReqs || !q->bufs)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	for (i = 0; i < q->depth; i++)
+	{
+		q->reqs[i].buf = q->bufs + (long)i * 2 * AIO_BLOCK;
+		q->freeReqs[q->nfree++] = q->depth - 1 - i;
+	}
+	return q;
+}
+
+/****************************CLOSEAIO****************************
+Finishes every request still queued and closes the queue.
+*/
+void closeAio(AIOQUEUE *q)
+{
+	aioDrain(q);
+#ifdef HAVE_IO_URING
+	if (q->ring >= 0)
+	{
+		if (q->cqRing != q->sqRing)
+			munmap(q->cqRing, q->cqSize);
+		munmap(q->sqRing, q->sqSize);
+		munmap(q->sqes, q->sqesSize);
+		close(q->ring);
+	}
+	if (q->putFd >= 0)
+	{
+		if (q->fd != q->putFd)
+			close(q->fd);
+		close(q->putFd);
+	}
+#endif
+	free(q->reqs);
+	free(q->freeReqs);
+	free(q->bufs);
+	free(q);
+}
+
+/****************************AIOGET****************************
+Queues a lookup of an ID. When it completes, done is called with
+1 and the record, or with 0 and a record holding only the ID if it
+is not in the table. Waits for a request to finish first if depth
+requests are in flight already. Counted as a lookup.
+*/
+void aioGet(AIOQUEUE *q, const char *id, void (*done)(int found, const RECORD *rec, void *arg), void *arg)
+{
+	RECORD rec;
+	int slot;
+
+	memset(&rec, 0, sizeof rec);
+	strncpy(rec.id, id, ID_SIZE);
+	if (q->ring < 0 && q->fd < 0) // no io_uring: look it up now
+	{
+		done(findRecord(q->db, rec.id, &rec, &slot) >= 0, &rec, arg);
+		return;
+	}
+	aioStart(q, aioRequest(q, OP_GET, &rec, done, arg));
+}
+
+/****************************AIOPUT****************************
+Queues an insert of a record. When it completes, done is called
+with 1 if the record was added, or 0 for a duplicate ID, as by
+insert(). Waits for a request to finish first if depth requests
+are in flight already.
+*/
+void aioPut(AIOQUEUE *q, const RECORD *rec, void (*done)(int added, const RECORD *rec, void *arg), void *arg)
+{
+	if (q->ring < 0 && q->fd < 0) // no io_uring: insert it now
+	{
+		done(insert(rec, q->db), rec, arg);
+		return;
+	}
+	aioStart(q, aioRequest(q, OP_PUT, rec, done, arg));
+}
+
+/****************************AIOREQUEST****************************
+Takes a free request, running completions until there is one.
+*/
+AIOREQ *aioRequest(AIOQUEUE *q, int op, const RECORD *rec, void (*done)(int ok, const RECORD *rec, void *arg), void *arg)
+{
+	AIOREQ *req;
+
+	while (q->nfree == 0)
+		aioPoll(q, 1);
+	req = &q->reqs[q->freeReqs[--q->nfree]];
+	req->op = op;
+	req->rec = *rec;
+	req->key = packID(rec->id);
+	req->done = done;
+	req->arg = arg;
+	q->db->stats[op].ops++;
+	return req;
+}
+
+/****************************AIOSTART****************************
+Starts, or starts again, the search for a request at its bucket.
+IDs the presence bitmap settles are finished without a read.
+*/
+void aioStart(AIOQUEUE *q, AIOREQ *req)
+{
+	HASHDB *db = q->db;
+	int known = db->presence && db->presenceExact;
+
+	if (req->op == OP_GET ? !presenceTest(db, req->rec.id) : known && presenceTest(db, req->rec.id))
+	{
+		db->stats[req->op].filtered++;
+		if (req->op == OP_PUT && !db->quiet)
+			printf("Duplicate ID detected! Unable to insert %s.\n", req->rec.name);
+		aioFinish(q, req, 0);
+		return;
+	}
+	req->address = bucketAddress(db, req->rec.id);
+	req->block = bucketOffset(db, req->address);
+	req->level = 0;
+	req->layout = db->splits + db->compactions - q->splits;
+	req->seq = q->changes;
+	req->searched = req->op == OP_PUT && known;
+	req->freeSlot = -1;
+	req->freeDead = 0;
+	req->at.ctrl = req->at.key = req->at.data = -1;
+	aioRead(q, req);
+}
+
+/****************************AIOREAD****************************
+Queues the read of the aligned AIO_BLOCK pages holding the block
+at req->block: one page, or two for a block wider IDs have pushed
+across a page boundary. Without a ring (AIO_SYNC with AIO_DIRECT)
+the pages are read at once and the request goes on with aioStep().
+*/
+void aioRead(AIOQUEUE *q, AIOREQ *req)
+{
+#ifdef HAVE_IO_URING
+	unsigned tail, index;
+	struct io_uring_sqe *sqe;
+	long size = req->level ? PAGE_BYTES : BUCKET_BYTES;
+	int fd = req->op == OP_PUT ? q->putFd : q->fd;
+	long offset = req->block / AIO_BLOCK * AIO_BLOCK;
+	size_t len = (size_t)alignOffset(req->block % AIO_BLOCK + size, AIO_BLOCK);
+
+	if (q->ring < 0)
+	{
+		if (q->db->backend == BACKEND_STDIO) // the read goes around the pool and stdio's buffer
+		{
+			if (q->db->frames)
+				flushPool(q->db);
+			fflush(q->db->fp);
+		}
+		if (pread(fd, req->buf, len, offset) < (ssize_t)(req->block % AIO_BLOCK + (req->level ? sizeof(OFLOWPAGE) : sizeof(BUCKET))))
+		{
+			printf("Fatal read error! Abort!\n");
+			exit(304);
+		}
+		q->db->nreads++;
+		aioStep(q, req);
+		return;
+	}
+	tail = *q->sqTail;
+	index = tail & *q->sqMask;
+	sqe = &q->sqes[index];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = (unsigned long)req->buf;
+	sqe->len = (unsigned)len;
+	sqe->user_data = (unsigned long)(req - q->reqs);
+	q->sqArray[index] = index;
+	__atomic_store_n(q->sqTail, tail + 1, __ATOMIC_RELEASE);
+	q->pending++;
+	q->db->nreads++;
+#endif
+}
+
+/****************************AIOPOLL****************************
+Submits the reads queued since the last call in one system call,
+then runs the completions that have arrived, waiting for at least
+one if wait is set and anything is in flight. A completed read
+either finishes its request, calling its done function, or queues
+the read of the next page of its chain. Returns the number of
+requests finished.
+*/
+int aioPoll(AIOQUEUE *q, int wait)
+{
+	int finished = 0;
+#ifdef HAVE_IO_URING
+	HASHDB *db = q->db;
+	unsigned head, flags;
+	int done, submit;
+	struct io_uring_cqe *cqe;
+	AIOREQ *req;
+
+	if (q->ring < 0)
+		return 0;
+	if (q->pending > 0 && db->backend == BACKEND_STDIO) // the reads go around the pool and stdio's buffer
+	{
+		if (db->frames)
+			flushPool(db);
+		fflush(db->fp);
+	}
+	wait = wait && q->pending + q->inflight > 0;
+	if (q->pending > 0 || wait)
+	{
+		flags = wait ? IORING_ENTER_GETEVENTS : 0;
+		do
+			submit = (int)syscall(__NR_io_uring_enter, q->ring, q->pending, wait ? 1 : 0, flags, NULL, 0);
+		while (submit < 0 && errno == EINTR);
+		if (submit < 0)
+		{
+			printf("Fatal read error! Abort!\n");
+			exit(304);
+		}
+		q->enters++;
+		q->pending -= submit;
+		q->inflight += submit;
+	}
+
+	head = *q->cqHead;
+	while (head != __atomic_load_n(q->cqTail, __ATOMIC_ACQUIRE))
+	{
+		cqe = &q->cqes[head & *q->cqMask];
+		req = &q->reqs[cqe->user_data];
+		done = cqe->res;
+		__atomic_store_n(q->cqHead, ++head, __ATOMIC_RELEASE);
+		q->inflight--;
+		if (done < (int)(req->block % AIO_BLOCK + (req->level ? sizeof(OFLOWPAGE) : sizeof(BUCKET))))
+		{
+			printf("Fatal read error! Abort!\n");
+			exit(304);
+		}
+		finished += aioStep(q, req);
+	}
+#endif
+	return finished;
+}
+
+/****************************AIODRAIN****************************
+Runs completions until no request is left in flight.
+*/
+void aioDrain(AIOQUEUE *q)
+{
+	while (q->nfree < q->depth)
+		aioPoll(q, 1);
+}
+
+/****************************AIOSTEP****************************
+Searches the block a request has just read, as probeRecord() and
+insert() would. A get finishes once it finds its ID or reaches a
+block with a slot never used. A put finishes at a duplicate, and
+otherwise goes on down the chain as insert() does, then writes the
+record with placeRecord(). A request starts again if a put or a
+split from the queue has changed its bucket since it started, or if
+the table was split or compacted around the queue. Returns 1 if the
+request finished.
+*/
+int aioStep(AIOQUEUE *q, AIOREQ *req)
+{
+	HASHDB *db = q->db;
+	const char *block = req->buf + req->block % AIO_BLOCK;
+	const BUCKET *home = (const BUCKET *)block;
+	const OFLOWPAGE *page = (const OFLOWPAGE *)block;
+	const unsigned char *ctrl = req->level ? page->ctrl : home->ctrl;
+	const PACKEDKEY *keys = req->level ? page->key : home->key;
+	int size = req->level ? OFLOWSIZE : BUCKETSIZE, known = db->presence && db->presenceExact, i, end = 0;
+	long next = req->level ? page->next : home->next, split = db->split, splits = db->splits;
+	unsigned int open;
+	OPSTATS *stats = &db->stats[req->op];
+
+	if (db->splits + db->compactions - q->splits != req->layout || q->conflicts[req->address % AIO_CONFLICTS] > req->seq)
+	{
+		aioStart(q, req);
+		return 0;
+	}
+	stats->probes++;
+	if (!req->searched && (i = probeBlock(ctrl, keys, size, req->key, &end)) >= 0) // found it!
+	{
+		if (req->op == OP_GET)
+		{
+			unpackSlot(req->key, req->level ? &page->data[i] : &home->data[i], &req->rec);
+			stats->oflow += req->level > 0;
+		}
+		else if (!db->quiet) // do not insert duplicate IDs!
+			printf("Duplicate ID detected! Unable to insert %s.\n", req->rec.name);
+		aioFinish(q, req, req->op == OP_GET);
+		return 1;
+	}
+	if (req->op == OP_GET)
+	{
+		if (end || !next)
+		{
+			aioFinish(q, req, 0);
+			return 1;
+		}
+	}
+	else
+	{
+		open = ctrlMatch(ctrl, size, CTRL_EMPTY) | ctrlMatch(ctrl, size, CTRL_TOMBSTONE);
+		if (req->at.key < 0 && open)
+		{
+			i = lowestBit(open);
+			slotAddr(req->block, req->level > 0, i, &req->at);
+			req->freeSlot = req->level ? (req->level - 1) * OFLOWSIZE + i : -1;
+			req->freeDead = ctrl[i] == CTRL_TOMBSTONE;
+			end |= known;
+		}
+		req->searched |= end;
+		req->link = req->block + (req->level ? (long)offsetof(OFLOWPAGE, next) : (long)offsetof(BUCKET, next));
+		if ((req->searched && req->at.key >= 0) || !next)
+		{
+			placeRecord(db, &req->rec, req->address, &req->at, req->link, req->level, req->freeSlot, req->freeDead);
+			q->conflicts[req->address % AIO_CONFLICTS] = ++q->changes;
+			if (db->splits != splits) // the split rewrote one bucket's chain
+			{
+				q->conflicts[split % AIO_CONFLICTS] = q->changes;
+				q->splits++;
+			}
+			aioFinish(q, req, 1);
+			return 1;
+		}
+	}
+	req->block = next;
+	req->level++;
+	aioRead(q, req);
+	return 0;
+}
+
+/****************************AIOFINISH****************************
+Calls a request's done function and frees the request.
+*/
+void aioFinish(AIOQUEUE *q, AIOREQ *req, int ok)
+{
+	req->done(ok, &req->rec, req->arg);
+	q->freeReqs[q->nfree++] = (int)(req - q->reqs);
+}
+
+/****************************COMPACTBUCKET****************************
+Rewrites a bucket and its chain without gaps if it holds any
+tombstones, or if records in its chain could move into free slots
+of the bucket itself. Overflow pages left empty go back on the
+free list. Returns the number of tombstones reclaimed, or -1 if
+the bucket was left alone.
+*/
+long compactBucket(HASHDB *db, long bucket)
+{
+	BUCKET home;
+	OFLOWPAGE page;
+	RECORD *live;
+	long next, *pages, dead = 0;
+	int nlive = 0, homeLive = 0, npages = 0, chainLive = 0, k;
+
+	readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+	for (k = 0; k < BUCKETSIZE; k++)
+	{
+		homeLive += KEY_LIVE(home.key[k]);
+		dead += home.key[k] == KEY_TOMBSTONE;
+	}
+	for (next = home.next; next; next = page.next, npages++)
+	{
+		readBlock(db, next, sizeof(OFLOWPAGE), &page);
+		for (k = 0; k < OFLOWSIZE; k++)
+		{
+			chainLive += KEY_LIVE(page.key[k]);
+			dead += page.key[k] == KEY_TOMBSTONE;
+		}
+	}
+	if (dead == 0 && (chainLive == 0 || homeLive == BUCKETSIZE)) // already packed
+		return -1;
+
+	reserveScratch(db, BUCKETSIZE + npages * OFLOWSIZE, npages + 1);
+	pages = db->scratchPages;
+	live = db->scratch;
+	for (k = 0; k < BUCKETSIZE; k++)
+		if (KEY_LIVE(home.key[k]))
+			unpackSlot(home.key[k], &home.data[k], &live[nlive++]);
+	for (next = home.next, npages = 0; next; next = page.next)
+	{
+		pages[npages++] = next;
+		readBlock(db, next, sizeof(OFLOWPAGE), &page);
+		for (k = 0; k < OFLOWSIZE; k++)
+			if (KEY_LIVE(page.key[k]))
+				unpackSlot(page.key[k], &page.data[k], &live[nlive++]);
+	}
+	db->oflowRecords -= chainLive;
+	fillBucket(db, bucket, live, nlive, pages, &npages);
+	while (npages > 0)
+		freePage(db, pages[--npages]);
+	db->tombstones -= dead;
+	db->compactions++;
+	walOpEnd(db);
+	return dead;
+}
+
+/****************************COMPACTSTEP****************************
+Runs the online compaction pass for about budgetMicros: buckets
+are compacted in order from where the last step stopped, at
+least one per step. The pass only runs while there are
+tombstones; a full sweep that finds none resets the count.
+*/
+void compactStep(HASHDB *db, long budgetMicros)
+{
+	double start = clockMicros();
+
+	if (budgetMicros <= 0)
+		return;
+	while (db->tombstones > 0)
+	{
+		if (db->compactCursor >= db->nbuckets)
+			db->compactCursor = 0;
+		if (compactBucket(db, db->compactCursor++) > 0)
+			db->compactClean = 0;
+		else if (++db->compactClean >= db->nbuckets) // counted tombstones that are gone
+		{
+			db->tombstones = 0;
+			db->compactClean = 0;
+		}
+		if (clockMicros() - start >= budgetMicros)
+			break;
+	}
+}
+
+/****************************COMPARELOADITEMS****************************
+Orders bulk load items by bucket, then ID, then input line, so
+each bucket's records are together and duplicates sit side by
+side with the first occurrence leading.
+*/
+int compareLoadItems(const void *a, const void *b)
+{
+	const LOADITEM *x = (const LOADITEM *)a, *y = (const LOADITEM *)b;
+	int cmp;
+
+	if (x->bucket != y->bucket)
+		return x->bucket < y->bucket ? -1 : 1;
+	if ((cmp = strcmp(x->rec.id, y->rec.id)) != 0)
+		return cmp;
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+/****************************BUILDTABLE****************************
+Writes sorted, duplicate-free items into an empty table. Buckets
+and overflow pages are built in memory, each at its on-disk stride,
+and written out in file order: each bucket group once, then all
+overflow pages at the end.
+*/
+void buildTable(HASHDB *db, LOADITEM *items, long n)
+{
+	char *table = (char *)calloc(db->nbuckets, BUCKET_BYTES), *pages;
+	BUCKET *home;
+	OFLOWPAGE *page;
+	long npages = 0, i, j, b, first, size, pageStart = alignOffset(db->fileEnd, PAGE_BYTES);
+	int group, k;
+
+	if (!table)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	// count the overflow pages each bucket needs
+	for (i = 0; i < n; i = j)
+	{
+		for (j = i; j < n && items[j].bucket == items[i].bucket; j++)
+			;
+		if (j - i > BUCKETSIZE)
+			npages += (j - i - BUCKETSIZE + OFLOWSIZE - 1) / OFLOWSIZE;
+	}
+	pages = (char *)calloc(npages + 1, PAGE_BYTES);
+	if (!pages)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+
+	// fill buckets, spilling into consecutive pages
+	for (i = 0, npages = 0; i < n; i = j)
+	{
+		b = items[i].bucket;
+		for (j = i; j < n && items[j].bucket == b; j++)
+		{
+			presenceSet(db, items[j].rec.id);
+			setQty(db, items[j].rec.id, items[j].rec.qty);
+			nameIndexChange(db, &items[j].rec, 1);
+		}
+		home = (BUCKET *)(table + b * BUCKET_BYTES);
+		for (j = i, k = 0; j < n && items[j].bucket == b && k < BUCKETSIZE; j++, k++)
+			packSlot(&items[j].rec, &home->ctrl[k], &home->key[k], &home->data[k]);
+		if (j < n && items[j].bucket == b)
+			home->next = pageStart + npages * PAGE_BYTES;
+		while (j < n && items[j].bucket == b)
+		{
+			page = (OFLOWPAGE *)(pages + npages * PAGE_BYTES);
+			for (k = 0; j < n && items[j].bucket == b && k < OFLOWSIZE; j++, k++)
+			{
+				packSlot(&items[j].rec, &page->ctrl[k], &page->key[k], &page->data[k]);
+				db->oflowRecords++;
+			}
+			if (j < n && items[j].bucket == b)
+				page->next = pageStart + (npages + 1) * PAGE_BYTES;
+			npages++;
+		}
+	}
+
+	// one write per bucket group, then one for the overflow pages
+	for (group = 0, first = 0, size = TABSIZE; first < db->nbuckets; group++)
+	{
+		storeBlock(db, db->groupStart[group],
+			(first + size < db->nbuckets ? size : db->nbuckets - first) * BUCKET_BYTES, table + first * BUCKET_BYTES);
+		first += size;
+		size = first;
+	}
+	if (npages > 0)
+	{
+		growFile(db, pageStart + npages * PAGE_BYTES);
+		storeBlock(db, pageStart, npages * PAGE_BYTES, pages);
+		db->npages += npages;
+	}
+	free(table);
+	free(pages);
+}
+
+/****************************MERGEBUCKET****************************
+Adds n sorted, duplicate-free items to a bucket that may already
+hold records: the bucket and its chain are read once, IDs already
+present are rejected, and the merged set is written back once.
+Returns the number of items added.
+*/
+long mergeBucket(HASHDB *db, long bucket, LOADITEM *items, long n)
+{
+	BUCKET home;
+	OFLOWPAGE page;
+	RECORD *merged;
+	long next, *pages, added = 0, i;
+	int nmerged = 0, npages = 0, k;
+
+	readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+	for (next = home.next; next; next = page.next, npages++)
+		readBlock(db, next, sizeof(OFLOWPAGE), &page);
+	reserveScratch(db, BUCKETSIZE + npages * OFLOWSIZE + n, npages + 1);
+	pages = db->scratchPages;
+	merged = db->scratch;
+
+	for (k = 0; k < BUCKETSIZE; k++)
+	{
+		db->tombstones -= home.key[k] == KEY_TOMBSTONE; // rewriting the bucket reclaims them
+		if (KEY_LIVE(home.key[k]))
+			unpackSlot(home.key[k], &home.data[k], &merged[nmerged++]);
+	}
+	for (next = home.next, npages = 0; next; next = page.next)
+	{
+		pages[npages++] = next;
+		readBlock(db, next, sizeof(OFLOWPAGE), &page);
+		for (k = 0; k < OFLOWSIZE; k++)
+		{
+			db->tombstones -= page.key[k] == KEY_TOMBSTONE;
+			if (KEY_LIVE(page.key[k]))
+			{
+				unpackSlot(page.key[k], &page.data[k], &merged[nmerged++]);
+				db->oflowRecords--;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		for (k = 0; k < nmerged && strcmp(merged[k].id, items[i].rec.id) != 0; k++)
+			;
+		if (k < nmerged) // do not insert duplicate IDs!
+			printf("Duplicate ID detected! Unable to insert %s.\n", items[i].rec.name);
+		else
+		{
+			merged[nmerged++] = items[i].rec;
+			presenceSet(db, items[i].rec.id);
+			setQty(db, items[i].rec.id, items[i].rec.qty);
+			nameIndexChange(db, &items[i].rec, 1);
+			added++;
+		}
+	}
+
+	fillBucket(db, bucket, merged, nmerged, pages, &npages);
+	while (npages > 0)
+		freePage(db, pages[--npages]);
+	return added;
+}
+
+/****************************ADDLOADITEM****************************
+Appends a parsed record to a bulk load list, growing it as needed.
+*/
+void addLoadItem(LOADLIST *list, const RECORD *rec)
+{
+	LOADITEM *grown;
+
+	if (list->n == list->capacity)
+	{
+		list->capacity = list->capacity ? 2 * list->capacity : 1024;
+		grown = (LOADITEM *)realloc(list->items, list->capacity * sizeof(LOADITEM));
+		if (!grown)
+		{
+			printf("Out of memory! Abort!\n");
+			exit(204);
+		}
+		list->items = grown;
+	}
+	list->items[list->n].rec = *rec;
+	list->items[list->n].line = list->n;
+	list->n++;
+}
+
+/****************************BULKLOAD****************************
+Loads a whole input file at once instead of record by record.
+Every line is parsed first, then loadList() adds them together.
+Returns the records added.
+*/
+long bulkLoad(HASHDB *db, FILE *inFile)
+{
+	LOADLIST list = { NULL, 0, 0 };
+	RECORD newRecord;
+	char line[100];
+
+	while (fgets(line, 100, inFile))
+	{
+		if (parseLine(line, &newRecord) == PARSE_OK)
+			addLoadItem(&list, &newRecord);
+	}
+	return loadList(db, &list);
+}
+
+/****************************LOADLIST****************************
+Adds a list of parsed records to the table. The table is grown to
+its final size, and the records are sorted by bucket so that each
+bucket and overflow chain is written exactly once, in file order.
+Duplicates are found in memory. Frees the list and returns the
+records added.
+*/
+long loadList(HASHDB *db, LOADLIST *list)
+{
+	LOADITEM *items = list->items;
+	long n = list->n, added = 0, i, j;
+
+	// grow the table once for everything; an empty table has nothing to move
+	while (db->nrecords + n > LOAD_FACTOR * db->nbuckets * BUCKETSIZE)
+	{
+		if (db->nrecords > 0)
+			splitBucket(db);
+		else
+			addBucket(db);
+	}
+	for (i = 0; i < n; i++)
+		items[i].bucket = bucketAddress(db, items[i].rec.id);
+	qsort(items, n, sizeof(LOADITEM), compareLoadItems);
+
+	// drop duplicates within the input, keeping the first line
+	for (i = 0, j = 0; i < n; i++)
+	{
+		if (j > 0 && strcmp(items[j - 1].rec.id, items[i].rec.id) == 0)
+			printf("Duplicate ID detected! Unable to insert %s.\n", items[i].rec.name);
+		else
+			items[j++] = items[i];
+	}
+	n = j;
+
+	if (db->nrecords == 0 && db->npages == 0)
+	{
+		buildTable(db, items, n);
+		db->tombstones = 0; // every bucket was rewritten
+		added = n;
+	}
+	else
+	{
+		for (i = 0; i < n; i = j)
+		{
+			for (j = i; j < n && items[j].bucket == items[i].bucket; j++)
+				;
+			added += mergeBucket(db, items[i].bucket, items + i, j - i);
+		}
+	}
+	db->nrecords += added;
+	walOpEnd(db);
+	free(items);
+	list->items = NULL;
+	list->n = list->capacity = 0;
+	syncHashFile(db);
+	printf("Bulk load: %ld records added.\n", added);
+	return added;
+}
+
+/****************************INGESTWORKER****************************
+Parses one chunk of the input file. A chunk owns every line that
+starts inside it, so the worker first skips the tail of a line
+begun in the previous chunk, and finishes the line it is in when
+it reaches the end. Valid records are packed into batches, which
+are handed to the writer through the shared queue.
+*/
+#ifdef HAVE_PTHREADS
+void *ingestWorker(void *arg)
+{
+	INGESTCHUNK *chunk = (INGESTCHUNK *)arg;
+	INGEST *ingest = chunk->ingest;
+	PARSEBATCH *batch = NULL;
+	char line[LINE_SIZE], field[LINE_SIZE];
+	long pos = chunk->start, lines = 0;
+	int c, code, midLine = 0;
+	size_t len;
+
+	FILE *inFile = fopen(ingest->filename, "rb");
+	if (!inFile)
+	{
+		printf("Unable to open %s!\n", ingest->filename);
+		exit(101);
+	}
+	if (pos > 0)
+	{
+		fseek(inFile, pos - 1, SEEK_SET);
+		while ((c = fgetc(inFile)) != EOF && c != '\n')
+			pos++;
+	}
+
+	while ((pos < chunk->end || midLine) && fgets(line, LINE_SIZE, inFile))
+	{
+		len = strlen(line);
+		pos += len;
+		midLine = line[len - 1] != '\n';
+		lines++;
+
+		if (!batch)
+		{
+			pthread_mutex_lock(&ingest->lock);
+			while (!ingest->freeBatches)
+				pthread_cond_wait(&ingest->hasFree, &ingest->lock);
+			batch = ingest->freeBatches;
+			ingest->freeBatches = batch->next;
+			pthread_mutex_unlock(&ingest->lock);
+			batch->n = 0;
+		}
+		if ((code = parseRecord(line, &batch->rec[batch->n], field)) != PARSE_OK)
+			parseMessage(code, field);
+		else if (++batch->n == PARSE_BATCH)
+		{
+			queueBatch(ingest, batch);
+			batch = NULL;
+		}
+	}
+	fclose(inFile);
+
+	pthread_mutex_lock(&ingest->lock);
+	if (batch)
+	{
+		batch->next = ingest->fullBatches;
+		ingest->fullBatches = batch;
+	}
+	ingest->lines += lines;
+	ingest->running--;
+	pthread_cond_signal(&ingest->hasFull);
+	pthread_mutex_unlock(&ingest->lock);
+	return NULL;
+}
+
+/****************************QUEUEBATCH****************************
+Hands a full batch to the writer.
+*/
+void queueBatch(INGEST *ingest, PARSEBATCH *batch)
+{
+	pthread_mutex_lock(&ingest->lock);
+	batch->next = ingest->fullBatches;
+	ingest->fullBatches = batch;
+	pthread_cond_signal(&ingest->hasFull);
+	pthread_mutex_unlock(&ingest->lock);
+}
+#endif
+
+/****************************PARALLELLOAD****************************
+Reads an input file with nthreads parser threads. The file is cut
+into equal byte ranges, one per thread, and the calling thread is
+the only writer: it takes batches of parsed records as they come
+and inserts them (or, with db->bulk, collects them for loadList).
+With db NULL the records are only counted (benchmarks). Batches
+arrive in no fixed order, so when an ID appears twice in the file
+it is not defined which line wins. Returns the records parsed.
+*/
+long parallelLoad(HASHDB *db, char *filename, int nthreads)
+{
+#ifdef HAVE_PTHREADS
+	INGEST ingest;
+	INGESTCHUNK chunks[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	PARSEBATCH *batches, *batch;
+	LOADLIST list = { NULL, 0, 0 };
+	long fileSize, parsed = 0;
+	int i, nbatches;
+
+	FILE *inFile = fopen(filename, "rb");
+	if (!inFile)
+	{
+		printf("Unable to open %s!\n", filename);
+		return 0;
+	}
+	fseek(inFile, 0, SEEK_END);
+	fileSize = ftell(inFile);
+	fclose(inFile);
+
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+	nbatches = 2 * nthreads + 1; // every worker can fill one while the writer drains one
+	batches = (PARSEBATCH *)malloc(nbatches * sizeof(PARSEBATCH));
+	if (!batches)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+
+	memset(&ingest, 0, sizeof ingest);
+	ingest.filename = filename;
+	ingest.running = nthreads;
+	for (i = 0; i < nbatches; i++)
+	{
+		batches[i].next = ingest.freeBatches;
+		ingest.freeBatches = &batches[i];
+	}
+	pthread_mutex_init(&ingest.lock, NULL);
+	pthread_cond_init(&ingest.hasFree, NULL);
+	pthread_cond_init(&ingest.hasFull, NULL);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		chunks[i].ingest = &ingest;
+		chunks[i].start = fileSize / nthreads * i;
+		chunks[i].end = i == nthreads - 1 ? fileSize : fileSize / nthreads * (i + 1);
+		if (pthread_create(&threads[i], NULL, ingestWorker, &chunks[i]) != 0)
+		{
+			printf("Could not start parser thread! Abort!\n");
+			exit(207);
+		}
+	}
+
+	// writer: store batches until every worker is done and the queue is empty
+	pthread_mutex_lock(&ingest.lock);
+	for (;;)
+	{
+		while (!ingest.fullBatches && ingest.running > 0)
+			pthread_cond_wait(&ingest.hasFull, &ingest.lock);
+		if (!ingest.fullBatches)
+			break;
+		batch = ingest.fullBatches;
+		ingest.fullBatches = batch->next;
+		pthread_mutex_unlock(&ingest.lock);
+
+		for (i = 0; i < batch->n && db; i++)
+		{
+			if (db->bulk)
+				addLoadItem(&list, &batch->rec[i]);
+			else
+				insert(&batch->rec[i], db);
+		}
+		parsed += batch->n;
+
+		pthread_mutex_lock(&ingest.lock);
+		batch->next = ingest.freeBatches;
+		ingest.freeBatches = batch;
+		pthread_cond_signal(&ingest.hasFree);
+	}
+	pthread_mutex_unlock(&ingest.lock);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&ingest.lock);
+	pthread_cond_destroy(&ingest.hasFree);
+	pthread_cond_destroy(&ingest.hasFull);
+	free(batches);
+
+	if (db && db->bulk)
+		loadList(db, &list);
+	else if (db)
+		syncHashFile(db);
+	return parsed;
+#else
+	// no threads here: read the file on this thread instead
+	RECORD newRecord;
+	char line[100];
+	long parsed = 0;
+
+	FILE *inFile = fopen(filename, "r");
+	if (!inFile)
+	{
+		printf("Unable to open %s!\n", filename);
+		return 0;
+	}
+	if (db && db->bulk)
+		parsed = bulkLoad(db, inFile);
+	else
+	{
+		while (fgets(line, 100, inFile))
+		{
+			if (parseLine(line, &newRecord) == PARSE_OK)
+			{
+				if (db)
+					insert(&newRecord, db);
+				parsed++;
+			}
+		}
+		if (db)
+			syncHashFile(db);
+	}
+	fclose(inFile);
+	return parsed;
+#endif
+}
+
+/*************************PARSERECORD****************************
+The parseRecord function checks one line of input and fills in
+a caller-owned record. It keeps no state between calls and does
+not modify or allocate anything, so several threads may parse
+at once. A line ending in "\r\n" is accepted.
+- ID must be 4 numbers
+- Name must be 20 chars or less, letters () or space
+- Qty must be a number 0-9999
+Pre: line, rec, field[LINE_SIZE]
+Post: returns PARSE_OK, or an error code with the offending text
+      copied to field (see parseMessage)
+*/
+int parseRecord(const char *line, RECORD *rec, char field[LINE_SIZE])
+{
+	const char *digits = "0123456789";
+	const char *nameChars = NAME_CHARS;
+	const char *token;
+	size_t len, i;
+	long tempQty;
+	char *end;
+
+	memset(rec, 0, sizeof(RECORD));
+
+	// parse line for ID. Must be 4 numbers, saved as a string
+	while (*line == ',')
+		line++;
+	if (*line == '\0')
+		return PARSE_NOID;
+	token = line;
+	len = strcspn(line, ",");
+	line += len + (line[len] != '\0');
+	copyField(field, token, len);
+	if (len != ID_SIZE || strspn(field, digits) != len)
+		return PARSE_BADID;
+	strcpy(rec->id, field);
+
+	// parse line for name. Can only be [a-zA-Z()\040], 20 chars max
+	while (*line == ':')
+		line++;
+	if (*line == '\0')
+		return PARSE_NONAME;
+	token = line;
+	len = strcspn(line, ":");
+	line += len + (line[len] != '\0');
+	copyField(field, token, len);
+	for (i = 0; i < len; i++)
+		field[i] = toupper((unsigned char)field[i]);
+	if (strspn(field, nameChars) != len)
+		return PARSE_BADNAME;
+	if (len > NAME_SIZE)
+		return PARSE_LONGNAME;
+	strcpy(rec->name, field);
+
+	// parse line for qty. Change from string to int
+	while (*line == '\n' || *line == '\r')
+		line++;
+	if (*line == '\0')
+		return PARSE_NOQTY;
+	copyField(field, line, strcspn(line, "\r\n"));
+	tempQty = strtol(field, &end, 10);
+	if (*end != '\0')
+		return PARSE_BADQTY;
+	if (tempQty < 0 || tempQty > 9999)
+		return PARSE_QTYRANGE;
+	rec->qty = (int)tempQty;
+	return PARSE_OK;
+}
+
+/*************************COPYFIELD****************************
+Copies len characters of a line into a LINE_SIZE buffer and
+terminates it.
+*/
+void copyField(char field[LINE_SIZE], const char *token, size_t len)
+{
+	if (len >= LINE_SIZE)
+		len = LINE_SIZE - 1;
+	memcpy(field, token, len);
+	field[len] = '\0';
+}
+
+/*************************PARSEMESSAGE****************************
+Prints the message for a parseRecord error code.
+*/
+void parseMessage(int code, const char *field)
+{
+	switch (code)
+	{
+	case PARSE_NOID:
+		printf("Unable to read in a value for ID!\nExiting. \n");
+		break;
+	case PARSE_BADID:
+		printf("ID must be %d digits! Unable to read %s\nExiting.\n", ID_SIZE, field);
+		break;
+	case PARSE_NONAME:
+		printf("Unable to read in a name!\nExiting. \n");
+		break;
+	case PARSE_BADNAME:
+		printf("Invalid characters found in name! Unable to read %s\nExiting.\n", field);
+		break;
+	case PARSE_LONGNAME:
+		printf("Name cannot be longer than %d characters! Unable to read %s\nExiting.\n", 
+			   NAME_SIZE, field);
+		break;
+	case PARSE_NOQTY:
+		printf("Unable to read in a value for quantity!\nExiting. \n");
+		break;
+	case PARSE_BADQTY:
+		printf("Error reading qty! Non-numeric characters found.\n");
+		break;
+	case PARSE_QTYRANGE:
+		printf("Qty %ld is out of range! Must be 0-9999.\n", strtol(field, NULL, 10));
+		break;
+	}
+}
+
+/*************************PARSELINE****************************
+The parseLine function accepts a string as input and uses it 
+to fill in a record owned by the caller (see parseRecord).
+Nothing is allocated. Bad lines are reported to the user.
+Pre: char line[100], rec
+Post: returns PARSE_OK, or the parseRecord error code
+*/
+int parseLine(char line[100], RECORD *rec)
+{
+	char field[LINE_SIZE];
+	int code = parseRecord(line, rec, field);
+
+	if (code != PARSE_OK)
+		parseMessage(code, field);
+	return code;
+}
+
+/*********************SEARCH_RECORD************************
+This function takes a filstream to a hashed binary file as
+input. It prompts the user to enter an ID to search for.
+It hashes the ID, searches the file bucket & overflow area,
+and prints the data if found.
+*/
+void search_record(HASHDB *db)
+{
+	RECORD detect;
+	int counter, slot;
+	char *digits = "1234567890";
+	char targetID[100];
+
+	while (printf("Please enter a 4 digit ID to search for, or type Q to quit:\n"),
+		   gets(targetID), strcmp(targetID, "q") != 0 && strcmp(targetID, "Q") != 0)
+	{
+		counter = strspn(targetID, digits);
+		if (counter != strlen(targetID) || strlen(targetID) != ID_SIZE)
+			printf("ID must be %d digits! Unable to read %s.\n", ID_SIZE, targetID);
+		else if (findRecord(db, targetID, &detect, &slot) < 0) // not found
+			printf("Records with ID %s not found.\n", targetID);
+		else if (slot < 0)
+			printf("ID %s found:\n%s %s %d\n", targetID, detect.id, detect.name, detect.qty);
+		else
+			printf("ID %s found in overflow slot %d:\n%s %s %d\n",
+				targetID, slot, detect.id, detect.name, detect.qty);
+	}
+}
+
+/*********************NAME_SEARCH************************
+Prompts for an item name, or the start of one followed by *,
+and prints the matching records, found through the name index.
+*/
+void name_search(HASHDB *db)
+{
+	char text[100], id[ID_SIZE + 1];
+	NAMEKEY *matches;
+	RECORD detect;
+	long count, i;
+	int prefix, slot;
+
+	while (printf("Please enter an item name, or the start of one followed by *, or type Q to quit:\n"),
+		   fgets(text, sizeof text, stdin) && (text[strcspn(text, "\r\n")] = '\0', strcmp(text, "q") != 0 && strcmp(text, "Q") != 0))
+	{
+		if (!nameQuery(text, &prefix))
+		{
+			printf("Names are up to %d letters, spaces or parentheses! Unable to read %s.\n", NAME_SIZE, text);
+			continue;
+		}
+		matches = nameSearch(db, text, prefix, &count);
+		printf("%ld records %s %s:\n", count, prefix ? "with names starting with" : "named", text);
+		for (i = 0; i < count; i++)
+		{
+			memcpy(id, matches[i].id, ID_SIZE);
+			id[ID_SIZE] = '\0';
+			if (findRecord(db, id, &detect, &slot) >= 0)
+				printf("%s %s %d\n", detect.id, detect.name, detect.qty);
+		}
+		free(matches);
+	}
+}
+
+/*********************RANGE_SEARCH************************
+Prompts for the first and last ID of a range and prints the
+records in it in ID order.
+*/
+void range_search(HASHDB *db)
+{
+	char text[100], low[100], high[100];
+	long count;
+
+	while (printf("Please enter the first and last ID of a range, or type Q to quit:\n"),
+		   fgets(text, sizeof text, stdin) && (text[strcspn(text, "\r\n")] = '\0', strcmp(text, "q") != 0 && strcmp(text, "Q") != 0))
+	{
+		if (sscanf(text, "%99s %99s", low, high) != 2 || !batchID(low) || !batchID(high))
+			printf("IDs must be %d digits! Unable to read %s.\n", ID_SIZE, text);
+		else
+		{
+			count = rangeScan(db, low, high, listRecord, stdout);
+			printf("%ld records from %s to %s.\n", count, low, high);
+		}
+	}
+}
+
+/*********************STOCK_REPORT************************
+Prompts for a low-stock quantity and prints the total quantity in
+stock, the records with less than that, in ID order, and the
+STOCK_TOP records with the most.
+*/
+void stock_report(HASHDB *db)
+{
+	char text[100];
+	STOCKITEM top[STOCK_TOP], *low;
+	long count, i;
+	int n;
+
+	while (printf("Please enter a low-stock quantity, or type Q to quit:\n"),
+		   fgets(text, sizeof text, stdin) && (text[strcspn(text, "\r\n")] = '\0', strcmp(text, "q") != 0 && strcmp(text, "Q") != 0))
+	{
+		if (*text == '\0' || strlen(text) > 4 || strspn(text, "0123456789") != strlen(text))
+		{
+			printf("Quantities are 0-9999! Unable to read %s.\n", text);
+			continue;
+		}
+		printf("%lld items in stock.\n", stockSum(db));
+		count = lowStock(db, atoi(text), NULL, 0);
+		low = (STOCKITEM *)malloc((count + 1) * sizeof(STOCKITEM));
+		if (!low)
+		{
+			printf("Out of memory! Abort!\n");
+			exit(204);
+		}
+		count = lowStock(db, atoi(text), low, count);
+		printf("%ld records with less than %s in stock:\n", count, text);
+		for (i = 0; i < count; i++)
+			visitStock(db, &low[i], listRecord, stdout);
+		free(low);
+		n = topStock(db, STOCK_TOP, top);
+		printf("%d records with the most in stock:\n", n);
+		for (i = 0; i < n; i++)
+			visitStock(db, &top[i], listRecord, stdout);
+	}
+}
+
+/****************************INSERT_STDIN****************************
+This function prompts the user to enter a line manually from 
+standard input to be added to the database.
+*/
+void insert_stdin(HASHDB *db)
+{
+	char input[100] = "test";
+	RECORD newRecord;
+	// instructions
+	printf("To insert an item, please enter a line of text in the following format:\n");
+	printf("####,ITEM NAME:##\n(ID),         :Quantity\n");
+	
+	while (printf("Please enter a line to parse, or type Q to quit:\n"),
+		   gets(input), strcmp(input, "q") != 0 && strcmp(input, "Q") != 0)
+	{
+		if (parseLine(input, &newRecord) == PARSE_OK)
+			insert(&newRecord, db);
+	}
+	syncHashFile(db);
+}
+
+/****************************INSERT_FILE****************************
+This function prompts the user to enter a filename, and inserts
+it in the same way as the original input file.
+*/
+void insert_file(HASHDB *db)
+{
+	char infilename[100];
+
+	while (printf("\nPlease enter the name of the file to insert, or Q to quit:\n"),
+		gets(infilename), strcmp(infilename, "q") != 0 && strcmp(infilename, "Q") != 0)
+	{
+		FILE *inFile = openFile(infilename); // open the file
+		if (inFile)
+		{
+			emptyFileTest(inFile); // check if empty
+			RECORD newRecord;
+			char line[100];
+			if (db->threads > 0)
+				parallelLoad(db, infilename, db->threads);
+			else if (db->bulk)
+				bulkLoad(db, inFile);
+			else
+			{
+				while (fgets(line, 100, inFile))
+				{
+					if (parseLine(line, &newRecord) == PARSE_OK)
+						insert(&newRecord, db);
+				}
+				syncHashFile(db);
+			}
+			// close file validation
+			if (fclose(inFile) == EOF)
+			{
+				printf("Error closing input file!\nExiting.\n");
+				exit(103);
+			}
+		}
+	}
+}
+/****************************DELETE****************************
+This function prompts the user to enter an ID to delete.
+It searches for the ID and replaces it with a tombstone.
+*/
+void delete_record(HASHDB *db)
+{
+	RECORD detect;
+	int counter, slot;
+	char *digits = "1234567890";
+	char targetID[100];
+	while (printf("Enter the ID of a record you want to delete, or Q to quit.\n"),
+		gets(targetID), strcmp(targetID, "q") != 0 && strcmp(targetID, "Q") != 0)
+	{
+		counter = strspn(targetID, digits);
+		if (counter != strlen(targetID) || strlen(targetID) != ID_SIZE)
+			printf("ID must be %d digits! Unable to read %s.\n", ID_SIZE, targetID);
+		else if (deleteRecord(db, targetID, &detect, &slot) < 0) // not found
+			printf("Records with ID %s not found.\n", targetID);
+		else if (slot < 0)
+			printf("Deleting record:\n%s %s %d\n", detect.id, detect.name, detect.qty);
+		else
+			printf("Deleting record from overflow:\n%s %s %d\n", detect.id, detect.name, detect.qty);
+	}
+	syncHashFile(db);
+}
+/****************************BATCH_CONTROL****************************
+Runs commands from a stream without prompts, one per line:
+GET id, PUT id,NAME:qty, UPD id,NAME:qty, DEL id, NAME name (NAME
+start* for a prefix), RANGE low high, SUM, LOW qty, TOP n and STATS,
+in upper or lower case. Each command writes one tab-separated result
+line (STATS writes its STAT lines first, see engineStats(), NAME a
+MATCH id name line per record found, RANGE a REC id name qty line per
+record, in ID order, LOW one per record with less than qty in stock,
+in ID order, and TOP one per record with the most, largest first):
+  OK id name qty   GET found the record
+  OK id            PUT, UPD or DEL succeeded
+  OK n             NAME, RANGE, LOW or TOP found n records
+  OK total         SUM: the total quantity in stock
+  OK               STATS is done
+  NF id            no record with that ID (GET, UPD, DEL)
+  DUP id           PUT of an ID that is already stored
+  ERR n reason     line n is not a valid command
+Results are buffered and the hash file is synced every BATCH_SYNC
+commands and at the end. A logged change is committed before the
+next command runs once its window has passed, but not while the
+read of that command waits.
+Returns the number of commands run.
+*/
+long batch_control(HASHDB *db, FILE *commands, FILE *results)
+{
+	char *errors[] = { "", "NOID", "BADID", "NONAME", "BADNAME", "LONGNAME", "NOQTY", "BADQTY", "QTYRANGE" };
+	char line[LINE_SIZE], field[LINE_SIZE], low[LINE_SIZE], high[LINE_SIZE], *arg;
+	long lineNo = 0, ran = 0, count, i;
+	double start = clockMicros();
+	int slot, code, prefix;
+	size_t len;
+	RECORD rec;
+	NAMEKEY *matches;
+	STOCKITEM *items;
+
+	db->quiet = 1;
+	while (fgets(line, LINE_SIZE, commands))
+	{
+		walTick(db);
+		lineNo++;
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (len == 0 || *line == '#') // blank lines and comments
+			continue;
+		arg = line + strcspn(line, " \t");
+		if (*arg != '\0')
+			*arg++ = '\0';
+		arg += strspn(arg, " \t");
+		for (len = 0; line[len]; len++)
+			line[len] = toupper((unsigned char)line[len]);
+
+		if (strcmp(line, "GET") == 0 || strcmp(line, "DEL") == 0)
+		{
+			if (!batchID(arg))
+				fprintf(results, "ERR\t%ld\tBADID\n", lineNo);
+			else if ((*line == 'G' ? findRecord(db, arg, &rec, &slot) : deleteRecord(db, arg, &rec, &slot)) < 0)
+				fprintf(results, "NF\t%s\n", arg);
+			else if (*line == 'G')
+				fprintf(results, "OK\t%s\t%s\t%d\n", rec.id, rec.name, rec.qty);
+			else
+				fprintf(results, "OK\t%s\n", arg);
+		}
+		else if (strcmp(line, "PUT") == 0 || strcmp(line, "UPD") == 0)
+		{
+			if ((code = parseRecord(arg, &rec, field)) != PARSE_OK)
+				fprintf(results, "ERR\t%ld\t%s\n", lineNo, errors[code]);
+			else if (*line == 'P')
+				fprintf(results, insert(&rec, db) ? "OK\t%s\n" : "DUP\t%s\n", rec.id);
+			else
+				fprintf(results, updateRecord(db, &rec) < 0 ? "NF\t%s\n" : "OK\t%s\n", rec.id);
+		}
+		else if (strcmp(line, "NAME") == 0)
+		{
+			if (!nameQuery(arg, &prefix))
+				fprintf(results, "ERR\t%ld\tBADNAME\n", lineNo);
+			else
+			{
+				matches = nameSearch(db, arg, prefix, &count);
+				for (i = 0; i < count; i++)
+					fprintf(results, "MATCH\t%.*s\t%.*s\n", ID_SIZE, matches[i].id, NAME_SIZE, matches[i].name);
+				fprintf(results, "OK\t%ld\n", count);
+				free(matches);
+			}
+		}
+		else if (strcmp(line, "RANGE") == 0)
+		{
+			if (sscanf(arg, "%99s %99s", low, high) != 2 || !batchID(low) || !batchID(high))
+				fprintf(results, "ERR\t%ld\tBADID\n", lineNo);
+			else
+				fprintf(results, "OK\t%ld\n", rangeScan(db, low, high, batchRecord, results));
+		}
+		else if (strcmp(line, "SUM") == 0)
+			fprintf(results, "OK\t%lld\n", stockSum(db));
+		else if (strcmp(line, "LOW") == 0 || strcmp(line, "TOP") == 0)
+		{
+			if (*arg == '\0' || strlen(arg) > 4 || strspn(arg, "0123456789") != strlen(arg))
+				fprintf(results, "ERR\t%ld\t%s\n", lineNo, *line == 'L' ? "BADQTY" : "BADCOUNT");
+			else
+			{
+				count = *line == 'L' ? lowStock(db, atoi(arg), NULL, 0) : atoi(arg);
+				items = (STOCKITEM *)malloc((count + 1) * sizeof(STOCKITEM));
+				if (!items)
+				{
+					printf("Out of memory! Abort!\n");
+					exit(204);
+				}
+				count = *line == 'L' ? lowStock(db, atoi(arg), items, count) : topStock(db, (int)count, items);
+				for (i = 0; i < count; i++)
+					visitStock(db, &items[i], batchRecord, results);
+				fprintf(results, "OK\t%ld\n", count);
+				free(items);
+			}
+		}
+		else if (strcmp(line, "STATS") == 0)
+		{
+			engineStats(db, results, 1);
+			fprintf(results, "OK\n");
+		}
+		else
+		{
+			fprintf(results, "ERR\t%ld\tCOMMAND\n", lineNo);
+			continue;
+		}
+		if (++ran % BATCH_SYNC == 0)
+			syncHashFile(db);
+	}
+	syncHashFile(db);
+	fflush(results);
+	printf("Batch: %ld commands in %.3f s (%.0f/s).\n", ran, (clockMicros() - start) / 1e6,
+		ran / ((clockMicros() - start) / 1e6 + 1e-9));
+	return ran;
+}
+
+/****************************BATCHID****************************
+Returns 1 if a batch command argument is an ID of ID_SIZE digits.
+*/
+int batchID(const char *arg)
+{
+	return strlen(arg) == ID_SIZE && strspn(arg, "0123456789") == ID_SIZE;
+}
+
+#ifdef HAVE_EPOLL
+volatile sig_atomic_t serverStopping = 0; // set by SIGINT or SIGTERM
+
+/****************************SERVER_CONTROL****************************
+Serves the table over a Unix domain socket at path until SIGINT or
+SIGTERM. One epoll loop handles every connection, so requests run
+one at a time, in order of arrival on each connection. A client
+may send any number of requests without waiting for the replies
+(pipelining); the replies come back in the same order. Requests
+and replies are fixed-size binary frames, with qty an int in host
+byte order:
+  GET  'G' id                GET found:  'O' name qty
+  DEL  'D' id                otherwise:  one code byte
+  PUT  'P' id name qty         'O' done, 'N' ID not stored,
+  UPD  'U' id name qty         'X' PUT of a stored ID, 'E' invalid
+The ID is ID_SIZE digits and the name NAME_SIZE bytes, padded
+with '\0'; records are checked like input lines. A request with an
+unknown code gets 'E' and its connection is closed, since the rest
+of the stream cannot be read. The hash file is synced every
+BATCH_SYNC requests, after SERVER_IDLE_MS without any, and on exit.
+A logged change is committed within the group commit window even
+when no request follows it (see walTick()).
+Returns the number of requests served.
+*/
+long server_control(HASHDB *db, const char *path)
+{
+	struct sockaddr_un addr;
+	struct epoll_event ev, events[SERVER_EVENTS];
+	CONN *conns = NULL, *conn;
+	long served = 0, synced = 0, wait;
+	int listener, epfd = -1, n, i, fd;
+	void (*oldPipe)(int);
+	double start = clockMicros();
+
+	if (strlen(path) >= sizeof addr.sun_path)
+	{
+		printf("Socket path %s is too long!\n", path);
+		exit(209);
+	}
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path); // left behind by a server that was killed
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+		listen(listener, SOMAXCONN) < 0 || fcntl(listener, F_SETFL, O_NONBLOCK) < 0 ||
+		(epfd = epoll_create1(0)) < 0)
+	{
+		printf("Could not listen on %s!\n", path);
+		exit(209);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; // the listener
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+	serverStopping = 0;
+	signal(SIGINT, serverStop);
+	signal(SIGTERM, serverStop);
+	oldPipe = signal(SIGPIPE, SIG_IGN); // a client gone with replies queued is a broken connection, not a reason to die
+	db->quiet = 1;
+	printf("Serving on %s; stop with Ctrl-C.\n", path);
+	fflush(stdout);
+
+	while (!serverStopping)
+	{
+		wait = walTick(db); // wake up in time to commit a lone logged change
+		n = epoll_wait(epfd, events, SERVER_EVENTS, wait < 0 || wait > SERVER_IDLE_MS ? SERVER_IDLE_MS : (int)wait);
+		if (n < 0 && errno != EINTR)
+		{
+			printf("Server wait failed! Abort!\n");
+			exit(209);
+		}
+		if (n <= 0 && served != synced) // idle: make the changes so far durable
+		{
+			syncHashFile(db);
+			synced = served;
+		}
+		for (i = 0; i < n; i++)
+		{
+			conn = (CONN *)events[i].data.ptr;
+			if (!conn) // new connections
+			{
+				while ((fd = accept(listener, NULL, NULL)) >= 0)
+				{
+					conn = (CONN *)calloc(1, sizeof(CONN));
+					if (!conn)
+					{
+						printf("Out of memory! Abort!\n");
+						exit(204);
+					}
+					conn->fd = fd;
+					conn->next = conns;
+					if (conns)
+						conns->prev = conn;
+					conns = conn;
+					fcntl(fd, F_SETFL, O_NONBLOCK);
+					ev.events = EPOLLIN;
+					ev.data.ptr = conn;
+					epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+				}
+				continue;
+			}
+
+			served += serveConnection(db, conn);
+			if (conn->broken || (conn->eof && conn->outLen == 0))
+			{
+				close(conn->fd); // also takes it out of the epoll set
+				if (conn->prev)
+					conn->prev->next = conn->next;
+				else
+					conns = conn->next;
+				if (conn->next)
+					conn->next->prev = conn->prev;
+				free(conn);
+				continue;
+			}
+			// read more once there is room for it; wait to write while replies are stuck
+			ev.events = (conn->eof || conn->inLen == SERVER_BUFSIZE ? 0 : EPOLLIN) |
+				(conn->outLen > conn->outStart ? EPOLLOUT : 0);
+			ev.data.ptr = conn;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+		}
+		if (served - synced >= BATCH_SYNC)
+		{
+			syncHashFile(db);
+			synced = served;
+		}
+	}
+
+	while (conns)
+	{
+		conn = conns;
+		conns = conn->next;
+		close(conn->fd);
+		free(conn);
+	}
+	close(epfd);
+	close(listener);
+	unlink(path);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGPIPE, oldPipe);
+	syncHashFile(db);
+	printf("Server: %ld requests in %.3f s.\n", served, (clockMicros() - start) / 1e6);
+	return served;
+}
+
+/****************************SERVERSTOP****************************
+Signal handler: asks server_control() to return.
+*/
+void serverStop(int sig)
+{
+	(void)sig;
+	serverStopping = 1;
+}
+
+/****************************SERVECONNECTION****************************
+Reads whatever a client has sent, serves every complete request
+that has room for its reply, and writes as many replies as the
+socket takes, until none of the three makes progress. Sets
+conn->eof once the client has closed its end, and conn->broken
+if the connection failed. Returns the number of requests served.
+*/
+long serveConnection(HASHDB *db, CONN *conn)
+{
+	long served = 0;
+	size_t at, size;
+	ssize_t got;
+	int progress = 1;
+
+	while (progress && !conn->broken)
+	{
+		progress = 0;
+		if (!conn->eof && conn->inLen < SERVER_BUFSIZE)
+		{
+			got = read(conn->fd, conn->in + conn->inLen, SERVER_BUFSIZE - conn->inLen);
+			if (got > 0)
+			{
+				conn->inLen += got;
+				progress = 1;
+			}
+			else if (got == 0)
+				conn->eof = 1;
+			else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				conn->broken = 1;
+		}
+
+		// serve complete requests while their replies fit
+		if (conn->outStart > 0)
+		{
+			memmove(conn->out, conn->out + conn->outStart, conn->outLen - conn->outStart);
+			conn->outLen -= conn->outStart;
+			conn->outStart = 0;
+		}
+		for (at = 0; at < conn->inLen && conn->outLen + WIRE_FOUND <= SERVER_BUFSIZE; at += size)
+		{
+			size = requestSize(conn->in[at]);
+			if (size == 0) // unknown code: the stream cannot be followed any further
+			{
+				conn->out[conn->outLen++] = WIRE_ERR;
+				conn->eof = 1;
+				at = conn->inLen;
+				break;
+			}
+			if (conn->inLen - at < size)
+				break;
+			conn->outLen += serveRequest(db, conn->in + at, conn->out + conn->outLen);
+			served++;
+			progress = 1;
+		}
+		memmove(conn->in, conn->in + at, conn->inLen - at);
+		conn->inLen -= at;
+
+		if (conn->outLen > conn->outStart)
+		{
+			got = write(conn->fd, conn->out + conn->outStart, conn->outLen - conn->outStart);
+			if (got > 0)
+			{
+				conn->outStart += got;
+				progress = 1;
+			}
+			else if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				conn->broken = 1; // EPIPE or ECONNRESET: the client has gone
+		}
+		if (conn->outStart == conn->outLen)
+			conn->outStart = conn->outLen = 0;
+	}
+	return served;
+}
+
+/****************************REQUESTSIZE****************************
+Returns the size of a request starting with code, or 0 if code is
+not a request.
+*/
+size_t requestSize(char code)
+{
+	if (code == WIRE_GET || code == WIRE_DEL)
+		return WIRE_KEY;
+	if (code == WIRE_PUT || code == WIRE_UPD)
+		return WIRE_RECORD;
+	return 0;
+}
+
+/****************************SERVEREQUEST****************************
+Runs one request and writes its reply. Returns the size of the
+reply.
+*/
+size_t serveRequest(HASHDB *db, const char *req, char *reply)
+{
+	char line[LINE_SIZE], field[LINE_SIZE];
+	RECORD rec;
+	int qty, slot;
+
+	if (*req == WIRE_PUT || *req == WIRE_UPD)
+	{
+		memcpy(&qty, req + 1 + ID_SIZE + NAME_SIZE, sizeof qty);
+		sprintf(line, "%.*s,%.*s:%d", ID_SIZE, req + 1, NAME_SIZE, req + 1 + ID_SIZE, qty);
+		if (parseRecord(line, &rec, field) != PARSE_OK)
+			*reply = WIRE_ERR;
+		else if (*req == WIRE_PUT)
+			*reply = insert(&rec, db) ? WIRE_OK : WIRE_DUP;
+		else
+			*reply = updateRecord(db, &rec) < 0 ? WIRE_NF : WIRE_OK;
+		return 1;
+	}
+
+	memcpy(rec.id, req + 1, ID_SIZE);
+	rec.id[ID_SIZE] = '\0';
+	if (!batchID(rec.id))
+		*reply = WIRE_ERR;
+	else if ((*req == WIRE_GET ? findRecord(db, rec.id, &rec, &slot) : deleteRecord(db, rec.id, &rec, &slot)) < 0)
+		*reply = WIRE_NF;
+	else if (*req == WIRE_GET)
+	{
+		*reply = WIRE_OK;
+		memset(reply + 1, 0, NAME_SIZE);
+		memcpy(reply + 1, rec.name, strlen(rec.name));
+		memcpy(reply + 1 + NAME_SIZE, &rec.qty, sizeof rec.qty);
+		return WIRE_FOUND;
+	}
+	else
+		*reply = WIRE_OK;
+	return 1;
+}
+#endif
+
+/****************************HASHDIAGNOSTICS****************************
+Reads every bucket and overflow chain and prints how evenly the
+hash function spreads the records: a histogram of records per
+bucket (0 to BUCKETSIZE, then one row per overflow page), the
+share of records in overflow pages, the average number of
+blocks read to find a stored ID and to miss an absent one, and
+the buffer pool's hit rate so far.
+*/
+void hashDiagnostics(HASHDB *db)
+{
+	char *names[HASH_COUNT] = { "cubes", "fnv", "mix" };
+	char label[20];
+	long most = 1;
+	long hits = db->poolHits, misses = db->poolMisses; // before this scan adds to them
+	int k, row;
+	TABLESCAN scan;
+
+	scanTable(db, &scan);
+	printf("Hash function: %s\n", names[db->hashFunc]);
+	printf("%ld records in %ld buckets, %ld overflow pages\n", db->nrecords, db->nbuckets, db->npages);
+	printf("Records per bucket:\n");
+	for (row = 0; row < DIAG_ROWS; row++)
+		if (scan.counts[row] > most)
+			most = scan.counts[row];
+	for (row = 0; row < DIAG_ROWS; row++)
+	{
+		fillLabel(row, label);
+		printf("%8s %8ld ", label, scan.counts[row]);
+		for (k = 0; k < scan.counts[row] * DIAG_BAR / most; k++)
+			putchar('*');
+		putchar('\n');
+	}
+	printf("Overflow ratio: %.3f\n", db->nrecords ? (double)db->oflowRecords / db->nrecords : 0.0);
+	printf("Tombstones: %ld\n", db->tombstones);
+	printf("Average probe length: %.3f blocks (found), %.3f blocks (not found)\n",
+		db->nrecords ? (double)scan.probes / db->nrecords : 0.0, (double)scan.missProbes / db->nbuckets);
+	if (db->frames)
+		printf("Buffer pool: %d pages, %ld hits, %ld misses (%.1f%% hits)\n", db->poolSize,
+			hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+/****************************SCANTABLE****************************
+Reads every bucket, overflow chain and free page once and fills
+in *scan.
+*/
+void scanTable(HASHDB *db, TABLESCAN *scan)
+{
+	long bucket, next;
+	int n, k, blocks, row;
+	BUCKET home;
+	OFLOWPAGE page;
+
+	memset(scan, 0, sizeof *scan);
+	for (bucket = 0; bucket < db->nbuckets; bucket++)
+	{
+		readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+		n = 0;
+		blocks = 1;
+		for (k = 0; k < BUCKETSIZE; k++)
+		{
+			scan->tombstones += home.key[k] == KEY_TOMBSTONE;
+			if (KEY_LIVE(home.key[k]))
+			{
+				n++;
+				scan->probes += blocks;
+			}
+		}
+		for (next = home.next; next; next = page.next)
+		{
+			readBlock(db, next, sizeof(OFLOWPAGE), &page);
+			blocks++;
+			for (k = 0; k < OFLOWSIZE; k++)
+			{
+				scan->tombstones += page.key[k] == KEY_TOMBSTONE;
+				if (KEY_LIVE(page.key[k]))
+				{
+					n++;
+					scan->probes += blocks;
+				}
+				else
+					scan->freeSlots++;
+			}
+		}
+		scan->missProbes += blocks;
+		row = n <= BUCKETSIZE ? n : BUCKETSIZE + 1 + (n - BUCKETSIZE - 1) / OFLOWSIZE;
+		scan->counts[row < DIAG_ROWS ? row : DIAG_ROWS - 1]++;
+	}
+	for (next = db->freePages; next; next = page.next)
+	{
+		readBlock(db, next, sizeof(OFLOWPAGE), &page);
+		scan->freePages++;
+		scan->freeSlots += OFLOWSIZE;
+	}
+}
+
+/****************************FILLLABEL****************************
+Writes the label of a row of the records-per-bucket histogram.
+*/
+void fillLabel(int row, char label[20])
+{
+	if (row <= BUCKETSIZE)
+		sprintf(label, "%d", row);
+	else if (row < DIAG_ROWS - 1)
+		sprintf(label, "%d-%d", BUCKETSIZE + 1 + (row - BUCKETSIZE - 1) * OFLOWSIZE,
+			BUCKETSIZE + (row - BUCKETSIZE) * OFLOWSIZE);
+	else
+		sprintf(label, "%d+", BUCKETSIZE + 1 + (row - BUCKETSIZE - 1) * OFLOWSIZE);
+}
+
+/****************************ENGINESTATS****************************
+Writes the engine statistics, one per line: I/O calls, buffer pool
+and log activity, per operation kind the operations run, blocks
+read per operation, overflow hits and presence bitmap answers,
+then the table's shape from a full scan (bucket fill histogram,
+tombstones, free overflow slots) and the name index size. With batch set every line is
+"STAT name value", tab-separated, as batch_control() results.
+*/
+void engineStats(HASHDB *db, FILE *out, int batch)
+{
+	char *ops[OP_COUNT] = { "get", "put", "del", "upd" };
+	char name[40], label[20];
+	long hits = db->poolHits, misses = db->poolMisses, seeks = db->nseeks, reads = db->nreads; // before the scan
+	int k;
+	TABLESCAN scan;
+
+	scanTable(db, &scan);
+	statLine(out, batch, "io.seeks", seeks, 0);
+	statLine(out, batch, "io.reads", reads, 0);
+	statLine(out, batch, "io.writes", db->nwrites, 0);
+	statLine(out, batch, "pool.pages", db->poolSize, 0);
+	statLine(out, batch, "pool.hits", hits, 0);
+	statLine(out, batch, "pool.misses", misses, 0);
+	statLine(out, batch, "wal.commits", db->walCommits, 0);
+	for (k = 0; k < OP_COUNT; k++)
+	{
+		sprintf(name, "%s.ops", ops[k]);
+		statLine(out, batch, name, db->stats[k].ops, 0);
+		sprintf(name, "%s.probes_per_op", ops[k]);
+		statLine(out, batch, name, db->stats[k].ops ? (double)db->stats[k].probes / db->stats[k].ops : 0.0, 3);
+		sprintf(name, "%s.overflow", ops[k]);
+		statLine(out, batch, name, db->stats[k].oflow, 0);
+		sprintf(name, "%s.filtered", ops[k]);
+		statLine(out, batch, name, db->stats[k].filtered, 0);
+	}
+	statLine(out, batch, "table.records", db->nrecords, 0);
+	statLine(out, batch, "table.buckets", db->nbuckets, 0);
+	statLine(out, batch, "table.load_factor", (double)db->nrecords / (db->nbuckets * BUCKETSIZE), 3);
+	statLine(out, batch, "table.splits", db->splits, 0);
+	statLine(out, batch, "table.overflow_records", db->oflowRecords, 0);
+	statLine(out, batch, "table.overflow_pages", db->npages, 0);
+	statLine(out, batch, "table.free_pages", scan.freePages, 0);
+	statLine(out, batch, "table.free_overflow_slots", scan.freeSlots, 0);
+	statLine(out, batch, "table.tombstones", scan.tombstones, 0);
+	statLine(out, batch, "table.compactions", db->compactions, 0);
+	statLine(out, batch, "table.probes_found", db->nrecords ? (double)scan.probes / db->nrecords : 0.0, 3);
+	statLine(out, batch, "table.probes_missed", (double)scan.missProbes / db->nbuckets, 3);
+	statLine(out, batch, "names.entries", db->nameEntries, 0);
+	statLine(out, batch, "names.pending", db->nameChanges, 0);
+	statLine(out, batch, "names.blocks_read", db->nameReads, 0);
+	for (k = 0; k < DIAG_ROWS; k++)
+	{
+		fillLabel(k, label);
+		sprintf(name, "fill.%s", label);
+		statLine(out, batch, name, scan.counts[k], 0);
+	}
+}
+
+/****************************STATLINE****************************
+Writes one engine statistic with the given decimals.
+*/
+void statLine(FILE *out, int batch, const char *name, double value, int decimals)
+{
+	fprintf(out, batch ? "STAT\t%s\t%.*f\n" : "%-26s %.*f\n", name, decimals, value);
+}
+
+/****************************COMPAREHASHES****************************
+Loads an input file into a scratch table once per hash function
+and prints the diagnostics of each, so the function that suits
+the IDs in the file can be chosen with -hash.
+*/
+void compareHashes(char *infilename)
+{
+	int func;
+
+	for (func = 0; func < HASH_COUNT; func++)
+	{
+		FILE *inFile = fopen(infilename, "r");
+		if (!inFile)
+		{
+			printf("Unable to open %s!\n", infilename);
+			exit(101);
+		}
+		HASHDB *db = createHashFile(DIAG_OUTPUT_FILENAME, BACKEND_STDIO, func);
+		db->quiet = 1;
+		bulkLoad(db, inFile);
+		fclose(inFile);
+		hashDiagnostics(db);
+		printf("\n");
+		closeHashFile(db);
+	}
+	removeHashFile(DIAG_OUTPUT_FILENAME);
+}
+
+/****************************USER_CONTROL****************************
+This function prompts the user to enter a code corresponding to 
+what task they want to do, and runs the specified function
+1: search
+2: insert from stdin
+3: insert from file
+4: delete
+5: hash diagnostics
+6: engine statistics
+Q: exit
+*/
+void user_control(HASHDB *db)
+{
+	char flag[10] = "";
+	while (printf("\nTo search the item database, press 1.\nTo insert from standard input, press 2.\n"),
+		   printf("To insert from a file, press 3.\nTo delete a record, press 4.\n"),
+		   printf("To show hash diagnostics, press 5.\nTo show engine statistics, press 6.\n"),
+		   printf("To search by item name, press 7.\nTo list a range of IDs, press 8.\n"),
+		   printf("To show a stock report, press 9.\n"),
+		   printf("To quit, press Q.\n"),
+		   gets(flag), strcmp(flag, "q") != 0 && strcmp(flag, "Q") != 0)
+	{
+		switch (*flag) // dereference flag (string) to get char
+		{
+		case '1':
+			search_record(db);
+			break;
+		case '2':
+			insert_stdin(db);
+			break;
+		case '3':
+			insert_file(db);
+			break;
+		case '4':
+			delete_record(db);
+			break;
+		case '5':
+			hashDiagnostics(db);
+			break;
+		case '6':
+			engineStats(db, stdout, 0);
+			break;
+		case '7':
+			name_search(db);
+			break;
+		case '8':
+			range_search(db);
+			break;
+		case '9':
+			stock_report(db);
+			break;
+		default:
+			printf("%s is an invalid flag!\n", flag);
+			break;
+		}
+	}	
+}
+/****************************CLOCKMICROS****************************
+Returns a monotonic timestamp in microseconds.
+*/
+double clockMicros(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return count.QuadPart * 1e6 / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#endif
+}
+#ifdef BENCHMARK
+int compareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/****************************BENCHKEY****************************
+Returns the i-th benchmark ID: a fixed permutation of
+0..space-1 so keys arrive in scattered order, as they
+would from a catalog.
+*/
+long benchKey(long i, long space)
+{
+	return (long)(((unsigned long long)i * 7919 + 13) % space);
+}
+
+void makeRecord(RECORD *rec, long key)
+{
+	if (snprintf(rec->id, sizeof rec->id, "%0*ld", ID_SIZE, key) >= (int)sizeof rec->id) // cannot happen below keySpace()
+	{
+		printf("Benchmark key %ld does not fit in %d digits!\n", key, ID_SIZE);
+		exit(207);
+	}
+	strcpy(rec->name, "BENCH ITEM");
+	rec->qty = (int)(key % 10000);
+}
+
+/****************************BENCH_INSERT****************************
+Loads 1K, 10K, 100K, ... records into a fresh table and reports
+insert throughput and latency percentiles for each size.
+*/
+void bench_insert(long maxRecords, int backend)
+{
+	long space = keySpace(), n, i;
+	double start, total, t0, *latency;
+	RECORD rec;
+
+	if (maxRecords > space)
+	{
+		printf("Only %ld IDs fit in %d digits; rebuild with a larger -DID_SIZE.\n", space, ID_SIZE);
+		maxRecords = space;
+	}
+	printf("%10s %12s %10s %10s %10s %10s\n",
+		"records", "inserts/s", "p50 us", "p99 us", "buckets", "pages");
+	for (n = 1000; n <= maxRecords; n *= 10)
+	{
+		HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, backend, HASH_DEFAULT);
+		db->quiet = 1;
+		latency = (double *)malloc(n * sizeof(double));
+		if (!latency)
+		{
+			printf("Out of memory! Abort!\n");
+			exit(204);
+		}
+
+		start = clockMicros();
+		for (i = 0; i < n; i++)
+		{
+			makeRecord(&rec, benchKey(i, space));
+			t0 = clockMicros();
+			insert(&rec, db);
+			latency[i] = clockMicros() - t0;
+		}
+		total = clockMicros() - start;
+
+		qsort(latency, n, sizeof(double), compareDoubles);
+		printf("%10ld %12.0f %10.2f %10.2f %10ld %10ld\n", n, n / total * 1e6,
+			latency[n / 2], latency[(long)(n * 0.99)], db->nbuckets, db->npages);
+		free(latency);
+		closeHashFile(db);
+	}
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************DROPCACHE****************************
+Writes the hash file out and asks the OS to evict it from the
+page cache, so the next lookups have to go to the disk. A mapped
+file is unmapped first since mapped pages cannot be evicted, and
+the buffer pool is emptied.
+*/
+void dropCache(HASHDB *db)
+{
+	syncHashFile(db);
+	if (db->frames)
+		setPoolSize(db, db->poolSize);
+#ifdef HAVE_MMAP
+	if (db->map)
+	{
+		munmap(db->map, db->mapSize);
+		db->map = NULL;
+	}
+	fsync(fileno(db->fp));
+	posix_fadvise(fileno(db->fp), 0, 0, POSIX_FADV_DONTNEED);
+	if (db->backend == BACKEND_MMAP)
+		mapHashFile(db);
+#else
+	printf("Cannot drop the page cache here; cold results are warm.\n");
+#endif
+}
+
+/****************************BENCH_LOOKUP****************************
+Loads a table with each backend and times a pass of lookups over
+every key, first with the file in the page cache, then after
+evicting it. The buffer pool is off, so each backend makes its
+own reads.
+*/
+void bench_lookup(long maxRecords)
+{
+	char *backends[] = { "stdio", "mmap" };
+	char *caches[] = { "warm", "cold" };
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i;
+	double start, total;
+	int backend, cold, slot, hits;
+	RECORD rec, found;
+
+	long reads, seeks;
+
+	printf("%8s %6s %10s %12s %10s %10s %10s\n", "backend", "cache", "lookups", "lookups/s",
+		"mean us", "reads/op", "seeks/op");
+	for (backend = BACKEND_STDIO; backend <= BACKEND_MMAP; backend++)
+	{
+		HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, backend, HASH_DEFAULT);
+		db->quiet = 1;
+		for (i = 0; i < n; i++)
+		{
+			makeRecord(&rec, benchKey(i, space));
+			insert(&rec, db);
+		}
+		syncHashFile(db);
+		setPoolSize(db, 0); // compare the backends, not the pool
+
+		for (cold = 0; cold <= 1; cold++)
+		{
+			if (cold)
+				dropCache(db);
+			hits = 0;
+			reads = db->nreads;
+			seeks = db->nseeks;
+			start = clockMicros();
+			for (i = n - 1; i >= 0; i--)
+			{
+				makeRecord(&rec, benchKey(i, space));
+				hits += findRecord(db, rec.id, &found, &slot) >= 0;
+			}
+			total = clockMicros() - start;
+			if (hits != n)
+				printf("Lookup benchmark found %d of %ld records!\n", hits, n);
+			printf("%8s %6s %10ld %12.0f %10.2f %10.2f %10.2f\n", backends[backend], caches[cold],
+				n, n / total * 1e6, total / n, (double)(db->nreads - reads) / n,
+				(double)(db->nseeks - seeks) / n);
+		}
+		closeHashFile(db);
+	}
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************BENCH_MISS****************************
+Loads half of the key space in ten steps. After each step, times
+lookups of IDs that are not in the table while reporting how many
+records live in overflow pages, first with the presence bitmap
+and then without it. Without the bitmap, only the home bucket's
+own chain is read for a miss, so the cost follows its length.
+The buffer pool is off, so those reads reach the file.
+*/
+void bench_miss(long maxRecords)
+{
+	long space = keySpace(), n = maxRecords < space / 2 ? maxRecords : space / 2;
+	long step = n / 10 > 0 ? n / 10 : 1, loaded = 0, probes, i, reads[2];
+	double start, total[2];
+	int slot, filtered;
+	unsigned char *presence;
+	RECORD rec, found;
+
+	HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+	db->quiet = 1;
+	setPoolSize(db, 0); // the pool would absorb the chain reads the bitmap saves
+	printf("%10s %10s %12s %10s %12s %10s\n", "records", "% oflow", "misses/s", "reads/op",
+		"unfiltered/s", "reads/op");
+	while (loaded < n)
+	{
+		for (i = 0; i < step && loaded < n; i++, loaded++)
+		{
+			makeRecord(&rec, benchKey(loaded, space));
+			insert(&rec, db);
+		}
+
+		probes = space - n < n ? space - n : n; // keys from the unused half
+		presence = db->presence;
+		for (filtered = 1; filtered >= 0; filtered--)
+		{
+			db->presence = filtered ? presence : NULL;
+			reads[filtered] = db->nreads;
+			start = clockMicros();
+			for (i = 0; i < probes; i++)
+			{
+				makeRecord(&rec, benchKey(n + i, space));
+				if (findRecord(db, rec.id, &found, &slot) >= 0)
+					printf("Miss benchmark found %s!\n", rec.id);
+			}
+			total[filtered] = clockMicros() - start;
+			reads[filtered] = db->nreads - reads[filtered];
+		}
+		db->presence = presence;
+		printf("%10ld %10.1f %12.0f %10.2f %12.0f %10.2f\n", loaded, 100.0 * db->oflowRecords / db->nrecords,
+			probes / total[1] * 1e6, (double)reads[1] / probes, probes / total[0] * 1e6, (double)reads[0] / probes);
+	}
+	closeHashFile(db);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************BENCH_POOL****************************
+Loads n records, then times a skewed lookup workload (nine in ten
+lookups go to the hottest 1% of IDs) with buffer pools of 0 to
+16384 pages, reporting the hit rate and file reads of each.
+*/
+void bench_pool(long maxRecords)
+{
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i, key;
+	long hot = n / 100 > 0 ? n / 100 : 1, lookups = 1000000, reads;
+	double start, total;
+	int npages, slot;
+	RECORD rec, found;
+
+	HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+	db->quiet = 1;
+	for (i = 0; i < n; i++)
+	{
+		makeRecord(&rec, benchKey(i, space));
+		insert(&rec, db);
+	}
+	printf("%d-byte pages, file %.1f MB\n", POOL_PAGESIZE, db->fileEnd / 1048576.0);
+	printf("%8s %10s %12s %10s %10s\n", "pages", "lookups", "lookups/s", "hit %", "reads/op");
+	for (npages = 0; npages <= 16384; npages = npages ? npages * 4 : 16)
+	{
+		setPoolSize(db, npages);
+		db->poolHits = db->poolMisses = 0;
+		reads = db->nreads;
+		start = clockMicros();
+		for (i = 0; i < lookups; i++)
+		{
+			key = (i * 2654435761UL) % 10 ? (i * 40503L) % hot : (i * 7L) % n;
+			makeRecord(&rec, benchKey(key, space));
+			if (findRecord(db, rec.id, &found, &slot) < 0)
+				printf("Pool benchmark lost %s!\n", rec.id);
+		}
+		total = clockMicros() - start;
+		printf("%8d %10ld %12.0f %10.1f %10.2f\n", npages, lookups, lookups / total * 1e6,
+			db->poolHits + db->poolMisses ? 100.0 * db->poolHits / (db->poolHits + db->poolMisses) : 0.0,
+			(double)(db->nreads - reads) / lookups);
+	}
+	closeHashFile(db);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************BENCH_WAL****************************
+Times durable inserts without a log and with group commit windows
+from 0 (an fsync per insert) to 10 ms. Each run stops after n
+inserts or five seconds.
+*/
+void bench_wal(long maxRecords)
+{
+	long windows[] = { -1, 0, 100, 1000, 10000 };
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i;
+	double start, total;
+	int w;
+	RECORD rec;
+
+	printf("%10s %10s %10s %12s %10s %12s\n", "window us", "inserts", "seconds", "inserts/s", "fsyncs",
+		"inserts/sync");
+	for (w = 0; w < (int)(sizeof windows / sizeof windows[0]); w++)
+	{
+		HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+		db->quiet = 1;
+		if (windows[w] >= 0)
+			openWal(db, windows[w]);
+		start = clockMicros();
+		for (i = 0; i < n && (i % 256 || clockMicros() - start < 5e6); i++)
+		{
+			makeRecord(&rec, benchKey(i, space));
+			insert(&rec, db);
+		}
+		syncHashFile(db);
+		total = clockMicros() - start;
+		if (windows[w] < 0)
+			printf("%10s %10ld %10.3f %12.0f %10s %12s\n", "no log", i, total / 1e6, i / total * 1e6, "-", "-");
+		else
+			printf("%10ld %10ld %10.3f %12.0f %10ld %12.1f\n", windows[w], i, total / 1e6, i / total * 1e6,
+				db->walCommits, (double)i / (db->walCommits ? db->walCommits : 1));
+		closeHashFile(db);
+	}
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************CHURNLOOKUPS****************************
+Looks up every fourth benchmark key (the ones bench_churn keeps)
+and prints a row: time per lookup and blocks read per lookup.
+*/
+void churnLookups(HASHDB *db, char *phase, long n, long steps, double worstStep)
+{
+	long space = keySpace(), i, lookups = 0, reads = db->nreads;
+	double start = clockMicros(), total;
+	int slot;
+	RECORD rec, found;
+
+	for (i = 0; i < n; i += 4, lookups++)
+	{
+		makeRecord(&rec, benchKey(i, space));
+		if (findRecord(db, rec.id, &found, &slot) < 0)
+			printf("Churn benchmark lost %s!\n", rec.id);
+	}
+	total = clockMicros() - start;
+	printf("%10s %8ld %10ld %10.1f %10.2f %10.2f %10.1f\n", phase, steps, db->tombstones,
+		100.0 * db->oflowRecords / db->nrecords, total / lookups, (double)(db->nreads - reads) / lookups, worstStep);
+}
+
+/****************************BENCH_CHURN****************************
+Loads n records, deletes three in four of them without compacting,
+then lets the compaction pass catch up in steps of COMPACT_MICROS,
+timing lookups of the remaining records along the way. Reports
+the tombstones left, the share of records in overflow pages, the
+blocks read per lookup and the longest compaction step.
+*/
+void bench_churn(long maxRecords)
+{
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i, steps = 0, dead;
+	double t0, worst = 0;
+	int slot, quarter;
+	RECORD rec, found;
+
+	HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+	db->quiet = 1;
+	setPoolSize(db, 0); // every block read goes to the file, so reads/op counts blocks
+	for (i = 0; i < n; i++)
+	{
+		makeRecord(&rec, benchKey(i, space));
+		insert(&rec, db);
+	}
+	printf("%10s %8s %10s %10s %10s %10s %10s\n", "phase", "steps", "tombstones", "% oflow",
+		"lookup us", "reads/op", "worst us");
+	churnLookups(db, "loaded", n, 0, 0);
+
+	db->compactMicros = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (i % 4 == 0)
+			continue;
+		makeRecord(&rec, benchKey(i, space));
+		if (deleteRecord(db, rec.id, &found, &slot) < 0)
+			printf("Churn benchmark could not delete %s!\n", rec.id);
+	}
+	churnLookups(db, "deleted", n, 0, 0);
+
+	dead = db->tombstones;
+	for (quarter = 3; quarter >= 0; quarter--)
+	{
+		while (db->tombstones > dead * quarter / 4)
+		{
+			t0 = clockMicros();
+			compactStep(db, COMPACT_MICROS);
+			t0 = clockMicros() - t0;
+			worst = t0 > worst ? t0 : worst;
+			steps++;
+		}
+		churnLookups(db, quarter ? "compacting" : "compacted", n, steps, worst);
+	}
+	closeHashFile(db);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************BENCHRANDOM****************************
+xorshift64* step: returns the next pseudo-random number of the
+sequence kept in *state, which must not start at 0.
+*/
+unsigned long long benchRandom(unsigned long long *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+/****************************MAKESKU****************************
+Fills in the record for benchmark key key with a catalog-like
+name built from a few word lists, and a quantity skewed toward
+small stock levels.
+*/
+void makeSku(RECORD *rec, long key)
+{
+	char *kinds[] = { "HEX", "WOOD", "LAG", "CARRIAGE", "MACHINE", "DRYWALL", "DECK", "ANCHOR" };
+	char *items[] = { "BOLT", "SCREW", "NUT", "WASHER", "NAIL", "HINGE", "BRACKET", "CLAMP", "RIVET" };
+	char *sizes[] = { "", " (S)", " (M)", " (L)", " (XL)" };
+	unsigned long long h = (unsigned long long)key * 0x9E3779B97F4A7C15ULL;
+
+	h ^= h >> 29;
+	if (snprintf(rec->id, sizeof rec->id, "%0*ld", ID_SIZE, key) >= (int)sizeof rec->id) // cannot happen below keySpace()
+	{
+		printf("Benchmark key %ld does not fit in %d digits!\n", key, ID_SIZE);
+		exit(207);
+	}
+	sprintf(rec->name, "%s %s%s", kinds[h % 8], items[h / 8 % 9], sizes[h / 72 % 5]);
+	rec->qty = (int)(h / 360 % 100 * (h / 36000 % 100) % 10000);
+}
+
+/****************************ZIPFTABLE****************************
+Returns the cumulative weights of a Zipfian distribution with
+exponent 1 over ranks 0..n-1 (rank r has weight 1/(r+1)), for
+zipfRank() to search. Needs free().
+*/
+double *zipfTable(long n)
+{
+	double *cdf = (double *)malloc(n * sizeof(double)), sum = 0;
+	long r;
+
+	if (!cdf)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	for (r = 0; r < n; r++)
+		cdf[r] = sum += 1.0 / (r + 1);
+	return cdf;
+}
+
+/****************************ZIPFRANK****************************
+Draws a rank from a zipfTable(): binary search for the first
+rank whose cumulative weight reaches a uniform point.
+*/
+long zipfRank(const double *cdf, long n, unsigned long long random)
+{
+	double point = (random >> 11) * (1.0 / 9007199254740992.0) * cdf[n - 1];
+	long lo = 0, hi = n - 1, mid;
+
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (cdf[mid] < point)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/****************************HISTRECORD****************************
+Adds a latency in nanoseconds to a histogram. Values below
+2^(HIST_SUBBITS+1) get a bucket each; above that every power of
+two is split into 2^HIST_SUBBITS equal buckets.
+*/
+void histRecord(HISTOGRAM *hist, long long ns)
+{
+	int shift = 0;
+
+	if (ns < 0)
+		ns = 0;
+	while ((ns >> shift) >= (2LL << HIST_SUBBITS) && shift < HIST_SHIFTS)
+		shift++;
+	if ((ns >> shift) >= (2LL << HIST_SUBBITS)) // off the scale
+		ns = ((2LL << HIST_SUBBITS) - 1) << shift;
+	hist->counts[((long)shift << HIST_SUBBITS) + (ns >> shift)]++;
+	hist->total++;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+/****************************HISTPERCENTILE****************************
+Returns the latency in microseconds below which pct percent of
+the recorded values fall (the upper edge of that bucket).
+*/
+double histPercentile(const HISTOGRAM *hist, double pct)
+{
+	long long want = (long long)(hist->total * pct / 100.0 + 0.5), seen = 0;
+	long i, shift;
+
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < (long)(sizeof hist->counts / sizeof hist->counts[0]); i++)
+		if ((seen += hist->counts[i]) >= want)
+		{
+			if (i < (2L << HIST_SUBBITS))
+				return i / 1e3;
+			shift = (i >> HIST_SUBBITS) - 1;
+			return ((i - (shift << HIST_SUBBITS) + 1) << shift) / 1e3;
+		}
+	return hist->max / 1e3;
+}
+
+/****************************BENCH_YCSB****************************
+Workload suite. Loads n synthetic SKU records, then runs ops
+operations of each YCSB-style mix against insert(), findRecord(),
+updateRecord() and deleteRecord(): read-heavy, write-heavy,
+delete churn, miss-heavy and a skewed Zipfian mix. Every operation
+is timed into a histogram; ops/sec and p50 to p99.9 latencies are
+printed and written as JSON to jsonName, so runs of different
+builds can be compared.
+*/
+void bench_ycsb(long maxRecords, long ops, int backend, char *jsonName)
+{
+	WORKLOAD mixes[] = {
+		{ "read-heavy", 95, 5, 0, 0, 0 },
+		{ "write-heavy", 50, 50, 0, 0, 0 },
+		{ "churn", 50, 0, 50, 0, 0 },
+		{ "miss-heavy", 100, 0, 0, 90, 0 },
+		{ "zipfian", 95, 5, 0, 0, 1 },
+	};
+	char *hashNames[HASH_COUNT] = { "cubes", "fnv", "mix" };
+	long space = keySpace(), n = maxRecords < space / 2 ? maxRecords : space / 2, i, key;
+	unsigned long long seed = 88172645463325252ULL, r;
+	double start, total, t0, *cdf;
+	int w, pick, slot;
+	RECORD rec, found;
+	LOADLIST list = { NULL, 0, 0 };
+	HISTOGRAM *hist = (HISTOGRAM *)malloc(sizeof(HISTOGRAM));
+	FILE *json = fopen(jsonName, "w");
+
+	if (!hist || !json)
+	{
+		printf("Couldn't set up the workload benchmark.\n");
+		exit(201);
+	}
+	HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, backend, HASH_DEFAULT);
+	db->quiet = 1;
+	for (i = 0; i < n; i++)
+	{
+		makeSku(&rec, benchKey(i, space));
+		addLoadItem(&list, &rec);
+	}
+	loadList(db, &list);
+	cdf = zipfTable(n);
+
+	fprintf(json, "{\n  \"benchmark\": \"ycsb\",\n  \"records\": %ld,\n  \"ops\": %ld,\n", n, ops);
+	fprintf(json, "  \"id_size\": %d,\n  \"hash\": \"%s\",\n  \"backend\": \"%s\",\n  \"pool_pages\": %d,\n",
+		ID_SIZE, hashNames[db->hashFunc], backend == BACKEND_MMAP ? "mmap" : "stdio", db->poolSize);
+	fprintf(json, "  \"workloads\": [\n");
+	printf("%12s %10s %12s %9s %9s %9s %9s %9s\n", "workload", "ops", "ops/s", "p50 us", "p95 us",
+		"p99 us", "p99.9 us", "max us");
+	for (w = 0; w < (int)(sizeof mixes / sizeof mixes[0]); w++)
+	{
+		memset(hist, 0, sizeof(HISTOGRAM));
+		start = clockMicros();
+		for (i = 0; i < ops; i++)
+		{
+			r = benchRandom(&seed);
+			pick = (int)(r % 100);
+			r = benchRandom(&seed);
+			key = mixes[w].zipf ? zipfRank(cdf, n, r) : (long)(r % n);
+			if (pick < mixes[w].get && (long)(r >> 40) % 100 < mixes[w].miss)
+				key += n; // keys n..2n-1 are never loaded
+			makeSku(&rec, benchKey(key, space));
+
+			t0 = clockMicros();
+			if (pick < mixes[w].get)
+				findRecord(db, rec.id, &found, &slot);
+			else if (pick < mixes[w].get + mixes[w].upd)
+			{
+				rec.qty = (int)(r % 10000);
+				updateRecord(db, &rec);
+			}
+			else if (deleteRecord(db, rec.id, &found, &slot) < 0)
+				insert(&rec, db);
+			histRecord(hist, (long long)((clockMicros() - t0) * 1e3));
+		}
+		syncHashFile(db);
+		total = clockMicros() - start;
+
+		printf("%12s %10ld %12.0f %9.2f %9.2f %9.2f %9.2f %9.2f\n", mixes[w].name, ops, ops / total * 1e6,
+			histPercentile(hist, 50), histPercentile(hist, 95), histPercentile(hist, 99),
+			histPercentile(hist, 99.9), hist->max / 1e3);
+		fprintf(json, "    { \"name\": \"%s\", \"get\": %d, \"update\": %d, \"churn\": %d, \"miss\": %d, "
+			"\"zipfian\": %s,\n", mixes[w].name, mixes[w].get, mixes[w].upd, mixes[w].churn, mixes[w].miss,
+			mixes[w].zipf ? "true" : "false");
+		fprintf(json, "      \"ops_per_sec\": %.0f, \"p50_us\": %.3f, \"p95_us\": %.3f, \"p99_us\": %.3f, "
+			"\"p999_us\": %.3f, \"max_us\": %.3f }%s\n", ops / total * 1e6, histPercentile(hist, 50),
+			histPercentile(hist, 95), histPercentile(hist, 99), histPercentile(hist, 99.9), hist->max / 1e3,
+			w + 1 < (int)(sizeof mixes / sizeof mixes[0]) ? "," : "");
+	}
+	fprintf(json, "  ]\n}\n");
+	fclose(json);
+	printf("Results written to %s\n", jsonName);
+	free(cdf);
+	free(hist);
+	closeHashFile(db);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************SCANNAMES****************************
+Counts the records named name (or starting with it, if prefix is
+set) by reading every bucket and overflow chain.
+*/
+long scanNames(HASHDB *db, const char *name, int prefix)
+{
+	BUCKET home;
+	OFLOWPAGE page;
+	long bucket, next, found = 0;
+	size_t len = strlen(name) + !prefix; // exact: the terminator must match too
+	int k;
+
+	for (bucket = 0; bucket < db->nbuckets; bucket++)
+	{
+		readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+		for (k = 0; k < BUCKETSIZE; k++)
+			found += KEY_LIVE(home.key[k]) && strncmp(home.data[k].name, name, len) == 0;
+		for (next = home.next; next; next = page.next)
+		{
+			readBlock(db, next, sizeof(OFLOWPAGE), &page);
+			for (k = 0; k < OFLOWSIZE; k++)
+				found += KEY_LIVE(page.key[k]) && strncmp(page.data[k].name, name, len) == 0;
+		}
+	}
+	return found;
+}
+
+/****************************NAMEMISMATCHES****************************
+Runs each query through the name index and a full scan and
+returns how many of them disagree.
+*/
+int nameMismatches(HASHDB *db, char *queries[], int nqueries)
+{
+	char text[NAME_SIZE + 2];
+	long count;
+	int q, prefix, wrong = 0;
+
+	for (q = 0; q < nqueries; q++)
+	{
+		strcpy(text, queries[q]);
+		nameQuery(text, &prefix);
+		free(nameSearch(db, text, prefix, &count));
+		wrong += count != scanNames(db, text, prefix);
+	}
+	return wrong;
+}
+
+/****************************BENCH_NAMES****************************
+Times name queries answered from the name index against the same
+queries answered by scanning the whole table, reporting the
+matches, the time per query and the index blocks read. The load
+is merged into the side file first, so the queries read its
+blocks rather than the in-memory log of changes. Then
+renames and deletes a share of the records, and closes and reopens
+the table, checking after each step that the index and a scan
+agree on every query.
+*/
+void bench_names(long maxRecords)
+{
+	char *queries[] = { "HEX BOLT (XL)", "DECK SCREW", "LAG NUT*", "MACHINE*", "D*", "ZINC*" };
+	int nqueries = sizeof queries / sizeof queries[0], q, prefix, reps, slot, wrong;
+	char text[NAME_SIZE + 2];
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i, count, scanned, reads;
+	double start, indexed, full;
+	RECORD rec, found;
+	LOADLIST list = { NULL, 0, 0 };
+	HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+
+	db->quiet = 1;
+	for (i = 0; i < n; i++)
+	{
+		makeSku(&rec, benchKey(i, space));
+		addLoadItem(&list, &rec);
+	}
+	loadList(db, &list);
+	syncHashFile(db);
+	if (db->nameChanges > 0) // below NAMES_DELTA changes the log would answer every query
+		mergeNameIndex(db);
+
+	printf("%16s %9s %12s %10s %12s %9s\n", "query", "matches", "index ms", "blocks", "scan ms", "speedup");
+	for (q = 0; q < nqueries; q++)
+	{
+		strcpy(text, queries[q]);
+		nameQuery(text, &prefix);
+		reads = db->nameReads;
+		start = clockMicros();
+		for (reps = 0; reps < 10 || clockMicros() - start < 100000; reps++)
+			free(nameSearch(db, text, prefix, &count));
+		indexed = (clockMicros() - start) / reps;
+		start = clockMicros();
+		scanned = scanNames(db, text, prefix);
+		full = clockMicros() - start;
+		printf("%16s %9ld %12.3f %10ld %12.3f %8.0fx\n", queries[q], count, indexed / 1e3,
+			(db->nameReads - reads) / reps, full / 1e3, full / indexed);
+		if (count != scanned)
+			printf("The index found %ld records, the scan %ld!\n", count, scanned);
+	}
+
+	// rename every 10th record and delete every 7th, then reopen
+	for (i = 0; i < n; i += 10)
+	{
+		makeSku(&rec, benchKey(i, space));
+		strcpy(rec.name, "DECK SCREW");
+		updateRecord(db, &rec);
+	}
+	for (i = 3; i < n; i += 7)
+	{
+		makeSku(&rec, benchKey(i, space));
+		deleteRecord(db, rec.id, &found, &slot);
+	}
+	wrong = nameMismatches(db, queries, nqueries);
+	closeHashFile(db);
+	db = openHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO);
+	if (!db)
+	{
+		printf("Name benchmark could not reopen %s!\n", BENCH_OUTPUT_FILENAME);
+		exit(208);
+	}
+	wrong += nameMismatches(db, queries, nqueries);
+	printf(wrong ? "Index and scan disagreed on %d queries after updates!\n" :
+		"Index and scan agree after renames, deletes and a reopen.\n", wrong);
+	closeHashFile(db);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************CHECKRANGE****************************
+rangeScan() visitor for bench_range(): counts the records and
+those that are out of ID order.
+*/
+void checkRange(const RECORD *rec, void *arg)
+{
+	RANGECHECK *check = (RANGECHECK *)arg;
+
+	check->unordered += check->n > 0 && strcmp(rec->id, check->last) <= 0;
+	strcpy(check->last, rec->id);
+	check->n++;
+}
+
+/****************************BENCH_RANGE****************************
+Times an ordered export of the whole table against a plain scan
+of it, then ID ranges covering 0.01% to 100% of the key space,
+each both by looking up the IDs in the presence bitmap and by
+sorting a scan of the table, checking that both visit the same
+records in ID order.
+*/
+void bench_range(long maxRecords)
+{
+	double widths[] = { 0.0001, 0.001, 0.01, 0.1, 1.0 };
+	char low[ID_SIZE + 1], high[ID_SIZE + 1];
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i, lo, hi, exported;
+	double start, scan, total, probed, merged, megabytes;
+	int w;
+	RECORD rec;
+	RANGECHECK byProbe, byMerge;
+	TABLESCAN table;
+	LOADLIST list = { NULL, 0, 0 };
+	HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+	FILE *exportFile;
+
+	db->quiet = 1;
+	for (i = 0; i < n; i++)
+	{
+		makeSku(&rec, benchKey(i, space));
+		addLoadItem(&list, &rec);
+	}
+	loadList(db, &list);
+
+	start = clockMicros();
+	scanTable(db, &table);
+	scan = clockMicros() - start;
+	start = clockMicros();
+	exported = exportCatalog(db, BENCH_EXPORT_FILENAME);
+	total = clockMicros() - start;
+	exportFile = fopen(BENCH_EXPORT_FILENAME, "rb");
+	fseek(exportFile, 0, SEEK_END);
+	megabytes = ftell(exportFile) / 1048576.0;
+	fclose(exportFile);
+	remove(BENCH_EXPORT_FILENAME);
+	printf("Table scan: %.3f s. Ordered export: %ld records, %.1f MB in %.3f s (%.0f records/s, %.1f MB/s), "
+		"runs of %ld records.\n\n", scan / 1e6, exported, megabytes, total / 1e6, exported / total * 1e6,
+		megabytes / total * 1e6, RANGE_RUN);
+
+	printf("%10s %10s %14s %14s %10s\n", "range", "records", "probe ms", "sort ms", "chosen");
+	for (w = 0; w < (int)(sizeof widths / sizeof widths[0]); w++)
+	{
+		lo = (long)(space * (1 - widths[w]) * 0.3);
+		hi = lo + (long)(space * widths[w]) - 1;
+		if (snprintf(low, sizeof low, "%0*ld", ID_SIZE, lo) >= (int)sizeof low ||
+			snprintf(high, sizeof high, "%0*ld", ID_SIZE, hi) >= (int)sizeof high) // cannot happen below keySpace()
+		{
+			printf("Range %ld-%ld does not fit in %d digits!\n", lo, hi, ID_SIZE);
+			exit(207);
+		}
+		memset(&byProbe, 0, sizeof byProbe);
+		memset(&byMerge, 0, sizeof byMerge);
+		start = clockMicros();
+		rangeProbe(db, lo, hi, checkRange, &byProbe);
+		probed = clockMicros() - start;
+		start = clockMicros();
+		rangeMerge(db, low, high, checkRange, &byMerge);
+		merged = clockMicros() - start;
+		printf("%9.2f%% %10ld %14.3f %14.3f %10s\n", widths[w] * 100, byMerge.n, probed / 1e3, merged / 1e3,
+			byMerge.n * RANGE_SEEK_RATIO < db->nbuckets + db->npages ? "probe" : "sort");
+		if (byProbe.n != byMerge.n || byProbe.unordered || byMerge.unordered)
+			printf("Range scans disagree: %ld and %ld records, %ld and %ld out of order!\n",
+				byProbe.n, byMerge.n, byProbe.unordered, byMerge.unordered);
+	}
+	closeHashFile(db);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************BENCH_STOCK****************************
+Loads 1M and then 10M catalog records (fewer if the ID space or
+the record limit is smaller) and times the stock queries answered
+from the quantity column against the same queries answered by
+reading every record, checking that both give the same answers.
+*/
+void bench_stock(long maxRecords)
+{
+	long sizes[] = { 1000000, 10000000 };
+	long space = keySpace(), limit = maxRecords < space ? maxRecords : space, n, last = 0, i, lowColumn;
+	long long sumColumn;
+	double start, rows[3], column[3];
+	int s, q, ncolumn;
+	char *queries[] = { "sum", "low", "top" };
+	char results[3][2][40];
+	RECORD rec;
+	STOCKITEM topRows[STOCK_TOP], topColumn[STOCK_TOP];
+	STOCKSCAN scan;
+	LOADLIST list;
+	HASHDB *db;
+
+	for (s = 0; s < (int)(sizeof sizes / sizeof sizes[0]); s++)
+	{
+		n = sizes[s] < limit ? sizes[s] : limit;
+		if (n == last)
+			break;
+		last = n;
+		db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+		db->quiet = 1;
+		memset(&list, 0, sizeof list);
+		for (i = 0; i < n; i++)
+		{
+			makeSku(&rec, benchKey(i, space));
+			addLoadItem(&list, &rec);
+		}
+		loadList(db, &list);
+		if (s == 0)
+			printf("\n%10s %6s %12s %12s %10s %16s\n", "records", "query", "row ms", "column ms", "speedup", "result");
+
+		start = clockMicros();
+		memset(&scan, 0, sizeof scan);
+		scanRecords(db, stockRow, &scan);
+		rows[0] = clockMicros() - start;
+		sprintf(results[0][0], "%lld", scan.sum);
+		start = clockMicros();
+		memset(&scan, 0, sizeof scan);
+		scan.low = BENCH_LOW_STOCK;
+		scanRecords(db, stockRow, &scan);
+		rows[1] = clockMicros() - start;
+		sprintf(results[1][0], "%ld", scan.lowCount);
+		start = clockMicros();
+		memset(&scan, 0, sizeof scan);
+		scan.top = topRows;
+		scan.topN = STOCK_TOP;
+		scanRecords(db, stockRow, &scan);
+		qsort(topRows, scan.topCount, sizeof(STOCKITEM), compareStock);
+		rows[2] = clockMicros() - start;
+		sprintf(results[2][0], "%d..%d", topRows[0].qty, topRows[scan.topCount - 1].qty);
+
+		start = clockMicros();
+		sumColumn = columnSum(db);
+		column[0] = clockMicros() - start;
+		sprintf(results[0][1], "%lld", sumColumn);
+		start = clockMicros();
+		lowColumn = columnLow(db, BENCH_LOW_STOCK, NULL, 0);
+		column[1] = clockMicros() - start;
+		sprintf(results[1][1], "%ld", lowColumn);
+		start = clockMicros();
+		ncolumn = columnTop(db, STOCK_TOP, topColumn);
+		column[2] = clockMicros() - start;
+		sprintf(results[2][1], "%d..%d", topColumn[0].qty, topColumn[ncolumn - 1].qty);
+
+		for (q = 0; q < 3; q++)
+		{
+			printf("%10ld %6s %12.3f %12.3f %9.1fx %16s\n", n, queries[q], rows[q] / 1e3, column[q] / 1e3,
+				rows[q] / (column[q] + 1e-3), results[q][1]);
+			if (strcmp(results[q][0], results[q][1]) != 0)
+				printf("Stock queries disagree: %s by rows, %s by the column!\n", results[q][0], results[q][1]);
+		}
+		printf("%10s column of %.1f MB, %s kernels\n", "", db->qtySize / 1048576.0,
+#ifdef HAVE_SSE2
+			"SSE2");
+#else
+			"scalar");
+#endif
+		closeHashFile(db);
+		removeHashFile(BENCH_OUTPUT_FILENAME);
+	}
+}
+
+/****************************PROBEKEYS****************************
+bench_probe() baseline: the version 4 probe, comparing every key
+of a block up to the first slot never used.
+*/
+int probeKeys(const PACKEDKEY *keys, int n, PACKEDKEY key, int *end)
+{
+	int i;
+
+	for (i = 0; i < n && keys[i] != KEY_EMPTY; i++)
+		if (keys[i] == key)
+			return i;
+	*end = i < n;
+	return -1;
+}
+
+/****************************PROBESCALAR****************************
+probeBlock() with the portable control byte match, so bench_probe()
+can time both in one build.
+*/
+int probeScalar(const unsigned char *ctrl, const PACKEDKEY *keys, int n, PACKEDKEY key, int *end)
+{
+	unsigned int match = ctrlMatchScalar(ctrl, n, ctrlByte(key));
+	int i;
+
+	for (; match; match &= match - 1)
+	{
+		i = lowestBit(match);
+		if (keys[i] == key)
+			return i;
+	}
+	*end = ctrlMatchScalar(ctrl, n, CTRL_EMPTY) != 0;
+	return -1;
+}
+
+/****************************BENCH_PROBE****************************
+Times the search within one block on its own: PROBE_PAGES overflow
+pages in memory are filled to 25%, 50%, 75% and 100% of their
+slots, and ops keys that are there and ops that are not are looked
+up by comparing every key, by matching control bytes a byte at a
+time, and by matching them with SIMD compares (probeBlock()).
+*/
+void bench_probe(long ops)
+{
+	int fills[] = { 25, 50, 75, 100 };
+	char *methods[] = { "keys", "scalar", SIMD_NAME };
+	OFLOWPAGE *pages = (OFLOWPAGE *)calloc(PROBE_PAGES, sizeof(OFLOWPAGE)), *page;
+	PACKEDKEY *keys = (PACKEDKEY *)malloc(PROBE_QUERIES * sizeof(PACKEDKEY));
+	long *where = (long *)malloc(PROBE_QUERIES * sizeof(long));
+	unsigned long long state = 88172645463325252ULL;
+	long i, p, hits;
+	double start, rate[3][2];
+	int f, m, k, n, miss, end, q;
+
+	if (!pages || !keys || !where)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	printf("%d-slot overflow pages, %ld probes per run\n", OFLOWSIZE, ops);
+	printf("%6s %8s %14s %14s\n", "fill", "probe", "hits/s", "misses/s");
+	for (f = 0; f < (int)(sizeof fills / sizeof fills[0]); f++)
+	{
+		n = (fills[f] * OFLOWSIZE + 50) / 100;
+		memset(pages, 0, PROBE_PAGES * sizeof(OFLOWPAGE));
+		for (p = 0; p < PROBE_PAGES; p++)
+			for (k = 0; k < n; k++)
+			{
+				pages[p].key[k] = (PACKEDKEY)(benchRandom(&state) % 100000000 * 2 + 2); // stored keys are even
+				pages[p].ctrl[k] = ctrlByte(pages[p].key[k]);
+			}
+		for (miss = 0; miss < 2; miss++)
+		{
+			for (i = 0; i < PROBE_QUERIES; i++)
+			{
+				where[i] = (long)(benchRandom(&state) % PROBE_PAGES);
+				keys[i] = miss ? (PACKEDKEY)(benchRandom(&state) % 100000000 * 2 + 3) :
+					pages[where[i]].key[benchRandom(&state) % n];
+			}
+			for (m = 0; m < 3; m++)
+			{
+				start = clockMicros();
+				for (i = 0, hits = 0; i < ops; i++)
+				{
+					q = (int)(i & (PROBE_QUERIES - 1));
+					page = &pages[where[q]];
+					if (m == 0)
+						hits += probeKeys(page->key, OFLOWSIZE, keys[q], &end) >= 0;
+					else if (m == 1)
+						hits += probeScalar(page->ctrl, page->key, OFLOWSIZE, keys[q], &end) >= 0;
+					else
+						hits += probeBlock(page->ctrl, page->key, OFLOWSIZE, keys[q], &end) >= 0;
+				}
+				rate[m][miss] = ops / (clockMicros() - start + 1e-3) * 1e6;
+				if (hits != (miss ? 0 : ops))
+					printf("The %s probe found %ld of %ld keys!\n", methods[m], hits, miss ? 0 : ops);
+			}
+		}
+		for (m = 0; m < 3; m++)
+			printf("%5d%% %8s %14.0f %14.0f\n", fills[f], methods[m], rate[m][0], rate[m][1]);
+	}
+	free(pages);
+	free(keys);
+	free(where);
+}
+
+/****************************BENCH_MULTI****************************
+Times ops random lookups, the deletes and re-inserts of ops
+records, and the lookups again after evicting the file from the
+page cache: one call per record, and with multiGet(), multiDelete()
+and multiPut() in batches of 1, 16, 256 and 4096. Each backend and
+batch size gets a freshly loaded table. Reports the reads and seeks
+per lookup, which fall as the batches let neighbouring buckets be
+read together. The puts refill the deletes' tombstones, so
+compaction is off.
+*/
+void bench_multi(long maxRecords, long ops)
+{
+	char *backends[] = { "stdio", "mmap" };
+	long batches[] = { 0, 1, 16, 256, 4096 }; // 0: one call per record
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i, m, size, hits, reads, seeks;
+	long *offsets = (long *)malloc(4096 * sizeof(long));
+	int *added = (int *)malloc(4096 * sizeof(int));
+	double start, gets, cold, dels, puts;
+	int backend, b, slot;
+	unsigned long long seed = 1;
+	RECORD *keys, *recs, found;
+	LOADLIST list;
+	HASHDB *db;
+
+	if (ops > n)
+		ops = n;
+	keys = (RECORD *)malloc(ops * sizeof(RECORD));
+	recs = (RECORD *)malloc(ops * sizeof(RECORD));
+	if (!offsets || !added || !keys || !recs)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	for (i = 0; i < ops; i++)
+	{
+		makeRecord(&keys[i], benchKey((long)(benchRandom(&seed) % n), space)); // looked up
+		makeRecord(&recs[i], benchKey(i, space)); // deleted and put back
+	}
+
+	printf("%8s %8s %12s %12s %10s %10s %12s %12s\n", "backend", "batch", "gets/s", "cold gets/s", "reads/get",
+		"seeks/get", "deletes/s", "puts/s");
+	for (backend = BACKEND_STDIO; backend <= BACKEND_MMAP; backend++)
+		for (b = 0; b < (int)(sizeof batches / sizeof batches[0]); b++)
+		{
+			db = createHashFile(BENCH_OUTPUT_FILENAME, backend, HASH_DEFAULT);
+			db->quiet = 1;
+			memset(&list, 0, sizeof list);
+			for (i = 0; i < n; i++)
+			{
+				makeRecord(&found, benchKey(i, space));
+				addLoadItem(&list, &found);
+			}
+			loadList(db, &list);
+			syncHashFile(db);
+			db->compactMicros = 0; // compaction steps would swamp the deletes (see bench_churn())
+
+			size = batches[b] ? batches[b] : 1;
+			hits = 0;
+			reads = db->nreads;
+			seeks = db->nseeks;
+			start = clockMicros();
+			for (i = 0; i < ops; i += m)
+			{
+				m = ops - i < size ? ops - i : size;
+				hits += batches[b] ? multiGet(db, keys + i, m, offsets) : findRecord(db, keys[i].id, &found, &slot) >= 0;
+			}
+			gets = clockMicros() - start;
+			reads = db->nreads - reads;
+			seeks = db->nseeks - seeks;
+			if (hits != ops)
+				printf("Batch benchmark found %ld of %ld records!\n", hits, ops);
+
+			hits = 0;
+			start = clockMicros();
+			for (i = 0; i < ops; i += m)
+			{
+				m = ops - i < size ? ops - i : size;
+				hits += batches[b] ? multiDelete(db, recs + i, m, offsets) : deleteRecord(db, recs[i].id, &found, &slot) >= 0;
+			}
+			dels = clockMicros() - start;
+			if (hits != ops)
+				printf("Batch benchmark deleted %ld of %ld records!\n", hits, ops);
+
+			hits = 0;
+			start = clockMicros();
+			for (i = 0; i < ops; i += m)
+			{
+				m = ops - i < size ? ops - i : size;
+				hits += batches[b] ? multiPut(db, recs + i, m, added) : insert(&recs[i], db);
+			}
+			puts = clockMicros() - start;
+			if (hits != ops)
+				printf("Batch benchmark put back %ld of %ld records!\n", hits, ops);
+
+			hits = 0;
+			dropCache(db);
+			start = clockMicros();
+			for (i = 0; i < ops; i += m)
+			{
+				m = ops - i < size ? ops - i : size;
+				hits += batches[b] ? multiGet(db, keys + i, m, offsets) : findRecord(db, keys[i].id, &found, &slot) >= 0;
+			}
+			cold = clockMicros() - start;
+			if (hits != ops)
+				printf("Batch benchmark found %ld of %ld records in a cold cache!\n", hits, ops);
+
+			if (batches[b])
+				printf("%8s %8ld", backends[backend], batches[b]);
+			else
+				printf("%8s %8s", backends[backend], "single");
+			printf(" %12.0f %12.0f %10.2f %10.2f %12.0f %12.0f\n", ops / gets * 1e6, ops / cold * 1e6, (double)reads / ops,
+				(double)seeks / ops, ops / dels * 1e6, ops / puts * 1e6);
+			closeHashFile(db);
+		}
+	free(offsets);
+	free(added);
+	free(keys);
+	free(recs);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+#ifndef _WIN32
+/****************************COUNTDONE****************************
+Completion of the asynchronous benchmark: counts the requests that
+succeeded in *arg.
+*/
+void countDone(int ok, const RECORD *rec, void *arg)
+{
+	(void)rec;
+	*(long *)arg += ok;
+}
+
+/****************************BENCH_AIO****************************
+Times ops random lookups and ops inserts of new IDs through an
+asynchronous queue: first synchronously, one pread at a time, then
+through io_uring at queue depths of 1 to 256. Every row reads the
+same pages with the buffer pool off, and lookups read with O_DIRECT,
+so every read goes to the device as it would for a file larger than
+RAM. Each row gets a freshly loaded table. Reports the reads and
+io_uring_enter calls per lookup; lookups/s should grow with the
+depth until the device is saturated.
+*/
+void bench_aio(long maxRecords, long ops)
+{
+	long space = keySpace(), n = maxRecords < space / 2 ? maxRecords : space / 2, i, hits, reads, enters, bytes = 0;
+	double start, gets, puts;
+	int depth, direct = 1, slot;
+	unsigned long long seed = 1;
+	RECORD *keys, *recs, found;
+	LOADLIST list;
+	HASHDB *db;
+	AIOQUEUE *q;
+
+	if (ops > n)
+		ops = n;
+	keys = (RECORD *)malloc(ops * sizeof(RECORD));
+	recs = (RECORD *)malloc(ops * sizeof(RECORD));
+	if (!keys || !recs)
+	{
+		printf("Out of memory! Abort!\n");
+		exit(204);
+	}
+	for (i = 0; i < ops; i++)
+	{
+		makeRecord(&keys[i], benchKey((long)(benchRandom(&seed) % n), space)); // looked up
+		makeRecord(&recs[i], benchKey(n + i, space)); // inserted
+	}
+
+	printf("%8s %12s %10s %12s %12s\n", "depth", "lookups/s", "reads/get", "enters/get", "puts/s");
+	for (depth = 0; depth <= 256; depth = depth ? depth * 2 : 1) // 0: synchronous
+	{
+		db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+		db->quiet = 1;
+		memset(&list, 0, sizeof list);
+		for (i = 0; i < n; i++)
+		{
+			makeRecord(&found, benchKey(i, space));
+			addLoadItem(&list, &found);
+		}
+		loadList(db, &list);
+		syncHashFile(db);
+		setPoolSize(db, 0); // every row reads the file itself
+		bytes = db->fileEnd;
+		if (depth == 0)
+			q = openAio(db, 1, AIO_SYNC | AIO_DIRECT);
+		else
+		{
+			q = openAio(db, depth, AIO_DIRECT);
+			if (q->ring < 0)
+			{
+				printf("io_uring is not available here; only the synchronous row was run.\n");
+				closeAio(q);
+				closeHashFile(db);
+				break;
+			}
+		}
+		direct &= q->direct;
+
+		hits = 0;
+		reads = db->nreads;
+		start = clockMicros();
+		for (i = 0; i < ops; i++)
+			aioGet(q, keys[i].id, countDone, &hits);
+		aioDrain(q);
+		gets = clockMicros() - start;
+		reads = db->nreads - reads;
+		enters = q->enters;
+		if (hits != ops)
+			printf("Asynchronous benchmark found %ld of %ld records!\n", hits, ops);
+
+		hits = 0;
+		start = clockMicros();
+		for (i = 0; i < ops; i++)
+			aioPut(q, &recs[i], countDone, &hits);
+		aioDrain(q);
+		puts = clockMicros() - start;
+		if (hits != ops)
+			printf("Asynchronous benchmark inserted %ld of %ld records!\n", hits, ops);
+		for (i = 0; i < ops; i++)
+			if (findRecord(db, recs[i].id, &found, &slot) < 0)
+				break;
+		if (i < ops)
+			printf("Asynchronous benchmark lost record %s!\n", recs[i].id);
+
+		if (depth)
+			printf("%8d", depth);
+		else
+			printf("%8s", "sync");
+		printf(" %12.0f %10.2f %12.2f %12.0f\n", ops / gets * 1e6, (double)reads / ops, (double)enters / ops, ops / puts * 1e6);
+		closeAio(q);
+		closeHashFile(db);
+	}
+	if (!direct)
+		printf("This file system refused O_DIRECT, so the lookups read through the page cache.\n");
+	else
+		printf("Lookups read with O_DIRECT, standing in for a file larger than RAM.\n");
+#ifdef _SC_PHYS_PAGES
+	printf("%ld records: %.1f MB file, %.1f MB of RAM.\n", n, bytes / 1048576.0,
+		(double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE) / 1048576.0);
+#endif
+	free(keys);
+	free(recs);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
+}
+
+/****************************BENCH_CRASH****************************
+Crash-recovery test. A child process inserts records with a
+1 ms group commit window and a small buffer pool, reporting
+through a pipe how many of them are committed, and kills itself
+at a random insert of each round: between two inserts in odd
+rounds, and in even rounds inside one, right after one of its
+first few writes is logged. The table is then recovered and
+checked: every committed record must be found intact, and a scan
+must find exactly the recorded number of records, each in the
+bucket its ID hashes to. At least one round must have left
+operations that were not committed, or nothing was undone.
 */
-FILE *createHashFile()
+void bench_crash(long maxRecords)
 {
-	printf("Opening output file: %s\n\n", DEFAULT_OUTPUT_FILENAME);
-	FILE *hashFile = fopen(DEFAULT_OUTPUT_FILENAME, "w+b");
-	RECORD hashtable[TABSIZE][BUCKETSIZE] = { "" };
-	RECORD overflow[OFLOWSIZE] = { "" };
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i, acked, done, scanned, misplaced, lost;
+	long stop, uncommitted = 0;
+	int fds[2], round, failures = 0, slot, k, torn;
+	unsigned long long seed = 88172645463325252ULL;
+	pid_t pid;
+	BUCKET home;
+	OFLOWPAGE page;
+	RECORD rec, found;
+	long bucket, next, committed, *ends;
 
-	if (!hashFile) // file validation
+	for (round = 1; round <= 5; round++)
 	{
-		printf("Couldn't open %s for writing.\n", DEFAULT_OUTPUT_FILENAME);
-		exit(201);
-	}
+		stop = benchRandom(&seed) % n; // fewer inserts than n, so the child never gets to finish
+		torn = round % 2 == 0;
+		if (pipe(fds) != 0 || (pid = fork()) < 0)
+		{
+			printf("Could not start the crash test.\n");
+			exit(207);
+		}
+		if (pid == 0) // child: insert until it kills itself
+		{
+			close(fds[0]);
+			HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+			db->quiet = 1;
+			setPoolSize(db, 16); // evict often, so pages reach the file between commits
+			openWal(db, 1000);
+			ends = (long *)malloc(n * sizeof(long));
+			if (!ends)
+				_exit(1);
+			for (i = 0, committed = done = 0; i < n; i++)
+			{
+				if (i == stop)
+				{
+					if (!torn)
+						raise(SIGKILL);
+					crashWrites = 1 + benchRandom(&seed) % 3; // may carry over into the next insert
+				}
+				makeRecord(&rec, benchKey(i, space));
+				insert(&rec, db);
+				ends[i] = db->walLsn; // where the insert of record i ends in the log
+				if (db->walDurable == db->walLsn) // a commit or checkpoint: everything up to record i is on disk
+					committed = i + 1;
+				else // the buffer pool may have committed part of the log, in the middle of an insert
+					while (committed < i && ends[committed] <= db->walDurable)
+						committed++;
+				if (committed != done)
+				{
+					done = committed;
+					if (write(fds[1], &done, sizeof done) < 0)
+						_exit(1);
+				}
+			}
+			raise(SIGKILL); // the last inserts made fewer logged writes than crashWrites
+			_exit(0);
+		}
 
-	if (fwrite(&hashtable[0][0], sizeof (RECORD), TABSIZE * BUCKETSIZE, hashFile) < TABSIZE)
-	{
-		printf("Hash table could not be created. Abort!\n");
-		exit(202);
-	}
+		close(fds[1]);
+		waitpid(pid, NULL, 0);
+		for (acked = 0; read(fds[0], &done, sizeof done) == sizeof done; )
+			acked = done;
+		close(fds[0]);
 
-	if (fwrite(overflow, sizeof (RECORD), OFLOWSIZE, hashFile) < OFLOWSIZE)
+		HASHDB *db = recoverHashFile(BENCH_OUTPUT_FILENAME, 1000);
+		for (i = 0, lost = 0; i < acked; i++)
+		{
+			makeRecord(&rec, benchKey(i, space));
+			if (findRecord(db, rec.id, &found, &slot) < 0 || strcmp(found.name, rec.name) != 0 || found.qty != rec.qty)
+				lost++;
+		}
+		for (bucket = 0, scanned = 0, misplaced = 0; bucket < db->nbuckets; bucket++)
+		{
+			readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+			for (k = 0; k < BUCKETSIZE; k++)
+				if (KEY_LIVE(home.key[k]))
+				{
+					scanned++;
+					unpackID(home.key[k], found.id);
+					misplaced += bucketAddress(db, found.id) != bucket;
+				}
+			for (next = home.next; next; next = page.next)
+			{
+				readBlock(db, next, sizeof(OFLOWPAGE), &page);
+				for (k = 0; k < OFLOWSIZE; k++)
+					if (KEY_LIVE(page.key[k]))
+					{
+						scanned++;
+						unpackID(page.key[k], found.id);
+						misplaced += bucketAddress(db, found.id) != bucket;
+					}
+			}
+		}
+		uncommitted += stop - acked + torn; // at least: a torn kill may land in a later insert
+		printf("Round %d: killed %s insert %ld, %ld committed, %ld recovered, %ld scanned: ", round,
+			torn ? "inside" : "before", stop + 1, acked, db->nrecords, scanned);
+		if (lost || misplaced || scanned != db->nrecords || db->nrecords < acked)
+		{
+			printf("FAILED (%ld lost, %ld misplaced)\n\n", lost, misplaced);
+			failures++;
+		}
+		else
+			printf("passed\n\n");
+		closeHashFile(db);
+		removeHashFile(BENCH_OUTPUT_FILENAME); // the next child creates a new table
+	}
+	if (uncommitted == 0)
 	{
-		printf("Could not create overflow area. Abort!\n");
-		exit(203);
+		printf("No round left an operation uncommitted, so recovery had nothing to undo!\n");
+		failures++;
 	}
-	rewind(hashFile);
-	return hashFile;
+	printf(failures ? "Crash test FAILED in %d rounds!\n" : "Crash test passed.\n", failures);
 }
+#endif
 
-/************************HASH************************
-Sum each ASCII code in id, cubed. Divide by 40, the
-remainder is the hash key.
+#ifdef HAVE_PTHREADS
+/****************************THREADWORKER****************************
+Runs the share of bench_threads() given to one thread.
 */
-long hash(char *key, int size)
+void *threadWorker(void *arg)
 {
-	long address = 0;
-	for (; *key != '\0'; key++)
+	BENCHTHREAD *t = (BENCHTHREAD *)arg;
+	long space = keySpace(), i;
+	unsigned long long r;
+	RECORD rec, found;
+
+	if (t->churn)
+	{
+		for (i = t->first; i < t->first + t->count; i++)
+		{
+			makeSku(&rec, benchKey(i, space));
+			sharedInsert(t->db, &rec);
+		}
+		for (i = t->first; i < t->first + t->count; i += 2)
+		{
+			makeSku(&rec, benchKey(i, space));
+			sharedDelete(t->db, rec.id, &found);
+		}
+		return NULL;
+	}
+	for (i = 0; i < t->ops; i++)
 	{
-		address += *key * *key * *key;
+		r = benchRandom(&t->seed);
+		makeSku(&rec, benchKey((long)(r % t->n), space));
+		if ((r >> 40) % 100 < 95)
+			sharedFind(t->db, rec.id, &found);
+		else
+		{
+			rec.qty = (int)(r % 10000);
+			sharedUpdate(t->db, &rec);
+		}
 	}
-	return address % 40;
+	return NULL;
 }
 
-/****************************INSERT****************************
-The insert function accepts a record and ptr to file as input.
-It hashes the record id, and writes the information to hashFile.
+/****************************BENCH_THREADS****************************
+Shares a table between threads. First 1 to 16 threads run the
+same total number of 95/5 lookup/update operations, reporting
+throughput and speedup over one thread. Then 8 threads each insert
+their own range of new keys and delete every other one of them,
+splitting buckets and compacting as they go; the table is then
+checked: every stored key must be found, every deleted key must be
+missing, and a scan must find exactly nrecords records, each in
+the bucket its ID hashes to.
 */
-void insert(const RECORD newRecord, FILE *hashFile)
+void bench_threads(long maxRecords, long ops)
 {
-	RECORD detect, temp;
-	int i;
-
-	temp = newRecord;
-	long address = hash(temp.id, ID_SIZE);
+	long space = keySpace(), n = maxRecords < space / 4 ? maxRecords : space / 4, i, per, lost, scanned, misplaced;
+	long bucket, next;
+	int nthreads, k, slot;
+	double start, total, single = 0;
+	pthread_t threads[16];
+	BENCHTHREAD work[16];
+	RECORD rec, found;
+	BUCKET home;
+	OFLOWPAGE page;
+	LOADLIST list = { NULL, 0, 0 };
+	HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
 
-	// go to beginning of hash bucket
-	if (fseek(hashFile, address * BUCKETSIZE * sizeof(RECORD), SEEK_SET) != 0)
+	db->quiet = 1;
+	for (i = 0; i < n; i++)
 	{
-		printf("Fatal seek error! Abort!\n");
-		exit(301);
+		makeSku(&rec, benchKey(i, space));
+		addLoadItem(&list, &rec);
 	}
-	
-	// find first available slot in the bucket
-	for (i = 0; i < BUCKETSIZE; i++)
+	loadList(db, &list);
+	shareHashFile(db, 1);
+	ops -= ops % 16; // every run does the same work, however it is split
+
+	printf("%ld records, %ld ops per run, 95%% lookups / 5%% updates\n", n, ops);
+	printf("%8s %12s %14s %9s\n", "threads", "seconds", "ops/s", "speedup");
+	for (nthreads = 1; nthreads <= 16; nthreads *= 2)
 	{
-		fread(&detect, sizeof(RECORD), 1, hashFile);
-		if (*detect.id == '\0') // available slot
-		{
-			fseek(hashFile, -1L * (signed)sizeof(RECORD), SEEK_CUR);
-			fwrite(&temp, sizeof(RECORD), 1, hashFile);
-			printf("Insert: Record %s added to bucket %ld.\n", temp.id, address);
-			return; // nothing left to do
-		}
-		else if (strcmp(detect.id, newRecord.id) == 0) // do not insert duplicate IDs! (bucket)
+		for (k = 0; k < nthreads; k++)
 		{
-			printf("Duplicate ID detected! Unable to insert %s.\n", newRecord.name);
-			return;
+			memset(&work[k], 0, sizeof(BENCHTHREAD));
+			work[k].db = db;
+			work[k].n = n;
+			work[k].ops = ops / nthreads;
+			work[k].seed = 88172645463325252ULL + k * 7919;
 		}
+		start = clockMicros();
+		for (k = 0; k < nthreads; k++)
+			if (pthread_create(&threads[k], NULL, threadWorker, &work[k]) != 0)
+			{
+				printf("Could not start benchmark thread! Abort!\n");
+				exit(207);
+			}
+		for (k = 0; k < nthreads; k++)
+			pthread_join(threads[k], NULL);
+		total = clockMicros() - start;
+		if (nthreads == 1)
+			single = total;
+		printf("%8d %12.3f %14.0f %8.2fx\n", nthreads, total / 1e6, ops / total * 1e6, single / total);
 	}
-	// bucket full: insert into the overflow area
-	fseek(hashFile, TABSIZE * BUCKETSIZE * sizeof(RECORD), SEEK_SET);
-	for (i = 0; i < OFLOWSIZE; i++)
+
+	// concurrent inserts and deletes, splitting and compacting the table
+	nthreads = 8;
+	per = n / nthreads;
+	for (k = 0; k < nthreads; k++)
 	{
-		fread(&detect, sizeof(RECORD), 1, hashFile);
-		if (*detect.id == '\0') // available slot
+		memset(&work[k], 0, sizeof(BENCHTHREAD));
+		work[k].db = db;
+		work[k].churn = 1;
+		work[k].first = n + k * per;
+		work[k].count = per;
+		if (pthread_create(&threads[k], NULL, threadWorker, &work[k]) != 0)
 		{
-			fseek(hashFile, -1L * (signed)sizeof(RECORD), SEEK_CUR);
-			fwrite(&temp, sizeof(RECORD), 1, hashFile);
-				printf("Insert: Record %s added to the overflow slot %d.\n", temp.id, i);
-			return;
+			printf("Could not start benchmark thread! Abort!\n");
+			exit(207);
 		}
-		else if (strcmp(detect.id, newRecord.id) == 0) // do not insert duplicate IDs! (oflow)
+	}
+	for (k = 0; k < nthreads; k++)
+		pthread_join(threads[k], NULL);
+	shareHashFile(db, 0);
+
+	for (i = 0, lost = 0; i < n + nthreads * per; i++)
+	{
+		makeSku(&rec, benchKey(i, space));
+		if ((findRecord(db, rec.id, &found, &slot) >= 0) != (i < n || (i - n) % 2 == 1))
+			lost++;
+	}
+	for (bucket = 0, scanned = 0, misplaced = 0; bucket < db->nbuckets; bucket++)
+	{
+		readBlock(db, bucketOffset(db, bucket), sizeof(BUCKET), &home);
+		for (k = 0; k < BUCKETSIZE; k++)
+			if (KEY_LIVE(home.key[k]))
+			{
+				scanned++;
+				unpackID(home.key[k], found.id);
+				misplaced += bucketAddress(db, found.id) != bucket;
+			}
+		for (next = home.next; next; next = page.next)
 		{
-			printf("Duplicate ID detected! Unable to insert %s.\n", newRecord.name);
-			return;
+			readBlock(db, next, sizeof(OFLOWPAGE), &page);
+			for (k = 0; k < OFLOWSIZE; k++)
+				if (KEY_LIVE(page.key[k]))
+				{
+					scanned++;
+					unpackID(page.key[k], found.id);
+					misplaced += bucketAddress(db, found.id) != bucket;
+				}
 		}
 	}
-	// item not inserted!
-	printf("Hash table overflow! Abort!\n");
-	exit(302);
+	printf("Concurrent churn on %d threads: %ld records, %ld scanned, %ld buckets, %ld splits, %ld compactions: ",
+		nthreads, db->nrecords, scanned, db->nbuckets, db->splits, db->compactions);
+	if (lost || misplaced || scanned != db->nrecords || db->nrecords != n + nthreads * per / 2)
+		printf("FAILED (%ld wrong lookups, %ld misplaced)\n", lost, misplaced);
+	else
+		printf("passed\n");
+	closeHashFile(db);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
 }
+#endif
 
-/*************************PARSELINE****************************
-The parseLine function accepts a string as input and uses it 
-to build a dynamically allocated record. 
-- ID must be 4 numbers
-- Name must be 20 chars or less, letters () or space
-- Qty must be a number
-Pre: char line[100]
-Post: RECORD * which later needs free()
+#ifdef HAVE_EPOLL
+/****************************WIREREQUEST****************************
+Writes a server request for rec: a GET or DEL carries only the ID,
+a PUT or UPD the whole record. Returns the size of the request.
 */
-RECORD *parseLine(char line[100])
+size_t wireRequest(char *req, char code, const RECORD *rec)
 {
-	char *tempID, *tempName, *strQty, *end;
-	char *digits = "0123456789";
-	char *nameChars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ()\040";
-	int counter, i = 0, tempQty = 0;
+	*req = code;
+	memcpy(req + 1, rec->id, ID_SIZE);
+	if (code == WIRE_GET || code == WIRE_DEL)
+		return WIRE_KEY;
+	memset(req + 1 + ID_SIZE, 0, NAME_SIZE);
+	memcpy(req + 1 + ID_SIZE, rec->name, strlen(rec->name));
+	memcpy(req + 1 + ID_SIZE + NAME_SIZE, &rec->qty, sizeof rec->qty);
+	return WIRE_RECORD;
+}
 
+/****************************CLIENTREAD****************************
+Returns the next need bytes of replies on a load generator
+connection, waiting for them if they have not arrived yet.
+*/
+char *clientRead(LOADCLIENT *c, size_t need)
+{
+	ssize_t got;
 
-	// parse line for ID. Must be 4 numbers, saved as a string
-	tempID = strtok(line, ",");
-	if (!tempID)
+	if (c->len - c->at < need)
 	{
-		printf("Unable to read in a value for ID!\nExiting. \n");
-		return NULL;
+		memmove(c->buf, c->buf + c->at, c->len - c->at);
+		c->len -= c->at;
+		c->at = 0;
 	}
-	counter = strspn(tempID, digits);
-	if (counter != strlen(tempID) || strlen(tempID) != ID_SIZE)
+	while (c->len < c->at + need)
 	{
-		printf("ID must be %d digits! Unable to read %s\nExiting.\n", ID_SIZE, tempID);
-		return NULL;
+		got = read(c->fd, c->buf + c->len, SERVER_BUFSIZE - c->len);
+		if (got <= 0)
+		{
+			printf("Lost the connection to the server! Abort!\n");
+			exit(209);
+		}
+		c->len += got;
 	}
+	c->at += need;
+	return c->buf + c->at - need;
+}
 
-	// parse line for name. Can only be [a-zA-Z()\040], 20 chars max
-	tempName = strtok(NULL, ":");
-	if (!tempName)
-	{
-		printf("Unable to read in a name!\nExiting. \n");
-		return NULL;
-	}
-	for (i = 0; i < strlen(tempName); i++)
-		tempName[i] = toupper(tempName[i]);
-	counter = strspn(tempName, nameChars);
-	if (counter != strlen(tempName))
-	{
-		printf("Invalid characters found in name! Unable to read %s\nExiting.\n", tempName);
-		return NULL;
-	}
-	if (strlen(tempName) > NAME_SIZE)
-	{
-		printf("Name cannot be longer than %d characters! Unable to read %s\nExiting.\n", 
-			   NAME_SIZE, tempName);
-		return NULL;
-	}
+/****************************BENCH_SERVER****************************
+Load generator for server mode. A child process loads the records
+and serves them on BENCH_SOCKET_FILENAME. The parent opens
+BENCH_CLIENTS connections and sends 95% GET and 5% UPD requests for
+stored IDs, depth requests on each connection before reading any
+replies, for pipeline depths 1, 16 and 128. It reports requests/s
+and percentiles of the time from sending a request to reading its
+reply, and counts replies other than the expected 'O'.
+*/
+void bench_server(long maxRecords, long ops)
+{
+	int depths[] = { 1, 16, 128 };
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i, done, wrong;
+	unsigned long long seed = 88172645463325252ULL, r;
+	int d, c, k, fd;
+	size_t size;
+	double start, total, now;
+	char req[128 * WIRE_RECORD], *reply;
+	ssize_t got;
+	pid_t pid;
+	struct sockaddr_un addr;
+	RECORD rec;
+	LOADLIST list = { NULL, 0, 0 };
+	LOADCLIENT *clients = (LOADCLIENT *)calloc(BENCH_CLIENTS, sizeof(LOADCLIENT));
+	HISTOGRAM *hist = (HISTOGRAM *)malloc(sizeof(HISTOGRAM));
 
-	// parse line for qty. Change from string to int
-	strQty = strtok(NULL, "\n");
-	if (!strQty)
+	if (!clients || !hist)
 	{
-		printf("Unable to read in a value for quantity!\nExiting. \n");
-		return NULL;
+		printf("Out of memory! Abort!\n");
+		exit(204);
 	}
-	tempQty = strtol(strQty, &end, 10);
-	if (*end != '\0')
+	remove(BENCH_SOCKET_FILENAME);
+	fflush(stdout);
+	if ((pid = fork()) < 0)
 	{
-		printf("Error reading qty! Non-numeric characters found.\n");
-		return NULL;
+		printf("Could not start the server.\n");
+		exit(207);
 	}
-	else if (tempQty < 0 || tempQty > 9999)
+	if (pid == 0) // child: the server
 	{
-		printf("Qty %d is out of range! Must be 0-9999.\n", tempQty);
-		return NULL;
+		HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+		db->quiet = 1;
+		for (i = 0; i < n; i++)
+		{
+			makeSku(&rec, benchKey(i, space));
+			addLoadItem(&list, &rec);
+		}
+		loadList(db, &list);
+		server_control(db, BENCH_SOCKET_FILENAME);
+		closeHashFile(db);
+		fflush(stdout);
+		_exit(0);
 	}
 
-	// create record
-	RECORD *newRecord = (RECORD *)malloc(sizeof(RECORD));
-	strcpy(newRecord->id, tempID);
-	strcpy(newRecord->name, tempName);
-	newRecord->qty = tempQty;
-	return newRecord;
-}
-
-/*********************SEARCH_RECORD************************
-This function takes a filstream to a hashed binary file as
-input. It prompts the user to enter an ID to search for.
-It hashes the ID, searches the file bucket & overflow area,
-and prints the data if found.
-*/
-void search_record(FILE *hashFile)
-{
-	RECORD detect;
-	int i, counter, found;
-	char *digits = "1234567890";
-	char targetID[100];
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, BENCH_SOCKET_FILENAME);
+	for (c = 0; c < BENCH_CLIENTS; c++)
+		for (k = 0; ; k++) // wait for the server to finish loading
+		{
+			fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof addr) == 0)
+			{
+				clients[c].fd = fd;
+				break;
+			}
+			close(fd);
+			if (k == 60000)
+			{
+				printf("Could not reach the server on %s!\n", BENCH_SOCKET_FILENAME);
+				kill(pid, SIGKILL);
+				exit(209);
+			}
+			usleep(1000);
+		}
 
-	while (printf("Please enter a 4 digit ID to search for, or type Q to quit:\n"),
-		   gets(targetID), strcmp(targetID, "q") != 0 && strcmp(targetID, "Q") != 0)
+	printf("%ld records, %ld requests per depth, %d connections, 95%% GET / 5%% UPD\n", n, ops, BENCH_CLIENTS);
+	printf("%6s %12s %9s %9s %9s %9s %9s\n", "depth", "requests/s", "p50 us", "p95 us", "p99 us", "p99.9 us",
+		"max us");
+	for (d = 0; d < (int)(sizeof depths / sizeof depths[0]); d++)
 	{
-		found = 0;
-		counter = strspn(targetID, digits);
-		if (counter != strlen(targetID) || strlen(targetID) != ID_SIZE)
-			printf("ID must be %d digits! Unable to read %s.\n", ID_SIZE, targetID);
-		else
+		memset(hist, 0, sizeof(HISTOGRAM));
+		wrong = 0;
+		start = clockMicros();
+		for (done = 0; done < ops; done += (long)depths[d] * BENCH_CLIENTS)
 		{
-				long address = hash(targetID, ID_SIZE);
-				if (fseek(hashFile, address * BUCKETSIZE * sizeof(RECORD), SEEK_SET) != 0)
+			for (c = 0; c < BENCH_CLIENTS; c++) // send a round on every connection...
+			{
+				for (k = 0, size = 0; k < depths[d]; k++)
 				{
-					printf("Fatal seek error! Abort");
-					exit(4);
+					r = benchRandom(&seed);
+					makeSku(&rec, benchKey((long)(r % n), space));
+					rec.qty = (int)((r >> 32) % 10000);
+					clients[c].get[k] = (r >> 20) % 100 < 95;
+					size += wireRequest(req + size, clients[c].get[k] ? WIRE_GET : WIRE_UPD, &rec);
 				}
-				// should stop searching once its found
-				for (i = 0; i < BUCKETSIZE && found == 0; i++)
-				{
-					fread(&detect, sizeof(RECORD), 1, hashFile);
-					if (strcmp(detect.id, targetID) == 0) // found it!
+				clients[c].sent = clockMicros();
+				for (i = 0; i < (long)size; i += got)
+					if ((got = write(clients[c].fd, req + i, size - i)) <= 0)
 					{
-						printf("ID %s found:\n%s %s %d\n", targetID, detect.id, detect.name, detect.qty);
-						found = 1;
+						printf("Lost the connection to the server! Abort!\n");
+						exit(209);
 					}
-				}
-				// check the overflow area
-				fseek(hashFile, TABSIZE * BUCKETSIZE * sizeof(RECORD), SEEK_SET);
-				for (i = 0; i < OFLOWSIZE && found == 0; i++)
+			}
+			for (c = 0; c < BENCH_CLIENTS; c++) // ...then read the replies
+				for (k = 0; k < depths[d]; k++)
 				{
-					fread(&detect, sizeof(RECORD), 1, hashFile);
-					if (strcmp(detect.id, targetID) == 0) // found it!
-					{
-						printf("ID %s found in overflow slot %d:\n%s %s %d\n",
-							targetID, i, detect.id, detect.name, detect.qty);
-						found = 1;
-					}
+					reply = clientRead(&clients[c], 1);
+					if (*reply != WIRE_OK)
+						wrong++;
+					else if (clients[c].get[k])
+						clientRead(&clients[c], WIRE_FOUND - 1);
+					now = clockMicros();
+					histRecord(hist, (long long)((now - clients[c].sent) * 1e3));
 				}
-				// not found
-				if (found == 0)
-					printf("Records with ID %s not found.\n", targetID);
 		}
+		total = clockMicros() - start;
+		printf("%6d %12.0f %9.2f %9.2f %9.2f %9.2f %9.2f\n", depths[d], done / total * 1e6,
+			histPercentile(hist, 50), histPercentile(hist, 95), histPercentile(hist, 99),
+			histPercentile(hist, 99.9), hist->max / 1e3);
+		if (wrong)
+			printf("%ld unexpected replies!\n", wrong);
 	}
+
+	for (c = 0; c < BENCH_CLIENTS; c++)
+		close(clients[c].fd);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	free(clients);
+	free(hist);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
 }
+#endif
 
-/****************************INSERT_STDIN****************************
-This function prompts the user to enter a line manually from 
-standard input to be added to the database.
+/****************************BENCH_LOAD****************************
+Writes an n-line input file, then loads it into a fresh table
+record by record (as main() does) and with bulkLoad(), reporting
+load time, the I/O calls and the heap allocations each needed.
 */
-void insert_stdin(FILE *hashFile)
+void bench_load(long maxRecords)
 {
-	char input[100] = "test";
-	RECORD *newRecord;
-	// instructions
-	printf("To insert an item, please enter a line of text in the following format:\n");
-	printf("####,ITEM NAME:##\n(ID),         :Quantity\n");
-	
-	while (printf("Please enter a line to parse, or type Q to quit:\n"),
-		   gets(input), strcmp(input, "q") != 0 && strcmp(input, "Q") != 0)
+	char *modes[] = { "insert", "bulk" };
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i;
+	double start, total;
+	char line[100];
+	int bulk;
+	RECORD rec, newRecord;
+	FILE *inFile = fopen(BENCH_INPUT_FILENAME, "w");
+
+	if (!inFile)
 	{
-		newRecord = parseLine(input);
-		if (newRecord)
-		{
-			insert(*newRecord, hashFile);
-			free(newRecord);
-		}
+		printf("Couldn't open %s for writing.\n", BENCH_INPUT_FILENAME);
+		exit(201);
 	}
-}
-
-/****************************INSERT_FILE****************************
-This function prompts the user to enter a filename, and inserts
-it in the same way as the original input file.
-*/
-void insert_file(FILE *hashFile)
-{
-	char infilename[100];
+	for (i = 0; i < n; i++)
+	{
+		makeRecord(&rec, benchKey(i, space));
+		fprintf(inFile, "%s,%s:%d\n", rec.id, rec.name, rec.qty);
+	}
+	fclose(inFile);
 
-	while (printf("\nPlease enter the name of the file to insert, or Q to quit:\n"),
-		gets(infilename), strcmp(infilename, "q") != 0 && strcmp(infilename, "Q") != 0)
+	printf("%8s %10s %10s %12s %10s %10s %8s\n", "mode", "records", "seconds", "records/s",
+		"writes", "seeks", "allocs");
+	for (bulk = 0; bulk <= 1; bulk++)
 	{
-		FILE *inFile = openFile(infilename); // open the file
-		if (inFile)
+		HASHDB *db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+		db->quiet = 1;
+		allocCount = 0;
+		inFile = fopen(BENCH_INPUT_FILENAME, "r");
+		start = clockMicros();
+		if (bulk)
+			bulkLoad(db, inFile);
+		else
 		{
-			emptyFileTest(inFile); // check if empty
-			RECORD *newRecord;
-			char line[100];
 			while (fgets(line, 100, inFile))
 			{
-				newRecord = parseLine(line);
-				insert(*newRecord, hashFile);
-				free(newRecord);
-			}
-			// close file validation
-			if (fclose(inFile) == EOF)
-			{
-				printf("Error closing input file!\nExiting.\n");
-				exit(103);
+				if (parseLine(line, &newRecord) == PARSE_OK)
+					insert(&newRecord, db);
 			}
 		}
+		syncHashFile(db);
+		total = clockMicros() - start;
+		fclose(inFile);
+		printf("%8s %10ld %10.3f %12.0f %10ld %10ld %8ld\n", modes[bulk], db->nrecords,
+			total / 1e6, db->nrecords / total * 1e6, db->nwrites, db->nseeks, allocCount);
+		if (allocCount > n / 1000)
+			printf("Load benchmark made %ld heap allocations for %ld records!\n", allocCount, n);
+		closeHashFile(db);
 	}
+	remove(BENCH_INPUT_FILENAME);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
 }
-/****************************DELETE****************************
-This function prompts the user to enter an ID to delete.
-It searches for the ID and replaces it with an empty record.
+
+/****************************BENCH_OPEN****************************
+Writes an n-line input file and times the two ways to start up:
+rebuilding the hash file from the text (record by record and
+with bulkLoad()) and reopening the file the rebuild left behind,
+which only reads the superblock and the presence bitmap.
 */
-void delete_record(FILE *hashFile)
+void bench_open(long maxRecords)
 {
-	RECORD detect;
-	RECORD emptyRecord = { "", "", 0 };
-	int i, counter, found;
-	char *digits = "1234567890";
-	char targetID[100];
-	while (printf("Enter the ID of a record you want to delete, or Q to quit.\n"),
-		gets(targetID), strcmp(targetID, "q") != 0 && strcmp(targetID, "Q") != 0)
+	char *modes[] = { "insert", "bulk", "reopen" };
+	long space = keySpace(), n = maxRecords < space ? maxRecords : space, i;
+	double start, total;
+	char line[100];
+	int mode, slot;
+	RECORD rec, newRecord, found;
+	HASHDB *db;
+	FILE *inFile = fopen(BENCH_INPUT_FILENAME, "w");
+
+	if (!inFile)
 	{
-		found = 0;
-		counter = strspn(targetID, digits);
-		if (counter != strlen(targetID) || strlen(targetID) != ID_SIZE)
-			printf("ID must be %d digits! Unable to read %s.\n", ID_SIZE, targetID);
-		else
+		printf("Couldn't open %s for writing.\n", BENCH_INPUT_FILENAME);
+		exit(201);
+	}
+	for (i = 0; i < n; i++)
+	{
+		makeRecord(&rec, benchKey(i, space));
+		fprintf(inFile, "%s,%s:%d\n", rec.id, rec.name, rec.qty);
+	}
+	fclose(inFile);
+
+	printf("%8s %10s %12s %10s\n", "startup", "records", "seconds", "reads");
+	for (mode = 0; mode <= 2; mode++)
+	{
+		start = clockMicros();
+		if (mode < 2)
 		{
-			long address = hash(targetID, ID_SIZE);
-			if (fseek(hashFile, address * BUCKETSIZE * sizeof(RECORD), SEEK_SET) != 0)
+			removeHashFile(BENCH_OUTPUT_FILENAME);
+			db = createHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO, HASH_DEFAULT);
+			db->quiet = 1;
+			inFile = fopen(BENCH_INPUT_FILENAME, "r");
+			if (mode == 1)
+				bulkLoad(db, inFile);
+			else
 			{
-				printf("Fatal seek error! Abort");
-				exit(4);
-			}
-			for (i = 0; i < BUCKETSIZE && found == 0; i++)
-			{
-				fread(&detect, sizeof(RECORD), 1, hashFile);
-				if (strcmp(detect.id, targetID) == 0) // found it!
-				{
-					printf("Deleting record:\n%s %s %d\n", detect.id, detect.name, detect.qty);
-					fseek(hashFile, -1L * (signed)sizeof(RECORD), SEEK_CUR);
-					fwrite(&emptyRecord, sizeof(RECORD), 1, hashFile);
-					found = 1;
-				}
-			}
-			// check the overflow area
-			fseek(hashFile, TABSIZE * BUCKETSIZE * sizeof(RECORD), SEEK_SET);
-			for (i = 0; i < OFLOWSIZE && found == 0; i++)
-			{
-				fread(&detect, sizeof(RECORD), 1, hashFile);
-				if (strcmp(detect.id, targetID) == 0) // found it!
+				while (fgets(line, 100, inFile))
 				{
-					printf("Deleting record from overflow:\n%s %s %d\n", detect.id, detect.name, detect.qty);
-					fseek(hashFile, -1L * (signed)sizeof(RECORD), SEEK_CUR);
-					fwrite(&emptyRecord, sizeof(RECORD), 1, hashFile);
-					found = 1;
+					if (parseLine(line, &newRecord) == PARSE_OK)
+						insert(&newRecord, db);
 				}
 			}
-			// not found
-			if (found == 0)
-				printf("Records with ID %s not found.\n", targetID);
+			fclose(inFile);
+			syncHashFile(db);
+		}
+		else if (!(db = openHashFile(BENCH_OUTPUT_FILENAME, BACKEND_STDIO)))
+		{
+			printf("Open benchmark could not reopen %s!\n", BENCH_OUTPUT_FILENAME);
+			exit(208);
 		}
+		total = clockMicros() - start;
+		printf("%8s %10ld %12.6f %10ld\n", modes[mode], db->nrecords, total / 1e6, db->nreads);
+		makeRecord(&rec, benchKey(n - 1, space));
+		if (db->nrecords != n || findRecord(db, rec.id, &found, &slot) < 0)
+			printf("Open benchmark lost records!\n");
+		closeHashFile(db);
 	}
+	remove(BENCH_INPUT_FILENAME);
+	removeHashFile(BENCH_OUTPUT_FILENAME);
 }
 
-/****************************USER_CONTROL****************************
-This function prompts the user to enter a code corresponding to 
-what task they want to do, and runs the specified function
-1: search
-2: insert from stdin
-3: insert from file
-4: delete
-Q: exit
+/****************************BENCH_PARSE****************************
+Writes an n-line input file (IDs repeat once n passes the key
+space; nothing is stored) and times parallelLoad() parsing it
+with 1, 2, 4 and 8 threads.
 */
-void user_control(FILE *hashFile)
+void bench_parse(long lines)
 {
-	char flag[10] = "";
-	while (printf("\nTo search the item database, press 1.\nTo insert from standard input, press 2.\n"),
-		   printf("To insert from a file, press 3.\nTo delete a record, press 4.\nTo quit, press Q.\n"),
-		   gets(flag), strcmp(flag, "q") != 0 && strcmp(flag, "Q") != 0)
+	long space = keySpace(), i, parsed;
+	double start, total, megabytes;
+	int threads;
+	RECORD rec;
+	FILE *inFile = fopen(BENCH_INPUT_FILENAME, "wb");
+
+	if (!inFile)
 	{
-		switch (*flag) // dereference flag (string) to get char
-		{
-		case '1':
-			search_record(hashFile);
-			break;
-		case '2':
-			insert_stdin(hashFile);
-			break;
-		case '3':
-			insert_file(hashFile);
-			break;
-		case '4':
-			delete_record(hashFile);
-			break;
-		default:
-			printf("%s is an invalid flag!\n", flag);
-			break;
-		}
-	}	
+		printf("Couldn't open %s for writing.\n", BENCH_INPUT_FILENAME);
+		exit(201);
+	}
+	for (i = 0; i < lines; i++)
+	{
+		makeRecord(&rec, benchKey(i % space, space));
+		fprintf(inFile, "%s,%s:%d\n", rec.id, rec.name, rec.qty);
+	}
+	megabytes = ftell(inFile) / 1048576.0;
+	fclose(inFile);
+
+	printf("%.0f MB, %ld lines\n", megabytes, lines);
+	printf("%8s %12s %14s %10s\n", "threads", "seconds", "lines/s", "MB/s");
+	for (threads = 1; threads <= 8; threads *= 2)
+	{
+		start = clockMicros();
+		parsed = parallelLoad(NULL, BENCH_INPUT_FILENAME, threads);
+		total = clockMicros() - start;
+		if (parsed != lines)
+			printf("Parse benchmark read %ld of %ld lines!\n", parsed, lines);
+		printf("%8d %12.3f %14.0f %10.1f\n", threads, total / 1e6,
+			parsed / total * 1e6, megabytes / total * 1e6);
+	}
+	remove(BENCH_INPUT_FILENAME);
+}
+
+/****************************BENCHMARK****************************
+Entry point for "HardwareDatabase -bench <test> [max records] [-mmap]
+[-ops N] [-json FILE]".
+Only compiled when BENCHMARK is defined.
+insert: insert throughput and latency as the table grows
+lookup: stdio vs mmap lookups with a warm and a cold page cache
+miss: negative lookups as the overflow pages fill up
+load: record-by-record load vs bulkLoad()
+open: rebuilding from the input file vs reopening the hash file
+churn: lookups after mass deletes, as compaction catches up
+ycsb: ops/sec and latency percentiles of five operation mixes, as JSON
+names: name and prefix queries through the name index vs a full scan
+range: ordered export and ID range scans by bitmap lookups vs a sorted scan
+stock: sum, low-stock and top-N queries on the quantity column vs a row scan
+probe: in-block probes/s at 25-100% fill, by key scan, scalar and SIMD control byte match
+multi: lookups, deletes and inserts one at a time vs batches of 1-4096
+aio: lookups and inserts through io_uring at queue depths 1-256 (O_DIRECT) vs the same reads one at a time
+threads: 95/5 lookup/update throughput on 1-16 threads sharing one table
+server: requests/s and latency of server mode at pipeline depths 1-128
+parse: input parsing throughput on 1-8 threads
+*/
+int benchmark(int argc, char *argv[])
+{
+	char *test = argc > 2 ? argv[2] : "insert", *jsonName = BENCH_JSON_FILENAME;
+	long maxRecords = argc > 3 ? atol(argv[3]) : 10000000, ops = BENCH_OPS;
+	int backend = BACKEND_STDIO, i;
+
+	for (i = 4; i < argc; i++)
+		if (strcmp(argv[i], "-mmap") == 0)
+			backend = BACKEND_MMAP;
+		else if (strcmp(argv[i], "-ops") == 0 && i + 1 < argc)
+			ops = atol(argv[++i]);
+		else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+			jsonName = argv[++i];
+
+	if (strcmp(test, "insert") == 0)
+		bench_insert(maxRecords, backend);
+	else if (strcmp(test, "lookup") == 0)
+		bench_lookup(maxRecords);
+	else if (strcmp(test, "miss") == 0)
+		bench_miss(maxRecords);
+	else if (strcmp(test, "load") == 0)
+		bench_load(maxRecords);
+	else if (strcmp(test, "open") == 0)
+		bench_open(maxRecords);
+	else if (strcmp(test, "pool") == 0)
+		bench_pool(maxRecords);
+	else if (strcmp(test, "wal") == 0)
+		bench_wal(maxRecords);
+	else if (strcmp(test, "churn") == 0)
+		bench_churn(maxRecords);
+	else if (strcmp(test, "ycsb") == 0)
+		bench_ycsb(maxRecords, ops, backend, jsonName);
+	else if (strcmp(test, "names") == 0)
+		bench_names(maxRecords);
+	else if (strcmp(test, "range") == 0)
+		bench_range(maxRecords);
+	else if (strcmp(test, "stock") == 0)
+		bench_stock(maxRecords);
+	else if (strcmp(test, "probe") == 0)
+		bench_probe(ops);
+	else if (strcmp(test, "multi") == 0)
+		bench_multi(maxRecords, ops);
+	else if (strcmp(test, "aio") == 0)
+		bench_aio(maxRecords, ops);
+#ifdef HAVE_PTHREADS
+	else if (strcmp(test, "threads") == 0)
+		bench_threads(maxRecords, ops);
+#endif
+#ifdef HAVE_EPOLL
+	else if (strcmp(test, "server") == 0)
+		bench_server(maxRecords, ops);
+#endif
+#ifndef _WIN32
+	else if (strcmp(test, "crash") == 0)
+		bench_crash(maxRecords);
+#endif
+	else if (strcmp(test, "parse") == 0)
+		bench_parse(maxRecords);
+	else
+	{
+		printf("%s is an invalid benchmark!\n", test);
+		return 1;
+	}
+	return 0;
 }
+#endif
+
 /******************************SAMPLE OUTPUT 1*********************************
 
 Deleting old output.txt
@@ -827,4 +9201,4 @@ q
 No Memory Leak
 Press any key to continue . . .
 
-*/
\ No newline at end of file
+*/